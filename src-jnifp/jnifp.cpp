@@ -49,7 +49,7 @@ int main(int argc, const char* argv[]) {
             }
         }
 
-        cf.computeFrames(&cp);
+        cf.computeFrames(&cp, true);
         cout << cf << endl;
         auto it = cf.getMethod("m1");
         if (it != cf.methods.end()) {
@@ -9,42 +9,64 @@ namespace jnif {
     void BasicBlock::addTarget(BasicBlock* target) {
         JnifError::check(cfg == target->cfg, "invalid owner for basic block");
 
-        targets.push_back(target);
-        target->ins.push_back(this);
+        _targets.push_back(target->id);
+        target->_ins.push_back(id);
+    }
+
+    string BasicBlock::name() const {
+        switch (id) {
+            case 0:
+                return ControlFlowGraph::EntryName;
+            case 1:
+                return ControlFlowGraph::ExitName;
+            default:
+                std::stringstream ss;
+                ss << "BB" << id - 2;
+                return ss.str();
+        }
     }
 
     static void addBasicBlock2(InstList::Iterator eit, InstList::Iterator& beginBb,
-                               int& bbid, ControlFlowGraph& cfg) {
+                               ControlFlowGraph& cfg) {
         if (beginBb != eit) {
-            std::stringstream ss;
-            ss << "BB" << bbid;
-            string name = ss.str();
-
-            cfg.addBasicBlock(beginBb, eit, name);
+            cfg.addBasicBlock(beginBb, eit);
 
             beginBb = eit;
-            bbid++;
         }
     }
 
-    static void buildBasicBlocks(InstList& instList, ControlFlowGraph& cfg) {
+    static void buildBasicBlocks(InstList& instList, ControlFlowGraph& cfg, const CodeAttr* code) {
         //setBranchTargets(instList);
 
-        int bbid = 0;
+        // Labels bounding a try range, indexed by label id.
+        vector<bool> tryBounds;
+        if (code != nullptr) {
+            for (const CodeAttr::ExceptionHandler& ex : code->exceptions) {
+                for (const Inst* bound : {ex.startpc, ex.endpc}) {
+                    u4 labelId = bound->label()->id;
+                    if (labelId >= tryBounds.size()) {
+                        tryBounds.resize(labelId + 1);
+                    }
+                    tryBounds[labelId] = true;
+                }
+            }
+        }
+
         InstList::Iterator beginBb = instList.begin();
 
         for (InstList::Iterator it = instList.begin(); it != instList.end(); ++it) {
             Inst* inst = *it;
 
             if (inst->isLabel()
-                && (inst->label()->isBranchTarget || inst->label()->isTryStart)) {
-                addBasicBlock2(it, beginBb, bbid, cfg);
+                && (inst->label()->isBranchTarget || inst->label()->isTryStart
+                    || ((u4) inst->label()->id < tryBounds.size() && tryBounds[inst->label()->id]))) {
+                addBasicBlock2(it, beginBb, cfg);
             }
 
             if (inst->isBranch() || inst->isExit()) {
                 InstList::Iterator eit = it;
                 ++eit;
-                addBasicBlock2(eit, beginBb, bbid, cfg);
+                addBasicBlock2(eit, beginBb, cfg);
             }
         }
     }
@@ -56,13 +78,37 @@ namespace jnif {
         bb->addTarget(tbbid);
     }
 
-    static void buildCfg(InstList& instList, ControlFlowGraph& cfg) {
-        buildBasicBlocks(instList, cfg);
+    /**
+     * Records the handlers covering each basic block.
+     * Blocks are split at try boundaries, so the offset of the first
+     * instruction decides for the whole block.
+     */
+    static void addHandlers(const CodeAttr& code, ControlFlowGraph& cfg) {
+        for (BasicBlock* bb : cfg) {
+            if (bb->start == cfg.instList.end()) {
+                continue;
+            }
+
+            int offset = (*bb->start)->_offset;
+            for (u4 i = 0; i < code.exceptions.size(); i++) {
+                const CodeAttr::ExceptionHandler& ex = code.exceptions[i];
+                if (ex.startpc->label()->_offset <= offset && offset < ex.endpc->label()->_offset) {
+                    bb->handlers.push_back(i);
+                }
+            }
+        }
+    }
+
+    static void buildCfg(InstList& instList, ControlFlowGraph& cfg, const CodeAttr* code) {
+        buildBasicBlocks(instList, cfg, code);
+
+        if (code != nullptr) {
+            addHandlers(*code, cfg);
+        }
 
         for (BasicBlock* bb : cfg) {
             if (bb->start == instList.end()) {
-                JnifError::assert(bb->name == ControlFlowGraph::EntryName || bb->name == ControlFlowGraph::ExitName,
-                                  "");
+                JnifError::assert(bb == cfg.entry || bb == cfg.exit, "");
                 JnifError::assert(bb->exit == instList.end(), "");
                 continue;
             }
@@ -86,6 +132,7 @@ namespace jnif {
                 }
                 bb->last = last;
             } else if (last->isTableSwitch()) {
+                bb->reserveTargets(last->ts()->targets.size() + 1);
                 addTarget2(bb, last->ts()->def, cfg);
 
                 for (Inst* target : last->ts()->targets) {
@@ -93,6 +140,7 @@ namespace jnif {
                 }
                 bb->last = last;
             } else if (last->isLookupSwitch()) {
+                bb->reserveTargets(last->ls()->targets.size() + 1);
                 addTarget2(bb, last->ls()->defbyte, cfg);
 
                 for (Inst* target : last->ls()->targets) {
@@ -110,10 +158,10 @@ namespace jnif {
     }
 
     ControlFlowGraph::ControlFlowGraph(InstList& instList) :
-            entry(addConstBb(instList, ".Entry")),
-            exit(addConstBb(instList, ".Exit")),
-            instList(instList) {
-        buildCfg(instList, *this);
+            instList(instList),
+            entry(addConstBb()),
+            exit(addConstBb()) {
+        buildCfg(instList, *this, nullptr);
 
         // std::vector<BasicBlock*>::iterator it = basicBlocks.begin();
         // JnifError::assert((*it)->name == EntryName, "Invalid entry");
@@ -124,15 +172,25 @@ namespace jnif {
         // basicBlocks.erase(it);
     }
 
+    ControlFlowGraph::ControlFlowGraph(CodeAttr& code) :
+            instList(code.instList),
+            entry(addConstBb()),
+            exit(addConstBb()) {
+        buildCfg(code.instList, *this, &code);
+    }
+
     ControlFlowGraph::~ControlFlowGraph() {
-        for (auto bb : *this) {
-            delete bb;
+        // The memory is released with the arena of the class file.
+        for (BasicBlock* bb : *this) {
+            bb->~BasicBlock();
         }
     }
 
     BasicBlock* ControlFlowGraph::addBasicBlock(InstList::Iterator start,
-                                                InstList::Iterator end, const string& name) {
-        BasicBlock* const bb = new BasicBlock(start, end, name, this);
+                                                InstList::Iterator end) {
+        Arena& arena = instList.constPool->_arena;
+        void* buf = arena.alloc(sizeof(BasicBlock), alignof(BasicBlock));
+        BasicBlock* const bb = new(buf) BasicBlock(start, end, basicBlocks.size(), this, &arena);
 
         if (basicBlocks.size() > 0) {
             BasicBlock* prevbb = basicBlocks.back();
@@ -141,27 +199,36 @@ namespace jnif {
 
         basicBlocks.push_back(bb);
 
+        if (start != end && (*start)->isLabel()) {
+            u4 labelId = (*start)->label()->id;
+            if (labelId >= labelBlocks.size()) {
+                labelBlocks.resize(labelId + 1, nullptr);
+            }
+
+            labelBlocks[labelId] = bb;
+        }
+
         return bb;
     }
 
     BasicBlock* ControlFlowGraph::findBasicBlockOfLabel(int labelId) const {
-        for (BasicBlock* bb : *this) {
-            if (bb->start == instList.end()) {
-                JnifError::assert(bb->name == EntryName || bb->name == ExitName, "");
-                JnifError::assert(bb->exit == instList.end(), "");
-                continue;
-            }
-
-            Inst* inst = *bb->start;
-            if (inst->isLabel() && inst->label()->id == labelId) {
-                return bb;
-            }
+        if (labelId >= 0 && (u4) labelId < labelBlocks.size() && labelBlocks[labelId] != nullptr) {
+            return labelBlocks[labelId];
         }
 
         throw Exception("Invalid label id: ", labelId, " for the instruction list: ",
                         ", in cfg: ", *this, instList);
     }
 
+    u4 ControlFlowGraph::visits() const {
+        u4 total = 0;
+        for (const BasicBlock* bb : *this) {
+            total += bb->visits;
+        }
+
+        return total;
+    }
+
     ControlFlowGraph::D ControlFlowGraph::dominance(BasicBlock*) {
         ControlFlowGraph& cfg = *this;
         map<BasicBlock*, set<BasicBlock*> > ds;
@@ -176,7 +243,7 @@ namespace jnif {
 
             for (BasicBlock* bb : cfg) {
                 set<BasicBlock*> ns;
-                for (BasicBlock* p : bb->targets) {
+                for (BasicBlock* p : bb->targets()) {
                     if (ns.empty()) {
                         ns = ds[p];
                     } else {
@@ -342,12 +409,11 @@ namespace jnif {
                     frame.popArray(&inst);
                     frame.pushFloat(&inst);
                     break;
-                case Opcode::daload: {
+                case Opcode::daload:
                     frame.popIntegral(&inst);
-                    Type arrayType = frame.popArray(&inst);
+                    frame.popArray(&inst);
                     frame.pushDouble(&inst);
                     break;
-                }
                 case Opcode::aaload:
                     aaload(inst);
                     break;
@@ -820,8 +886,7 @@ namespace jnif {
     private:
 
         void newinst(TypeInst& inst) {
-            const string& className = cp.getClassName(inst.type()->classIndex);
-            const Type& t = TypeFactory::fromConstClass(className);
+            const Type& t = TypeFactory::fromConstClass(cp, inst.type()->classIndex);
             t.init = false;
             t.typeId = Type::nextTypeId;
             Type::nextTypeId++;
@@ -839,8 +904,7 @@ namespace jnif {
 
         void anewarray(Inst& inst) {
             frame.popIntegral(&inst);
-            const string& className = cp.getClassName(inst.type()->classIndex);
-            const Type& t = TypeFactory::fromConstClass(className);
+            const Type& t = TypeFactory::fromConstClass(cp, inst.type()->classIndex);
             frame.pushArray(t, t.getDims() + 1, &inst);
         }
 
@@ -866,10 +930,10 @@ namespace jnif {
                     frame.pushFloat(&inst);
                     break;
                 case ConstPool::CLASS:
-                    frame.pushRef(cp.getClassName(inst.ldc()->valueIndex), &inst);
+                    frame.push(TypeFactory::objectType(cp.getClassSymbol(inst.ldc()->valueIndex)), &inst);
                     break;
                 case ConstPool::STRING:
-                    frame.pushRef("java/lang/String", &inst);
+                    frame.push(TypeFactory::objectType(ClassNames::STRING), &inst);
                     break;
                 default:
                     throw Exception("Invalid tag entry: ", tag);
@@ -898,8 +962,7 @@ namespace jnif {
 
         void checkcast(Inst& inst) {
             frame.popRef(&inst);
-            const string& className = cp.getClassName(inst.type()->classIndex);
-            frame.push(TypeFactory::fromConstClass(className), &inst);
+            frame.push(TypeFactory::fromConstClass(cp, inst.type()->classIndex), &inst);
         }
 
         void istore(int lvindex, Inst* inst) {
@@ -1057,8 +1120,7 @@ namespace jnif {
                 frame.popIntegral(&inst);
             }
 
-            string arrayClassName = cp.getClassName(inst.multiarray()->classIndex);
-            const char* d = arrayClassName.c_str();
+            const char* d = cp.getClassName(inst.multiarray()->classIndex);
             Type arrayType = TypeFactory::fromFieldDesc(d);
 
             frame.pushType(arrayType, &inst);
@@ -1143,9 +1205,72 @@ namespace jnif {
     //     return os;
     // }
 
+    /**
+     * The in and out frames of the basic blocks while computing them.
+     *
+     * Frames with def-use tracking are kept aside, indexed by basic block
+     * id, and only their types are stored into the basic blocks at the end.
+     */
+    template<class TFrame>
+    class BlockFrames {
+    public:
+
+        explicit BlockFrames(const ControlFlowGraph& cfg) : ins(cfg.size()), outs(cfg.size()) {
+        }
+
+        TFrame& in(BasicBlock& bb) {
+            return ins[bb.id];
+        }
+
+        TFrame& out(BasicBlock& bb) {
+            return outs[bb.id];
+        }
+
+        void store(ControlFlowGraph& cfg) {
+            for (BasicBlock* bb : cfg) {
+                if (ins[bb->id].valid) {
+                    bb->in = Frame(ins[bb->id]);
+                }
+
+                if (outs[bb->id].valid) {
+                    bb->out = Frame(outs[bb->id]);
+                }
+            }
+        }
+
+    private:
+        vector<TFrame> ins;
+        vector<TFrame> outs;
+    };
+
+    /**
+     * Frames without def-use tracking are computed in place.
+     */
+    template<>
+    class BlockFrames<Frame> {
+    public:
+
+        explicit BlockFrames(const ControlFlowGraph&) {
+        }
+
+        Frame& in(BasicBlock& bb) {
+            return bb.in;
+        }
+
+        Frame& out(BasicBlock& bb) {
+            return bb.out;
+        }
+
+        void store(ControlFlowGraph&) {
+        }
+    };
+
+    template<class TFrame>
     class ComputeFrames {
     public:
 
+        typedef typename TFrame::T T;
+
         bool isAssignable(const Type& subt, const Type& supt) {
             if (subt == supt) {
                 return true;
@@ -1167,23 +1292,24 @@ namespace jnif {
             return false;
         }
 
-        string getCommonSuperClass(const string& classLeft,
-                                   const string& classRight, IClassPath* classPath) {
-            if (classLeft == "java/lang/Object"
-                || classRight == "java/lang/Object") {
-                return "java/lang/Object";
+        ClassNames::Symbol getCommonSuperClass(ClassNames::Symbol classLeft,
+                                               ClassNames::Symbol classRight, IClassPath* classPath) {
+            if (classLeft == ClassNames::OBJECT
+                || classRight == ClassNames::OBJECT) {
+                return ClassNames::OBJECT;
             }
 
-            return classPath->getCommonSuperClass(classLeft, classRight);
+            return ClassNames::intern(classPath->getCommonSuperClass(
+                    ClassNames::name(classLeft), ClassNames::name(classRight)));
         }
 
         bool assign(Type& t, Type o, IClassPath* classPath) {
             if (!isAssignable(t, o) && !isAssignable(o, t)) {
                 if (t.isClass() && o.isClass()) {
-                    string clazz1 = t.getClassName();
-                    string clazz2 = o.getClassName();
+                    ClassNames::Symbol clazz1 = t.getClassSymbol();
+                    ClassNames::Symbol clazz2 = o.getClassSymbol();
 
-                    string res = getCommonSuperClass(clazz1, clazz2, classPath);
+                    ClassNames::Symbol res = getCommonSuperClass(clazz1, clazz2, classPath);
 
                     Type superClass = TypeFactory::objectType(res);
                     JnifError::assert((superClass == t) == (res == clazz1),
@@ -1199,7 +1325,7 @@ namespace jnif {
 
                 if (t.isArray() && o.isArray()) {
                     if (t.getDims() != o.getDims()) {
-                        t = TypeFactory::objectType("java/lang/Object");
+                        t = TypeFactory::objectType(ClassNames::OBJECT);
                         return true;
                     }
 
@@ -1217,7 +1343,7 @@ namespace jnif {
 //						" and ", o,
 //						" should have not change assign result to Top.");
                     if (st.isTop()) {
-                        t = TypeFactory::objectType("java/lang/Object");
+                        t = TypeFactory::objectType(ClassNames::OBJECT);
                         return true;
                     }
 
@@ -1226,7 +1352,7 @@ namespace jnif {
                 }
 
                 if ((t.isClass() && o.isArray()) || (t.isArray() && o.isClass())) {
-                    t = TypeFactory::objectType("java/lang/Object");
+                    t = TypeFactory::objectType(ClassNames::OBJECT);
                     return true;
                 }
 
@@ -1253,25 +1379,28 @@ namespace jnif {
         }
 
 
-        bool includes(const std::set<Inst*>& xs, const std::set<Inst*>& ys) {
-            for (Inst* y : ys) {
-                if (xs.find(y) == xs.end()) {
-                    return false;
-                }
+        /**
+         * Joins the definitions of two slots into both of them, returning
+         * whether they grew.
+         */
+        bool joinDefs(typename TFrame::Defs& xs, typename TFrame::Defs& ys) {
+            if (xs.includes(ys)) {
+                return false;
             }
 
+            xs.insert(ys);
+            ys.insert(xs);
             return true;
         }
 
-        bool join(Frame& frame, Frame& how,
+        bool join(TFrame& frame, TFrame& how,
                   IClassPath* classPath, Method* method = NULL) {
             JnifError::check(frame.stack.size() == how.stack.size(),
                              "Different stack sizes: ", frame.stack.size(), " != ",
                              how.stack.size(), ": #", frame, " != #", how, "Method: ",
                              method);
 
-            std::set<Inst*> ls;
-            const Frame::T defType = std::make_pair(TypeFactory::topType(), ls);
+            const T defType(TypeFactory::topType(), typename TFrame::Defs());
             if (frame.lva.size() < how.lva.size()) {
                 frame.lva.resize(how.lva.size(), defType);
             } else if (how.lva.size() < frame.lva.size()) {
@@ -1285,36 +1414,16 @@ namespace jnif {
 
             for (u4 i = 0; i < frame.lva.size(); i++) {
                 bool assignChanged = assign(frame.lva[i].first, how.lva[i].first, classPath);
+                bool defsChanged = joinDefs(frame.lva[i].second, how.lva[i].second);
 
-                std::set<Inst*>& xs = frame.lva[i].second;
-                std::set<Inst*>& ys = how.lva[i].second;
-
-                if (!includes(xs, ys)) {
-                    // std::cerr << "lva" << " xs: " << xs << "ys: " << ys << std::endl;
-                    xs.insert(ys.begin(), ys.end());
-                    ys.insert(xs.begin(), xs.end());
-                    change = true;
-                }
-
-                change = change || assignChanged;
+                change = change || assignChanged || defsChanged;
             }
 
-            std::list<Frame::T>::iterator i = frame.stack.begin();
-            std::list<Frame::T>::iterator j = how.stack.begin();
-
-            for (; i != frame.stack.end(); i++, j++) {
-                bool assignChanged = assign(i->first, j->first, classPath);
+            for (u4 i = 0; i < frame.stack.size(); i++) {
+                bool assignChanged = assign(frame.stack[i].first, how.stack[i].first, classPath);
+                bool defsChanged = joinDefs(frame.stack[i].second, how.stack[i].second);
 
-                std::set<Inst*>& xs = i->second;
-                std::set<Inst*>& ys = j->second;
-                if (!includes(xs, ys)) {
-                    // std::cerr << "stack" << " xs: " << xs << "ys: " << ys << std::endl;
-                    xs.insert(ys.begin(), ys.end());
-                    ys.insert(xs.begin(), xs.end());
-                    change = true;
-                }
-
-                change = change || assignChanged;
+                change = change || assignChanged || defsChanged;
             }
 
             return change;
@@ -1322,95 +1431,200 @@ namespace jnif {
 
         Type getExceptionType(const ConstPool& cp, ConstPool::Index catchIndex) {
             if (catchIndex != ConstPool::NULLENTRY) {
-                const string& className = cp.getClassName(catchIndex);
-                return TypeFactory::fromConstClass(className);
+                return TypeFactory::fromConstClass(cp, catchIndex);
             } else {
-                return TypeFactory::objectType("java/lang/Throwable");
+                return TypeFactory::objectType(ClassNames::THROWABLE);
             }
         }
 
-        void visitCatch(const CodeAttr::ExceptionHandler& ex, InstList& instList,
-                        const ClassFile& cf, const CodeAttr* code, IClassPath* classPath,
-                        const ControlFlowGraph* cfg, Frame frame, Method* method) {
-            int handlerPcId = ex.handlerpc->label()->id;
-            BasicBlock* handlerBb = cfg->findBasicBlockOfLabel(handlerPcId);
+        /**
+         * Computes the in and out frames of the basic blocks reachable from
+         * bb, where how is the frame coming into bb.
+         *
+         * A worklist is solved iteratively, instead of recursing into the
+         * successors, so large methods do not overflow the native stack.
+         * Blocks are taken in reverse post-order, and a block is queued
+         * at most once however many of its predecessors change its in frame.
+         */
+        void computeState(BasicBlock& bb, TFrame& how, const ClassFile& cf,
+                          const CodeAttr* code, IClassPath* classPath, Method* method) {
+            ControlFlowGraph& cfg = *bb.cfg;
+            BlockFrames<TFrame> frames(cfg);
+
+            vector<BasicBlock*> handlers;
+            vector<Type> exTypes;
+            handlers.reserve(code->exceptions.size());
+            exTypes.reserve(code->exceptions.size());
+            for (const CodeAttr::ExceptionHandler& ex : code->exceptions) {
+                handlers.push_back(cfg.findBasicBlockOfLabel(ex.handlerpc->label()->id));
+                exTypes.push_back(getExceptionType(cf, ex.catchtype));
+            }
 
-//		Type exType = [&]() {
-//			if (ex.catchtype != ConstPool::NULLENTRY) {
-//				const String& className = cf.getClassName(ex.catchtype);
-//				return Type::fromConstClass(className);
-//			} else {
-//				return Type::objectType("java/lang/Throwable");
-//			}
-//		}();
-            const Type& exType = getExceptionType(cf, ex.catchtype);
+            computeOrder(bb, code, cfg);
 
-            frame.clearStack();
-            frame.push(exType, nullptr);
+            merge(bb, how, frames, classPath, method);
 
-            computeState(*handlerBb, frame, instList, cf, code, classPath, method);
-        }
+            while (!worklist.empty()) {
+                BasicBlock& next = *worklist.begin()->second;
+                worklist.erase(worklist.begin());
+
+                next.visits++;
+
+                TFrame out = frames.in(next);
 
-        bool contains(const CodeAttr::ExceptionHandler& ex, const Inst* inst) {
-            int start = ex.startpc->label()->_offset;
-            int end = ex.endpc->label()->_offset;
-            int off = inst->_offset;
+                // The locals after each instruction, joined, enter the
+                // handlers covering this block once.
+                TFrame catchFrame;
+
+                SmtBuilder<TFrame> builder(out, cf);
+                for (InstList::Iterator it = next.start; it != next.exit; ++it) {
+                    Inst* inst = *it;
+                    builder.exec(*inst);
+
+                    if (!next.handlers.empty()) {
+                        joinLocals(catchFrame, out, classPath);
+                    }
+                }
 
-            return start <= off && off < end;
+                for (u4 i : next.handlers) {
+                    TFrame frame = catchFrame;
+                    frame.push(exTypes[i], nullptr);
+
+                    merge(*handlers[i], frame, frames, classPath, method);
+                }
+
+                frames.out(next) = out;
+                TFrame h = std::move(out);
+
+                for (BasicBlock* nid : next) {
+                    merge(*nid, h, frames, classPath, method);
+                }
+            }
+
+            frames.store(cfg);
         }
 
-        int s = 0;
+    private:
 
-        void computeState(BasicBlock& bb, Frame& how, InstList& instList,
-                          const ClassFile& cf, const CodeAttr* code, IClassPath* classPath,
-                          Method* method) {
-            s++;
-            // std::cerr << s << " " << std::flush;
-            if (bb.start == instList.end()) {
-                JnifError::assert(bb.name == ControlFlowGraph::ExitName && bb.exit == instList.end(),
-                                  "exit bb");
-                s--;
+        /**
+         * Joins the locals of how into the ones of frame, with an empty
+         * stack, leaving how untouched.
+         */
+        void joinLocals(TFrame& frame, const TFrame& how, IClassPath* classPath) {
+            if (!frame.valid) {
+                frame = how;
+                frame.clearStack();
+                return;
+            }
+
+            if (frame.lva.size() < how.lva.size()) {
+                frame.lva.resize(how.lva.size(), T(TypeFactory::topType(), typename TFrame::Defs()));
+            }
+
+            for (u4 i = 0; i < frame.lva.size(); i++) {
+                if (i < how.lva.size()) {
+                    assign(frame.lva[i].first, how.lva[i].first, classPath);
+                    frame.lva[i].second.insert(how.lva[i].second);
+                } else {
+                    assign(frame.lva[i].first, TypeFactory::topType(), classPath);
+                }
+            }
+        }
+
+        /**
+         * Joins how into the in frame of bb, and queues bb when it changes.
+         */
+        void merge(BasicBlock& bb, TFrame& how, BlockFrames<TFrame>& frames,
+                   IClassPath* classPath, Method* method) {
+            if (bb.start == bb.cfg->instList.end()) {
+                JnifError::assert(&bb == bb.cfg->exit, "exit bb");
                 return;
             }
 
             JnifError::assert(how.valid, "how valid");
-            //JnifError::assert(bb.in.valid == bb.out.valid, "in.valid != out.valid");
+
+            TFrame& in = frames.in(bb);
 
             bool change;
-            if (!bb.in.valid) {
-                bb.in = how;
+            if (!in.valid) {
+                in = how;
                 change = true;
             } else {
-                change = join(bb.in, how, classPath, method);
+                change = join(in, how, classPath, method);
             }
 
             if (change) {
-                Frame out = bb.in;
+                worklist.insert({order[bb.id], &bb});
+            }
+        }
 
-                SmtBuilder<Frame> builder(out, cf);
-                for (InstList::Iterator it = bb.start; it != bb.exit; ++it) {
-                    Inst* inst = *it;
-                    builder.exec(*inst);
-                    //prepareCatchHandlerFrame(inst, out);
+        /**
+         * Numbers the basic blocks reachable from bb in reverse post-order.
+         * An exception handler is taken as a successor of the block
+         * starting its try range.
+         */
+        void computeOrder(BasicBlock& bb, const CodeAttr* code, const ControlFlowGraph& cfg) {
+            // Indexed by basic block id.
+            vector<vector<BasicBlock*>> handlerEdges(cfg.size());
+            for (const CodeAttr::ExceptionHandler& ex : code->exceptions) {
+                handlerEdges[cfg.findBasicBlockOfLabel(ex.startpc->label()->id)->id].push_back(
+                        cfg.findBasicBlockOfLabel(ex.handlerpc->label()->id));
+            }
 
-                    //join(typeFactory, outp, out, classPath, method);
+            vector<BasicBlock*> postOrder;
+            vector<bool> visited(cfg.size());
 
-                    for (const CodeAttr::ExceptionHandler& ex : code->exceptions) {
-                        if (contains(ex, inst)) {
-                            visitCatch(ex, instList, cf, code, classPath, bb.cfg, out, method);
-                        }
+            // Each stack entry is a block and the index of its next successor.
+            vector<std::pair<BasicBlock*, u4>> stack;
+            stack.push_back({&bb, 0});
+            visited[bb.id] = true;
+
+            while (!stack.empty()) {
+                BasicBlock* current = stack.back().first;
+                u4 i = stack.back().second++;
+
+                const vector<BasicBlock*>& handlers = handlerEdges[current->id];
+                BasicBlock::Blocks targets = current->targets();
+
+                u4 targetCount = targets.size();
+                if (i < targetCount + handlers.size()) {
+                    BasicBlock* succ = i < targetCount ? targets[i] : handlers[i - targetCount];
+                    if (!visited[succ->id]) {
+                        visited[succ->id] = true;
+                        stack.push_back({succ, 0});
                     }
+                } else {
+                    postOrder.push_back(current);
+                    stack.pop_back();
                 }
+            }
 
-                bb.out = out;
-                Frame h = bb.out;
+            u4 n = postOrder.size();
+            order.assign(cfg.size(), 0);
+            for (u4 i = 0; i < n; i++) {
+                order[postOrder[i]->id] = n - 1 - i;
+            }
 
-                for (BasicBlock* nid : bb) {
-                    computeState(*nid, h, instList, cf, code, classPath, method);
+            // Handlers whose try range starts in an unreachable block
+            // go last.
+            for (BasicBlock* b : cfg) {
+                if (!visited[b->id]) {
+                    order[b->id] = n++;
                 }
             }
-            s--;
         }
+
+        /**
+         * The reverse post-order position of each basic block, indexed by
+         * basic block id.
+         */
+        vector<u4> order;
+
+        /**
+         * The blocks whose in frame changed since they were last visited,
+         * ordered by position.
+         */
+        std::set<std::pair<u4, BasicBlock*>> worklist;
     };
 
     class FrameGenerator {
@@ -1445,11 +1659,11 @@ namespace jnif {
             }
         }
 
-        void computeFrames(CodeAttr* code, Method* method) {
+        void computeFrames(CodeAttr* code, Method* method, bool trackDefUse) {
             for (auto it = code->attrs.begin(); it != code->attrs.end(); it++) {
                 Attr* attr = *it;
                 if (attr->kind == ATTR_SMT) {
-                    code->attrs.attrs.erase(it);
+                    code->attrs.remove(it);
                     break;
                 }
             }
@@ -1458,50 +1672,16 @@ namespace jnif {
                 _attrIndex = _cf.putUtf8("StackMapTable");
             }
 
-            Frame initFrame;
-
-            u4 lvindex;
-            if (method->isStatic()) {
-                lvindex = 0;
-            } else {
-                //|| method->isClassInit()
-                string className = _cf.getThisClassName();
-                if (method->isInit()) {
-                    Type u = TypeFactory::uninitThisType();
-                    u.init = false;
-                    u.typeId = Type::nextTypeId;
-                    u.className = className;
-                    Type::nextTypeId++;
-                    initFrame.setVar2(0, u, nullptr);
-                } else {
-                    initFrame.setRefVar(0, className, nullptr);
-                }
-
-                lvindex = 1;
-            }
-
-            const char* methodDesc = _cf.getUtf8(method->descIndex);
-            std::vector<Type> argsType;
-            TypeFactory::fromMethodDesc(methodDesc, &argsType);
-
-            for (Type t : argsType) {
-                initFrame.setVar(&lvindex, t, nullptr);
-            }
-
-            ControlFlowGraph* cfgp = new ControlFlowGraph(code->instList);
+            ControlFlowGraph* cfgp = _cf._arena.own(new ControlFlowGraph(*code));
             code->cfg = cfgp;
 
             ControlFlowGraph& cfg = *cfgp;
 
-            initFrame.valid = true;
-            BasicBlock* bbe = cfg.entry;
-            bbe->in = initFrame;
-            bbe->out = initFrame;
-
-            BasicBlock* to = *cfg.entry->begin();
-            ComputeFrames comp;
-            comp.computeState(*to, initFrame, code->instList, _cf, code, _classPath,
-                              method);
+            if (trackDefUse) {
+                computeState<DefUseFrame>(code, method, cfg);
+            } else {
+                computeState<Frame>(code, method, cfg);
+            }
 
             u4 maxStack = code->maxStack;
             if (!code->instList.hasBranches() && !code->hasTryCatch()) {
@@ -1519,7 +1699,7 @@ namespace jnif {
                 return;
             }
 
-            SmtAttr* smt = new SmtAttr(_attrIndex, &_cf);
+            SmtAttr* smt = _cf._arena.create<SmtAttr>(_attrIndex, &_cf);
 
             int totalOffset = -1;
 
@@ -1529,19 +1709,38 @@ namespace jnif {
             class Ser {
             public:
 
+                /**
+                 * Compares the types of the locals only, the defining
+                 * instructions are not part of a stack map frame and
+                 * depend on the order the blocks were visited.
+                 */
+                bool isSameLocals(Frame& current, Frame& prev) {
+                    if (current.lva.size() != prev.lva.size()) {
+                        return false;
+                    }
+
+                    for (u4 i = 0; i < current.lva.size(); ++i) {
+                        if (current.lva[i].first != prev.lva[i].first) {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+
                 bool isSame(Frame& current, Frame& prev) {
-                    return current.lva == prev.lva && current.stack.size() == 0;
+                    return isSameLocals(current, prev) && current.stack.size() == 0;
                 }
 
                 bool isSameLocals1StackItem(Frame& current, Frame& prev) {
-                    return current.lva == prev.lva && current.stack.size() == 1;
+                    return isSameLocals(current, prev) && current.stack.size() == 1;
                 }
 
                 int isChopAppend(Frame& current, Frame& prev) {
                     int diff = current.lva.size() - prev.lva.size();
 
                     for (u4 i = 0; i < std::min(current.lva.size(), prev.lva.size()); ++i) {
-                        if (current.lva.at(i) != prev.lva.at(i)) {
+                        if (current.lva.at(i).first != prev.lva.at(i).first) {
                             return 0;
                         }
                     }
@@ -1571,7 +1770,7 @@ namespace jnif {
 
                         setCpIndex(current, code->instList);
 
-                        SmtAttr::Entry e;
+                        SmtAttr::Entry e(smt->arena());
 
                         e.label = start;
 
@@ -1590,11 +1789,11 @@ namespace jnif {
                         } else if (s.isSameLocals1StackItem(current, *f)) {
                             if (offsetDelta <= 63) {
                                 e.frameType = 64 + offsetDelta;
-                                const Type& t = current.stack.front().first;
+                                const Type& t = current.stack.back().first;
                                 e.sameLocals_1_stack_item_frame.stack.push_back(t);
                             } else {
                                 e.frameType = 247;
-                                const Type& t = current.stack.front().first;
+                                const Type& t = current.stack.back().first;
                                 e.same_locals_1_stack_item_frame_extended.stack.push_back(
                                         t);
                                 e.same_locals_1_stack_item_frame_extended.offset_delta =
@@ -1623,18 +1822,12 @@ namespace jnif {
                         } else {
                             e.frameType = 255;
                             e.full_frame.offset_delta = offsetDelta;
-                            std::vector<Type> lva(current.lva.size(), TypeFactory::topType());
-                            for (size_t i = 0; i < current.lva.size(); i++) {
-                                lva[i] = current.lva[i].first;
+                            for (const Frame::T& t : current.lva) {
+                                e.full_frame.locals.push_back(t.first);
                             }
 
-                            e.full_frame.locals = lva;
-
-                            std::list<Frame::T> rs = current.stack;
-                            rs.reverse();
-                            for (const Frame::T& t : rs) {
+                            for (const Frame::T& t : current.stack) {
                                 e.full_frame.stack.push_back(t.first);
-                                //e.full_frame.stack.push_front(t);
                             }
                         }
 
@@ -1654,50 +1847,100 @@ namespace jnif {
 
     private:
 
+        /**
+         * Computes the in and out frames of the basic blocks of cfg, with
+         * the def-use policy of TFrame.
+         */
+        template<class TFrame>
+        void computeState(CodeAttr* code, Method* method, ControlFlowGraph& cfg) {
+            TFrame initFrame;
+            initFrame.reserve(code->maxLocals, code->maxStack);
+
+            u4 lvindex;
+            if (method->isStatic()) {
+                lvindex = 0;
+            } else {
+                //|| method->isClassInit()
+                ClassNames::Symbol className = _cf.getClassSymbol(_cf.thisClassIndex);
+                if (method->isInit()) {
+                    Type u = TypeFactory::uninitThisType(className);
+                    u.init = false;
+                    u.typeId = Type::nextTypeId;
+                    Type::nextTypeId++;
+                    initFrame.setVar2(0, u, nullptr);
+                } else {
+                    initFrame.setRefVar(0, TypeFactory::objectType(className), nullptr);
+                }
+
+                lvindex = 1;
+            }
+
+            const char* methodDesc = _cf.getUtf8(method->descIndex);
+            std::vector<Type> argsType;
+            TypeFactory::fromMethodDesc(methodDesc, &argsType);
+
+            for (Type t : argsType) {
+                initFrame.setVar(&lvindex, t, nullptr);
+            }
+
+            initFrame.valid = true;
+            BasicBlock* bbe = cfg.entry;
+            bbe->in = Frame(initFrame);
+            bbe->out = bbe->in;
+
+            BasicBlock* to = *cfg.entry->begin();
+            ComputeFrames<TFrame> comp;
+            comp.computeState(*to, initFrame, _cf, code, _classPath, method);
+        }
+
         ConstPool::Index _attrIndex;
         ClassFile& _cf;
         IClassPath* _classPath;
 
     };
 
-    static void setLink(const std::set<Inst*>& is, Inst* j) {
+    void InstDefs::link(Inst* j) const {
         JnifError::assert(j != nullptr, "j cannot be null");
-        for (Inst* i : is) {
+        for (Inst* i : defs) {
             JnifError::assert(i != nullptr, "i cannot be null");
-            j->consumes.insert(i);
-            i->produces.insert(j);
+            j->consumes.insert(i, j->arena());
+            i->produces.insert(j, i->arena());
         }
     }
 
-    Type Frame::getVar(u4 lvindex, Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::getVar(u4 lvindex, Inst* inst) {
         JnifError::assert(inst != nullptr, "Inst cannot be null for getVar");
 
-        const T* t = &lva.at(lvindex);
-        setLink(t->second, inst);
+        const T& t = lva.at(lvindex);
+        t.second.link(inst);
 
-        return t->first;
+        return t.first;
     }
 
-    Type Frame::pop(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::pop(Inst* inst) {
         JnifError::check(stack.size() > 0, "Trying to pop in an empty stack.");
         JnifError::assert(inst != nullptr, "Inst cannot be null");
 
-        const T* t = &stack.front();
-        setLink(t->second, inst);
-        Type ret = t->first;
-        stack.pop_front();
+        const T& t = stack.back();
+        t.second.link(inst);
+        Type ret = t.first;
+        stack.pop_back();
 
         return ret;
     }
 
-    Type Frame::popOneWord(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::popOneWord(Inst* inst) {
         Type t = pop(inst);
         JnifError::check(t.isOneWord() || t.isTop(), "Type is not one word type: ", t,
                          ", frame: ", *this);
         return t;
     }
 
-    Type Frame::popTwoWord(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::popTwoWord(Inst* inst) {
         Type t1 = pop(inst);
         Type t2 = pop(inst);
 
@@ -1709,32 +1952,37 @@ namespace jnif {
         return t1;
     }
 
-    Type Frame::popIntegral(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::popIntegral(Inst* inst) {
         Type t = popOneWord(inst);
         JnifError::assert(t.isIntegral(), "Invalid integral type on top of stack: ", t);
         return t;
     }
 
-    Type Frame::popFloat(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::popFloat(Inst* inst) {
         Type t = popOneWord(inst);
         JnifError::assert(t.isFloat(), "invalid float type on top of the stack");
         return t;
     }
 
-    Type Frame::popLong(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::popLong(Inst* inst) {
         Type t = popTwoWord(inst);
         JnifError::check(t.isLong(), "invalid long type on top of the stack");
         return t;
     }
 
-    Type Frame::popDouble(Inst* inst) {
+    template<class TDefs>
+    Type BasicFrame<TDefs>::popDouble(Inst* inst) {
         Type t = popTwoWord(inst);
         JnifError::check(t.isDouble(), "Invalid double type on top of the stack: ", t);
 
         return t;
     }
 
-    void Frame::popType(const Type& type, Inst* inst) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::popType(const Type& type, Inst* inst) {
         if (type.isIntegral()) {
             popIntegral(inst);
         } else if (type.isFloat()) {
@@ -1750,13 +1998,9 @@ namespace jnif {
         }
     }
 
-    void Frame::push(const Type& t, Inst* inst) {
-        std::set<Inst*> ls;
-        if (inst != nullptr) {
-            ls.insert(inst);
-        }
-
-        stack.push_front(std::make_pair(t, ls));
+    template<class TDefs>
+    void BasicFrame<TDefs>::push(const Type& t, Inst* inst) {
+        stack.push_back(T(t, TDefs(inst)));
 
         if (maxStack < stack.size()) {
             JnifError::assert(maxStack + 1 == stack.size(), "Invalid inc maxStack/size");
@@ -1764,7 +2008,8 @@ namespace jnif {
         }
     }
 
-    void Frame::pushType(const Type& type, Inst* inst) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::pushType(const Type& type, Inst* inst) {
         if (type.isIntegral()) {
             pushInt(inst);
         } else if (type.isFloat()) {
@@ -1782,7 +2027,8 @@ namespace jnif {
         }
     }
 
-    void Frame::setVar(u4* lvindex, const Type& t, Inst* inst) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::setVar(u4* lvindex, const Type& t, Inst* inst) {
         JnifError::assert(t.isOneOrTwoWord(),
                           "Setting var on non one-two word uninit this");
 
@@ -1796,17 +2042,20 @@ namespace jnif {
         }
     }
 
-    void Frame::setVar2(u4 lvindex, const Type& t, Inst* inst) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::setVar2(u4 lvindex, const Type& t, Inst* inst) {
         setVar(&lvindex, t, inst);
     }
 
-    void Frame::setRefVar(u4 lvindex, const Type& type, Inst* inst) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::setRefVar(u4 lvindex, const Type& type, Inst* inst) {
         JnifError::check(type.isObject() || type.isNull() || type.isUninitThis(),
                          "Type must be object type: ", type);
         setVar(&lvindex, type, inst);
     }
 
-    void Frame::cleanTops() {
+    template<class TDefs>
+    void BasicFrame<TDefs>::cleanTops() {
         JnifError::assert(!topsErased, "tops already erased: ", topsErased);
 
         for (u4 i = 0; i < lva.size(); i++) {
@@ -1835,68 +2084,72 @@ namespace jnif {
         }
     }
 
-    void Frame::join(Frame& how, IClassPath* classPath) {
-        ComputeFrames().join(*this, how, classPath);
+    template<class TDefs>
+    void BasicFrame<TDefs>::join(BasicFrame& how, IClassPath* classPath) {
+        ComputeFrames<BasicFrame>().join(*this, how, classPath);
     }
 
-    void Frame::init(const Type& t) {
-        for (Frame::T& p : lva) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::init(const Type& t) {
+        for (T& p : lva) {
             Type& tr = p.first;
             if (tr.typeId == t.typeId) {
 //						JnifError::check(!tr.init,
 //								"Object is already init in lva: ", tr, ", ",
 //								className, ".", name, desc, ", ", t);
-                JnifError::check(tr.className != "", "empty clsname lva");
+                JnifError::check(tr.getClassSymbol() != ClassNames::NONE, "empty clsname lva");
                 JnifError::check(
-                        tr.className == t.className,
-                        "!= clsname lva", tr.className, " !=! ", t.className);
+                        tr.getClassSymbol() == t.getClassSymbol(),
+                        "!= clsname lva", tr, " !=! ", t);
 
-                tr.init = true;
-                tr.tag = TYPE_OBJECT;
+                tr.setInit();
 
             }
         }
 
-        for (Frame::T& p : stack) {
+        for (T& p : stack) {
             Type& tr = p.first;
             if (tr.typeId == t.typeId) {
 //						JnifError::check(!tr.init,
 //								"Object is already init in stack: ", tr, ", ",
 //								className, ".", name, desc, ", ", t);
-                JnifError::check(tr.className != "", "empty clsname stack");
-                JnifError::check(tr.className == t.className,
+                JnifError::check(tr.getClassSymbol() != ClassNames::NONE, "empty clsname stack");
+                JnifError::check(tr.getClassSymbol() == t.getClassSymbol(),
                                  "!= clsname stack");
 
-                tr.init = true;
-                tr.tag = TYPE_OBJECT;
+                tr.setInit();
             }
         }
     }
 
-    void Frame::_setVar(u4 lvindex, const Type& t, Inst* inst) {
+    template<class TDefs>
+    void BasicFrame<TDefs>::_setVar(u4 lvindex, const Type& t, Inst* inst) {
         JnifError::check(lvindex < 256 * 256, "Index too large for LVA: ", lvindex);
 
         if (lvindex >= lva.size()) {
-            lva.resize(lvindex + 1, std::make_pair(TypeFactory::topType(), std::set<Inst*>()));
-        }
-
-        std::set<Inst*> ls;
-        if (inst != nullptr) {
-            ls.insert(inst);
+            lva.resize(lvindex + 1, T(TypeFactory::topType(), TDefs()));
         }
 
-        lva[lvindex] = std::make_pair(t, ls);
+        lva[lvindex] = T(t, TDefs(inst));
     }
 
+    template class BasicFrame<NoDefs>;
+    template class BasicFrame<InstDefs>;
+
     namespace model {
 
 
-        void ClassFile::computeFrames(IClassPath* classPath) {
+        void ClassFile::computeFrames(IClassPath* classPath, bool trackDefUse) {
             computeSize();
 
             FrameGenerator fg(*this, classPath);
 
             for (Method& method : methods) {
+                // Unmodified methods keep their original StackMapTable.
+                if (!method.isModified()) {
+                    continue;
+                }
+
                 CodeAttr* code = method.codeAttr();
 
                 if (code != nullptr) {
@@ -1905,7 +2158,7 @@ namespace jnif {
                         return;
                     }
 
-                    fg.computeFrames(code, &method);
+                    fg.computeFrames(code, &method, trackDefUse);
                 }
             }
         }
@@ -7,8 +7,10 @@
 #include "jnif.hpp"
 
 #include <stdio.h>
+#include <cstring>
 #include <execinfo.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 namespace jnif {
 
@@ -39,7 +41,11 @@ namespace jnif {
     public:
 
         Block(Block* next, size_t blockSize) :
-                _next(next), _buffer(malloc(blockSize)), _position(0) {
+                Block(next, malloc(blockSize), blockSize, false) {
+        }
+
+        Block(Block* next, void* buffer, size_t blockSize, bool pooled) :
+                _next(next), _buffer(buffer), _size(blockSize), _position(0), _pooled(pooled) {
             JnifError::check(_buffer != nullptr, "Block alloc is NULL");
         }
 
@@ -47,41 +53,74 @@ namespace jnif {
             free(_buffer);
         }
 
-        void* alloc(int size) {
-            JnifError::assert(size <= BLOCK_SIZE, "Size too large for a block: ", size);
-
-            if (_position + size <= BLOCK_SIZE) {
-                void* offset = (char*) _buffer + _position;
-                _position += size;
+        void* alloc(size_t size, size_t align) {
+            size_t start = (_position + align - 1) & ~(align - 1);
+            if (start <= _size && size <= _size - start) {
+                void* offset = (char*) _buffer + start;
+                _position = start + size;
                 return offset;
             }
 
             return nullptr;
         }
 
+        size_t available() const {
+            return _size - _position;
+        }
+
         Block* _next;
         void* _buffer;
-        int _position;
+        size_t _size;
+        size_t _position;
+        const bool _pooled;
+    };
+
+    struct Arena::Finalizer {
+        void (* fn)(void*);
+        void* obj;
+        Finalizer* next;
     };
 
-    Arena::Arena(size_t blockSize) :
-            blockSize(blockSize),
-            _head(new Block(nullptr, blockSize)) {
+    Arena::Arena(size_t blockSize, ArenaPool* pool) :
+            blockSize(pool == nullptr ? blockSize : pool->blockSize()),
+            _head(nullptr),
+            _finalizers(nullptr),
+            _pool(pool) {
     }
 
     Arena::~Arena() {
+        for (Finalizer* f = _finalizers; f != nullptr; f = f->next) {
+            f->fn(f->obj);
+        }
+
         for (Block* block = _head; block != nullptr;) {
             Block* next = block->_next;
-            delete block;
+            if (block->_pooled) {
+                _pool->_release(block);
+            } else {
+                delete block;
+            }
             block = next;
         }
     }
 
-    void* Arena::alloc(int size) {
-        void* res = _head->alloc(size);
+    void* Arena::alloc(size_t size, size_t align) {
+        void* res = _head == nullptr ? nullptr : _head->alloc(size, align);
         if (res == nullptr) {
-            _head = new Block(_head, blockSize);
-            res = _head->alloc(size);
+            if (size > blockSize) {
+                // Dedicated block, keeps the current block for next allocations.
+                Block* block = new Block(_head == nullptr ? nullptr : _head->_next, size);
+                if (_head == nullptr) {
+                    _head = block;
+                } else {
+                    _head->_next = block;
+                }
+
+                res = block->alloc(size, align);
+            } else {
+                _newBlock(blockSize);
+                res = _head->alloc(size, align);
+            }
         }
 
         JnifError::assert(res != nullptr, "alloc == NULL");
@@ -89,45 +128,166 @@ namespace jnif {
         return res;
     }
 
+    void Arena::_addFinalizer(void (* fn)(void*), void* obj) {
+        Finalizer* f = create<Finalizer>();
+        f->fn = fn;
+        f->obj = obj;
+        f->next = _finalizers;
+        _finalizers = f;
+    }
+
+    void Arena::reserve(size_t size) {
+        if (_pool != nullptr) {
+            // Do not leave the pool for a large reservation.
+            size = std::min(size, blockSize);
+        }
+
+        if (size > 0 && (_head == nullptr || _head->available() < size)) {
+            _newBlock(size);
+        }
+    }
+
+    void Arena::_newBlock(size_t size) {
+        if (_pool != nullptr) {
+            _head = size <= blockSize ? _pool->_acquire(_head) : new Block(_head, size);
+            return;
+        }
+
+        _head = new Block(_head, size);
+
+        blockSize = std::min<size_t>(std::max(blockSize, size) * 2, BLOCK_SIZE);
+    }
+
+    ArenaPool::ArenaPool(bool hugePages, int maxFree) :
+            _hugePages(hugePages),
+            _blockSize(hugePages ? HUGE_PAGE_SIZE : Arena::BLOCK_SIZE),
+            _maxFree(maxFree),
+            _free(nullptr),
+            _freeCount(0) {
+    }
+
+    ArenaPool::~ArenaPool() {
+        for (Arena::Block* block = _free; block != nullptr;) {
+            Arena::Block* next = block->_next;
+            delete block;
+            block = next;
+        }
+    }
+
+    ArenaPool& ArenaPool::local() {
+        static thread_local ArenaPool pool;
+        pool._owner = std::this_thread::get_id();
+        return pool;
+    }
+
+    Arena::Block* ArenaPool::_acquire(Arena::Block* next) {
+        JnifError::assert(_owner == std::thread::id() || _owner == std::this_thread::get_id(),
+                          "Arena block taken from the local pool of another thread");
+
+        Arena::Block* block = _free;
+        if (block != nullptr) {
+            _free = block->_next;
+            _freeCount--;
+
+            block->_next = next;
+            block->_position = 0;
+            return block;
+        }
+
+        void* buffer;
+        if (_hugePages) {
+            if (posix_memalign(&buffer, HUGE_PAGE_SIZE, _blockSize) != 0) {
+                buffer = nullptr;
+            } else {
+                madvise(buffer, _blockSize, MADV_HUGEPAGE);
+            }
+        } else {
+            buffer = malloc(_blockSize);
+        }
+
+        return new Arena::Block(next, buffer, _blockSize, true);
+    }
+
+    void ArenaPool::_release(Arena::Block* block) {
+        JnifError::assert(_owner == std::thread::id() || _owner == std::this_thread::get_id(),
+                          "Arena block given back to the local pool of another thread");
+
+        if (_freeCount >= _maxFree) {
+            delete block;
+            return;
+        }
+
+        block->_next = _free;
+        _free = block;
+        _freeCount++;
+    }
+
     void ClassHierarchy::addClass(const ClassFile& classFile) {
-        ClassEntry e;
-        e.className = classFile.getThisClassName();
+        const char* className = classFile.getThisClassName();
 
         if (classFile.superClassIndex == ConstPool::NULLENTRY) {
-            JnifError::check(e.className == "java/lang/Object",
-                             "invalid class name for null super class: ", e.className,
-                             "asdfasf");
-            e.superClassName = "0";
+            addClass(className, strlen(className), nullptr, 0);
         } else {
-            e.superClassName = classFile.getClassName(classFile.superClassIndex);
+            const char* superClassName = classFile.getClassName(classFile.superClassIndex);
+            addClass(className, strlen(className), superClassName, strlen(superClassName));
         }
 
         //for (ConstIndex interIndex : classFile.interfaces) {
         //const string& interName = classFile.getClassName(interIndex);
         //e.interfaces.push_back(interName);
         //}
+    }
+
+    void ClassHierarchy::addClass(const parser::ClassFileView& view) {
+        ConstPool::Utf8 className = view.getThisClassName();
+
+        if (view.superClassIndex() == ConstPool::NULLENTRY) {
+            addClass(className.data, className.len, nullptr, 0);
+        } else {
+            ConstPool::Utf8 superClassName = view.getSuperClassName();
+            addClass(className.data, className.len, superClassName.data, superClassName.len);
+        }
+    }
+
+    void ClassHierarchy::addClass(const char* className, size_t len,
+                                  const char* superClassName, size_t superLen) {
+        ClassEntry e;
+        e.className = ClassNames::intern(className, len);
+
+        if (superClassName == nullptr) {
+            JnifError::check(e.className == ClassNames::OBJECT,
+                             "invalid class name for null super class: ",
+                             ClassNames::name(e.className));
+            e.superClassName = ClassNames::intern("0");
+        } else {
+            e.superClassName = ClassNames::intern(superClassName, superLen);
+        }
 
         classes[e.className] = e;
-        //classes.push_front(e);
     }
 
     const string& ClassHierarchy::getSuperClass(const string& className) const {
         auto it = getEntry(className);
         JnifError::assert(it != classes.end(), "Class not defined");
 
-        return it->second.superClassName;
+        return ClassNames::name(it->second.superClassName);
     }
 
     bool ClassHierarchy::isAssignableFrom(const string& sub,
                                           const string& sup) const {
+        const ClassNames::Symbol root = ClassNames::intern("0");
+        const ClassNames::Symbol supSymbol = ClassNames::intern(sup);
 
-        string cls = sub;
-        while (cls != "0") {
-            if (cls == sup) {
+        ClassNames::Symbol cls = ClassNames::intern(sub);
+        while (cls != root) {
+            if (cls == supSymbol) {
                 return true;
             }
 
-            cls = getSuperClass(cls);
+            auto it = classes.find(cls);
+            JnifError::assert(it != classes.end(), "Class not defined");
+
+            cls = it->second.superClassName;
         }
 
         return false;
@@ -140,10 +300,10 @@ namespace jnif {
         return it != classes.end();
     }
 
-    map<string, ClassHierarchy::ClassEntry>::const_iterator ClassHierarchy::getEntry(
+    map<ClassNames::Symbol, ClassHierarchy::ClassEntry>::const_iterator ClassHierarchy::getEntry(
             const string& className) const {
 
-        auto it = classes.find(className);
+        auto it = classes.find(ClassNames::find(className.data(), className.size()));
 
         return it;
 
@@ -178,9 +338,9 @@ namespace jnif {
 
     ostream& operator<<(ostream& os, const DomMap& ds) {
         for (const pair<BasicBlock*, set<BasicBlock*> >& d : ds) {
-            os << d.first->name << ": ";
+            os << d.first->name() << ": ";
             for (const BasicBlock* bb : d.second) {
-                os << bb->name << " ";
+                os << bb->name() << " ";
             }
             os << std::endl;
         }
@@ -0,0 +1,322 @@
+/*
+ * clone.cpp
+ *
+ * Deep copy of class files.
+ */
+#include "jnif.hpp"
+
+#include <cstring>
+
+namespace jnif {
+
+    namespace model {
+
+        /**
+         * Copies attributes into a class file whose constant pool is a copy
+         * of the one of the source class file, so that constant pool
+         * indices are kept as they are.
+         * Pointers between instructions, labels and attributes of a Code
+         * attribute are relocated to the copied ones.
+         */
+        class AttrCloner {
+        public:
+
+            explicit AttrCloner(ClassFile* cf) : cf(cf), instList(nullptr) {
+            }
+
+            void cloneAttrs(const Attrs& source, Attrs* target) {
+                for (const Attr* attr : source) {
+                    Attr* copy = cloneAttr(*attr);
+                    copy->len = attr->len;
+                    target->add(copy);
+                }
+
+                target->setModified(source.isModified());
+            }
+
+        private:
+
+            Attr* cloneAttr(const Attr& attr) {
+                Arena& arena = cf->_arena;
+
+                switch (attr.kind) {
+                    case ATTR_UNKNOWN: {
+                        const UnknownAttr& ua = (const UnknownAttr&) attr;
+
+                        // The data can live in the arena of the source class file.
+                        u1* data = (u1*) arena.alloc(ua.len);
+                        memcpy(data, ua.data, ua.len);
+
+                        return arena.create<UnknownAttr>(ua.nameIndex, ua.len, data, cf);
+                    }
+                    case ATTR_SOURCEFILE: {
+                        const SourceFileAttr& sfa = (const SourceFileAttr&) attr;
+                        return arena.create<SourceFileAttr>(sfa.nameIndex, sfa.sourceFileIndex, cf);
+                    }
+                    case ATTR_SIGNATURE: {
+                        const SignatureAttr& sa = (const SignatureAttr&) attr;
+                        return arena.create<SignatureAttr>(sa.nameIndex, sa.signatureIndex, cf);
+                    }
+                    case ATTR_EXCEPTIONS: {
+                        const ExceptionsAttr& ea = (const ExceptionsAttr&) attr;
+                        vector<u2> es(ea.es.begin(), ea.es.end());
+                        return arena.create<ExceptionsAttr>(ea.nameIndex, cf, es);
+                    }
+                    case ATTR_CODE:
+                        return cloneCode((const CodeAttr&) attr);
+                    case ATTR_LVT:
+                    case ATTR_LVTT: {
+                        const LvtAttr& la = (const LvtAttr&) attr;
+                        LvtAttr* copy = arena.create<LvtAttr>(la.kind, la.nameIndex, cf);
+                        copy->lvt.reserve(la.lvt.size());
+
+                        for (const LvtAttr::LvEntry& e : la.lvt) {
+                            LvtAttr::LvEntry entry = e;
+                            entry.startPcLabel = label(e.startPcLabel);
+                            // Not set by the parser, the writer uses len.
+                            entry.endPcLabel = nullptr;
+                            copy->lvt.push_back(entry);
+                        }
+
+                        return copy;
+                    }
+                    case ATTR_LNT: {
+                        const LntAttr& la = (const LntAttr&) attr;
+                        LntAttr* copy = arena.create<LntAttr>(la.nameIndex, cf);
+                        copy->lnt.reserve(la.lnt.size());
+
+                        for (const LntAttr::LnEntry& e : la.lnt) {
+                            LntAttr::LnEntry entry = e;
+                            entry.startPcLabel = label(e.startPcLabel);
+                            copy->lnt.push_back(entry);
+                        }
+
+                        return copy;
+                    }
+                    case ATTR_SMT: {
+                        const SmtAttr& sa = (const SmtAttr&) attr;
+                        SmtAttr* copy = arena.create<SmtAttr>(sa.nameIndex, cf);
+                        copy->entries.reserve(sa.entries.size());
+
+                        for (const SmtAttr::Entry& e : sa.entries) {
+                            copy->entries.emplace_back(e, &arena);
+
+                            SmtAttr::Entry& entry = copy->entries.back();
+                            entry.label = label(e.label);
+                            relocate(entry.sameLocals_1_stack_item_frame.stack);
+                            relocate(entry.same_locals_1_stack_item_frame_extended.stack);
+                            relocate(entry.append_frame.locals);
+                            relocate(entry.full_frame.locals);
+                            relocate(entry.full_frame.stack);
+                        }
+
+                        return copy;
+                    }
+                }
+
+                throw Exception("Invalid attribute kind: ", attr.kind);
+            }
+
+            CodeAttr* cloneCode(const CodeAttr& source) {
+                CodeAttr* code = cf->_arena.create<CodeAttr>(source.nameIndex, cf);
+                code->maxStack = source.maxStack;
+                code->maxLocals = source.maxLocals;
+                code->codeLen = source.codeLen;
+
+                if (!source.isModified()) {
+                    // Copy on write, the copy decodes the same bytes when accessed.
+                    code->_data = source._data;
+                    code->_dataLen = source._dataLen;
+                    code->_decoder = source._decoder;
+
+                    return code;
+                }
+
+                instList = &code->instList;
+                labels.clear();
+
+                for (Inst* inst : source.instList) {
+                    Inst* copy = cloneInst(inst);
+                    copy->_offset = inst->_offset;
+                }
+
+                code->exceptions.reserve(source.exceptions.size());
+                for (const CodeAttr::ExceptionHandler& e : source.exceptions) {
+                    code->exceptions.push_back({
+                                                       label(e.startpc),
+                                                       label(e.endpc),
+                                                       label(e.handlerpc),
+                                                       e.catchtype
+                                               });
+                }
+
+                cloneAttrs(source.attrs, &code->attrs);
+
+                code->instList.setModified(source.instList.isModified());
+                code->_data = source._data;
+                code->_dataLen = source._dataLen;
+                code->_decoder = source._decoder;
+                code->_decoded = true;
+
+                instList = nullptr;
+
+                return code;
+            }
+
+            Inst* cloneInst(const Inst* inst) {
+                switch (inst->kind) {
+                    case KIND_LABEL: {
+                        LabelInst* copy = label(inst);
+                        instList->addLabel(copy);
+                        return copy;
+                    }
+                    case KIND_ZERO:
+                        if (inst->opcode == Opcode::wide) {
+                            const WideInst* wi = inst->wide();
+                            if (wi->subOpcode == Opcode::iinc) {
+                                return instList->addWideIinc(wi->iinc.index, wi->iinc.value);
+                            } else {
+                                return instList->addWideVar(wi->subOpcode, wi->var.lvindex);
+                            }
+                        }
+
+                        return instList->addZero(inst->opcode);
+                    case KIND_BIPUSH:
+                        return instList->addBiPush(inst->push()->value);
+                    case KIND_SIPUSH:
+                        return instList->addSiPush(inst->push()->value);
+                    case KIND_LDC:
+                        return instList->addLdc(inst->opcode, inst->ldc()->valueIndex);
+                    case KIND_VAR:
+                        return instList->addVar(inst->opcode, inst->var()->lvindex);
+                    case KIND_IINC:
+                        return instList->addIinc(inst->iinc()->index, inst->iinc()->value);
+                    case KIND_JUMP:
+                        return instList->addJump(inst->opcode, label(inst->jump()->label2));
+                    case KIND_TABLESWITCH: {
+                        const TableSwitchInst* ts = inst->ts();
+                        TableSwitchInst* copy = instList->addTableSwitch(label(ts->def), ts->low, ts->high);
+                        copy->targets.reserve(ts->targets.size());
+
+                        for (const Inst* target : ts->targets) {
+                            copy->addTarget(label(target));
+                        }
+
+                        return copy;
+                    }
+                    case KIND_LOOKUPSWITCH: {
+                        const LookupSwitchInst* ls = inst->ls();
+                        LookupSwitchInst* copy = instList->addLookupSwitch(label(ls->defbyte), ls->npairs);
+                        copy->keys.assign(ls->keys.begin(), ls->keys.end());
+                        copy->targets.reserve(ls->targets.size());
+
+                        for (const Inst* target : ls->targets) {
+                            copy->addTarget(label(target));
+                        }
+
+                        return copy;
+                    }
+                    case KIND_FIELD:
+                        return instList->addField(inst->opcode, inst->field()->fieldRefIndex);
+                    case KIND_INVOKE:
+                        return instList->addInvoke(inst->opcode, inst->invoke()->methodRefIndex);
+                    case KIND_INVOKEINTERFACE:
+                        return instList->addInvokeInterface(inst->invokeinterface()->interMethodRefIndex,
+                                                            inst->invokeinterface()->count);
+                    case KIND_INVOKEDYNAMIC:
+                        return instList->addInvokeDynamic(inst->indy()->callSite());
+                    case KIND_TYPE:
+                        return instList->addType(inst->opcode, inst->type()->classIndex);
+                    case KIND_NEWARRAY:
+                        return instList->addNewArray(inst->newarray()->atype);
+                    case KIND_MULTIARRAY:
+                        return instList->addMultiArray(inst->multiarray()->classIndex,
+                                                       inst->multiarray()->dims);
+                    default:
+                        throw Exception("Invalid instruction kind to clone: ", inst->kind);
+                }
+            }
+
+            /**
+             * Returns the copy of the given label, creating it on first use.
+             */
+            LabelInst* label(const Inst* inst) {
+                if (inst == nullptr) {
+                    return nullptr;
+                }
+
+                const LabelInst* source = inst->label();
+                if ((size_t) source->id >= labels.size()) {
+                    labels.resize(source->id + 1, nullptr);
+                }
+
+                LabelInst*& copy = labels[source->id];
+                if (copy == nullptr) {
+                    JnifError::assert(instList != nullptr, "Label outside of a Code attribute");
+
+                    copy = instList->createLabel();
+                    copy->_offset = source->_offset;
+                    copy->offset = source->offset;
+                    copy->deltaOffset = source->deltaOffset;
+                    copy->isBranchTarget = source->isBranchTarget;
+                    copy->isTryStart = source->isTryStart;
+                    copy->isCatchHandler = source->isCatchHandler;
+                }
+
+                return copy;
+            }
+
+            void relocate(ArenaVector<Type>& types) {
+                for (Type& type : types) {
+                    if (type.isUninit()) {
+                        // The new instruction is only tracked during analysis.
+                        type.uninit.label = label(type.uninit.label);
+                        type.uninit.newinst = nullptr;
+                    }
+                }
+            }
+
+            ClassFile* const cf;
+
+            /**
+             * The instruction list of the Code attribute being copied.
+             */
+            InstList* instList;
+
+            /**
+             * The copy of each label of the Code attribute being copied,
+             * indexed by label id.
+             */
+            vector<LabelInst*> labels;
+        };
+
+        ClassFile::ClassFile(const ClassFile& source, ArenaPool* pool) :
+                _arena(Arena::INITIAL_BLOCK_SIZE, pool),
+                thisClassIndex(source.thisClassIndex),
+                superClassIndex(source.superClassIndex),
+                accessFlags(source.accessFlags),
+                version(source.version),
+                interfaces(_create<ArenaList<ConstPool::Index> >()), fields(_create<ArenaList<Field> >()),
+                methods(_create<ArenaList<Method> >()), attrs(_create<Attrs>()), sig(&attrs) {
+            _copy(source);
+            interfaces.assign(source.interfaces.begin(), source.interfaces.end());
+
+            AttrCloner cloner(this);
+
+            for (const Field& f : source.fields) {
+                Field& copy = addField(f.nameIndex, f.descIndex, f.accessFlags);
+                cloner.cloneAttrs(f.attrs, &copy.attrs);
+            }
+
+            for (const Method& m : source.methods) {
+                Method& copy = addMethod(m.nameIndex, m.descIndex, m.accessFlags);
+                cloner.cloneAttrs(m.attrs, &copy.attrs);
+            }
+
+            cloner.cloneAttrs(source.attrs, &attrs);
+
+            modified = source.modified;
+        }
+
+    }
+}
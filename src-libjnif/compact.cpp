@@ -0,0 +1,385 @@
+/*
+ * compact.cpp
+ *
+ * Removal of unused constant pool entries.
+ */
+#include "jnif.hpp"
+
+#include <cstring>
+
+namespace jnif {
+
+    namespace model {
+
+        /**
+         * Locates the constant pool indices inside the attributes that jnif
+         * keeps as UnknownAttr, given the attribute name.
+         */
+        class UnknownAttrIndices {
+        public:
+
+            UnknownAttrIndices(const UnknownAttr& attr, vector<u4>* offsets) :
+                    data(attr.data), len(attr.len), pos(0), offsets(offsets) {
+            }
+
+            /**
+             * Appends to offsets the position of each u2 index in the
+             * attribute data.
+             *
+             * @returns false when the format of the attribute is not known.
+             */
+            bool collect(const string& name) {
+                if (name == "Deprecated" || name == "Synthetic" || name == "SourceDebugExtension") {
+                    return true;
+                } else if (name == "ConstantValue" || name == "NestHost") {
+                    index();
+                } else if (name == "EnclosingMethod") {
+                    index();
+                    index();
+                } else if (name == "NestMembers" || name == "PermittedSubclasses") {
+                    u2 count = readu2();
+                    for (u2 i = 0; i < count; i++) {
+                        index();
+                    }
+                } else if (name == "InnerClasses") {
+                    u2 count = readu2();
+                    for (u2 i = 0; i < count; i++) {
+                        index();
+                        index();
+                        index();
+                        readu2();
+                    }
+                } else if (name == "BootstrapMethods") {
+                    u2 count = readu2();
+                    for (u2 i = 0; i < count; i++) {
+                        index();
+                        u2 argCount = readu2();
+                        for (u2 j = 0; j < argCount; j++) {
+                            index();
+                        }
+                    }
+                } else if (name == "MethodParameters") {
+                    u1 count = readu1();
+                    for (u1 i = 0; i < count; i++) {
+                        index();
+                        readu2();
+                    }
+                } else if (name == "RuntimeVisibleAnnotations"
+                           || name == "RuntimeInvisibleAnnotations") {
+                    annotations();
+                } else if (name == "RuntimeVisibleParameterAnnotations"
+                           || name == "RuntimeInvisibleParameterAnnotations") {
+                    u1 count = readu1();
+                    for (u1 i = 0; i < count; i++) {
+                        annotations();
+                    }
+                } else if (name == "AnnotationDefault") {
+                    elementValue();
+                } else {
+                    return false;
+                }
+
+                JnifError::check(pos == len, "Invalid length for attribute ", name);
+                return true;
+            }
+
+        private:
+
+            u1 readu1() {
+                JnifError::check(pos + 1 <= len, "Attribute too short");
+                return data[pos++];
+            }
+
+            u2 readu2() {
+                JnifError::check(pos + 2 <= len, "Attribute too short");
+                u2 value = (data[pos] << 8) | data[pos + 1];
+                pos += 2;
+                return value;
+            }
+
+            void index() {
+                offsets->push_back(pos);
+                readu2();
+            }
+
+            void annotations() {
+                u2 count = readu2();
+                for (u2 i = 0; i < count; i++) {
+                    annotation();
+                }
+            }
+
+            void annotation() {
+                index();
+                u2 pairCount = readu2();
+                for (u2 i = 0; i < pairCount; i++) {
+                    index();
+                    elementValue();
+                }
+            }
+
+            void elementValue() {
+                u1 tag = readu1();
+                switch (tag) {
+                    case 'B':
+                    case 'C':
+                    case 'D':
+                    case 'F':
+                    case 'I':
+                    case 'J':
+                    case 'S':
+                    case 'Z':
+                    case 's':
+                    case 'c':
+                        index();
+                        break;
+                    case 'e':
+                        index();
+                        index();
+                        break;
+                    case '@':
+                        annotation();
+                        break;
+                    case '[': {
+                        u2 count = readu2();
+                        for (u2 i = 0; i < count; i++) {
+                            elementValue();
+                        }
+                        break;
+                    }
+                    default:
+                        throw Exception("Invalid element value tag: ", tag);
+                }
+            }
+
+            const u1* const data;
+            const u4 len;
+            u4 pos;
+            vector<u4>* const offsets;
+        };
+
+        /**
+         * Applies func to every non-null constant pool index held by a class
+         * file outside its constant pool.
+         */
+        template<typename TFunc>
+        class IndexVisitor {
+        public:
+
+            IndexVisitor(ClassFile& cf, TFunc func) : cf(cf), func(func) {
+            }
+
+            /**
+             * @returns false when an unknown attribute could not be visited.
+             */
+            bool visitClassFile() {
+                index(cf.thisClassIndex);
+                index(cf.superClassIndex);
+
+                for (ConstPool::Index& interIndex : cf.interfaces) {
+                    index(interIndex);
+                }
+
+                for (Field& f : cf.fields) {
+                    if (!visitMember(f)) {
+                        return false;
+                    }
+                }
+
+                for (Method& m : cf.methods) {
+                    if (!visitMember(m)) {
+                        return false;
+                    }
+                }
+
+                return visitAttrs(cf.attrs);
+            }
+
+        private:
+
+            void index(ConstPool::Index& index) {
+                if (index != ConstPool::NULLENTRY) {
+                    func(index);
+                }
+            }
+
+            bool visitMember(Member& member) {
+                index(member.nameIndex);
+                index(member.descIndex);
+
+                return visitAttrs(member.attrs);
+            }
+
+            bool visitAttrs(Attrs& attrs) {
+                for (Attr* attr : attrs) {
+                    index(attr->nameIndex);
+
+                    switch (attr->kind) {
+                        case ATTR_SOURCEFILE:
+                            index(((SourceFileAttr*) attr)->sourceFileIndex);
+                            break;
+                        case ATTR_SIGNATURE:
+                            index(((SignatureAttr*) attr)->signatureIndex);
+                            break;
+                        case ATTR_EXCEPTIONS:
+                            for (ConstPool::Index& e : ((ExceptionsAttr*) attr)->es) {
+                                index(e);
+                            }
+                            break;
+                        case ATTR_CODE:
+                            if (!visitCode((CodeAttr*) attr)) {
+                                return false;
+                            }
+                            break;
+                        case ATTR_LVT:
+                        case ATTR_LVTT:
+                            for (LvtAttr::LvEntry& e : ((LvtAttr*) attr)->lvt) {
+                                index(e.varNameIndex);
+                                index(e.varDescIndex);
+                            }
+                            break;
+                        case ATTR_LNT:
+                            break;
+                        case ATTR_SMT:
+                            for (SmtAttr::Entry& e : ((SmtAttr*) attr)->entries) {
+                                visitTypes(e.sameLocals_1_stack_item_frame.stack);
+                                visitTypes(e.same_locals_1_stack_item_frame_extended.stack);
+                                visitTypes(e.append_frame.locals);
+                                visitTypes(e.full_frame.locals);
+                                visitTypes(e.full_frame.stack);
+                            }
+                            break;
+                        case ATTR_UNKNOWN:
+                            if (!visitUnknown((UnknownAttr*) attr)) {
+                                return false;
+                            }
+                            break;
+                    }
+                }
+
+                return true;
+            }
+
+            bool visitCode(CodeAttr* code) {
+                code->decode();
+
+                for (Inst* inst : code->instList) {
+                    switch (inst->kind) {
+                        case KIND_LDC:
+                            index(inst->ldc()->valueIndex);
+                            break;
+                        case KIND_FIELD:
+                            index(inst->field()->fieldRefIndex);
+                            break;
+                        case KIND_INVOKE:
+                            index(inst->invoke()->methodRefIndex);
+                            break;
+                        case KIND_INVOKEINTERFACE:
+                            index(inst->invokeinterface()->interMethodRefIndex);
+                            break;
+                        case KIND_INVOKEDYNAMIC: {
+                            ConstPool::Index callSite = inst->indy()->callSite();
+                            index(callSite);
+                            inst->indy()->setCallSite(callSite);
+                            break;
+                        }
+                        case KIND_TYPE:
+                            index(inst->type()->classIndex);
+                            break;
+                        case KIND_MULTIARRAY:
+                            index(inst->multiarray()->classIndex);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+
+                for (CodeAttr::ExceptionHandler& e : code->exceptions) {
+                    index(e.catchtype);
+                }
+
+                return visitAttrs(code->attrs);
+            }
+
+            void visitTypes(ArenaVector<Type>& types) {
+                for (Type& type : types) {
+                    if (type.isObject()) {
+                        index(type.classIndex);
+                    }
+                }
+            }
+
+            bool visitUnknown(UnknownAttr* attr) {
+                vector<u4> offsets;
+                if (!UnknownAttrIndices(*attr, &offsets).collect(cf.getUtf8(attr->nameIndex))) {
+                    return false;
+                }
+
+                u1* data = nullptr;
+                for (u4 offset : offsets) {
+                    const u1* p = attr->data + offset;
+                    ConstPool::Index oldIndex = (p[0] << 8) | p[1];
+                    ConstPool::Index newIndex = oldIndex;
+                    index(newIndex);
+
+                    if (newIndex != oldIndex) {
+                        if (data == nullptr) {
+                            // The original data may be borrowed from the parsed buffer.
+                            data = (u1*) cf._arena.alloc(attr->len);
+                            memcpy(data, attr->data, attr->len);
+                            attr->data = data;
+                        }
+
+                        data[offset] = newIndex >> 8;
+                        data[offset + 1] = newIndex & 0xff;
+                    }
+                }
+
+                return true;
+            }
+
+            ClassFile& cf;
+            TFunc func;
+        };
+
+        template<typename TFunc>
+        static bool visitIndices(ClassFile& cf, TFunc func) {
+            return IndexVisitor<TFunc>(cf, func).visitClassFile();
+        }
+
+        int ClassFile::compactConstPool() {
+            vector<bool> live(size(), false);
+            bool known = visitIndices(*this, [&](ConstPool::Index& index) {
+                live[index] = true;
+            });
+
+            if (!known) {
+                return -1;
+            }
+
+            u4 oldSize = size();
+            vector<ConstPool::Index> map = _compact(live);
+
+            visitIndices(*this, [&](ConstPool::Index& index) {
+                JnifError::assert(map[index] != ConstPool::NULLENTRY, "Removed entry: ", index);
+                index = map[index];
+            });
+
+            for (Method& m : methods) {
+                if (m.hasCode()) {
+                    CodeAttr* code = m.codeAttr();
+                    for (Inst* inst : code->instList) {
+                        if (inst->opcode == Opcode::ldc_w && inst->ldc()->valueIndex <= 0xff) {
+                            code->instList.setOpcode(inst, Opcode::ldc);
+                        }
+                    }
+
+                    code->setModified();
+                }
+            }
+
+            return oldSize - size();
+        }
+
+    }
+}
@@ -0,0 +1,959 @@
+/*
+ * image.cpp
+ *
+ * Binary images of the model of class files.
+ */
+#include "jnif.hpp"
+
+#include <cstring>
+
+namespace jnif {
+
+    namespace model {
+
+        /*
+         * An image is a sequence of fixed records in native byte order,
+         * each aligned to four bytes, except the constant pool values,
+         * which are aligned to eight bytes so that they are copied as is.
+         * Offsets are relative to the start of the image, and
+         * instructions and attributes refer to labels by their id in the
+         * label table of their Code attribute.
+         */
+        namespace {
+
+            const u4 IMAGE_MAGIC = 0x4a4e4946;
+
+            const u4 IMAGE_VERSION = 1;
+
+            /**
+             * Label id of a null label.
+             */
+            const u4 NOLABEL = 0xffffffff;
+
+            struct ImageHeader {
+                u4 magic;
+                u4 version;
+                u4 cpCount;
+                u4 utf8Count;
+
+                /**
+                 * The size in bytes of the utf8 entries, each terminated
+                 * by a null byte.
+                 */
+                u4 utf8Size;
+            };
+
+            struct Utf8Record {
+                u4 offset;
+                u4 len;
+            };
+
+            struct ClassRecord {
+                u2 thisClassIndex;
+                u2 superClassIndex;
+                u2 accessFlags;
+                u2 majorVersion;
+                u2 minorVersion;
+                u2 interfacesCount;
+                u4 fieldsCount;
+                u4 methodsCount;
+            };
+
+            struct MemberRecord {
+                u2 accessFlags;
+                u2 nameIndex;
+                u2 descIndex;
+                u2 padding;
+            };
+
+            struct AttrRecord {
+                u1 kind;
+                u1 padding;
+                u2 nameIndex;
+                u4 len;
+            };
+
+            struct CodeRecord {
+                u2 maxStack;
+                u2 maxLocals;
+                u4 codeLen;
+                u4 instCount;
+                u4 exceptionCount;
+                u4 labelCount;
+
+                /**
+                 * Offset of the label table, which follows the
+                 * attributes of the Code attribute.
+                 */
+                u4 labelsOffset;
+            };
+
+            struct LabelRecord {
+                int _offset;
+                u2 offset;
+                u2 deltaOffset;
+                u1 isBranchTarget;
+                u1 isTryStart;
+                u1 isCatchHandler;
+                u1 padding;
+            };
+
+            /**
+             * An instruction with its operand that fits in two bytes,
+             * e.g., a constant pool index or a local variable index.
+             * Labels, jumps, switches, wide, invokeinterface and
+             * multianewarray are followed by a u4 operand, see
+             * ImageWriter::writeInst, and switches then by their keys and
+             * targets, each preceded by its count.
+             */
+            struct InstRecord {
+                u1 kind;
+                u1 opcode;
+                u2 a;
+                int _offset;
+            };
+
+            struct ExceptionRecord {
+                u4 startpc;
+                u4 endpc;
+                u4 handlerpc;
+                u2 catchtype;
+                u2 padding;
+            };
+
+            struct LvRecord {
+                u2 startPc;
+                u2 len;
+                u2 varNameIndex;
+                u2 varDescIndex;
+                u2 index;
+                u2 padding;
+                u4 startPcLabel;
+            };
+
+            struct LnRecord {
+                u2 startpc;
+                u2 lineno;
+                u4 startPcLabel;
+            };
+
+            /**
+             * A frame of a StackMapTable, followed by its types,
+             * in the order of the counts.
+             */
+            struct FrameRecord {
+                int frameType;
+                u4 label;
+                short sameLocalsExtendedDelta;
+                short chopDelta;
+                short sameExtendedDelta;
+                short appendDelta;
+                short fullDelta;
+                u2 sameLocalsStackCount;
+                u2 sameLocalsExtendedStackCount;
+                u2 appendLocalsCount;
+                u2 fullLocalsCount;
+                u2 fullStackCount;
+            };
+
+            /**
+             * A verification type, with the class index of an object
+             * or the offset of an uninitialized type in index.
+             */
+            struct TypeRecord {
+                u1 tag;
+                u1 padding;
+                u2 index;
+                u4 label;
+            };
+
+        }
+
+        class ImageWriter {
+        public:
+
+            explicit ImageWriter(vector<u1>* image) : image(*image) {
+            }
+
+            void writeClassFile(ClassFile& cf) {
+                const ConstPool& cp = cf;
+                u4 cpCount = cp.tags.size();
+                u4 utf8Count = cp.utf8s.size();
+
+                size_t headerOffset = reserve(sizeof(ImageHeader));
+
+                align(8);
+                append(cp.values.data(), cpCount * sizeof(ConstPool::Value));
+                append(cp.tags.data(), cpCount);
+                align(4);
+
+                size_t utf8sOffset = reserve(utf8Count * sizeof(Utf8Record));
+                size_t utf8Start = image.size();
+                for (u4 i = 0; i < utf8Count; i++) {
+                    const ConstPool::Utf8& utf8 = cp.utf8s[i];
+                    Utf8Record record{(u4) image.size(), utf8.len};
+                    memcpy(&image[utf8sOffset + i * sizeof(Utf8Record)], &record, sizeof(Utf8Record));
+
+                    append(utf8.data, utf8.len);
+                    image.push_back('\0');
+                }
+
+                ImageHeader header{IMAGE_MAGIC, IMAGE_VERSION, cpCount, utf8Count, (u4) (image.size() - utf8Start)};
+                memcpy(&image[headerOffset], &header, sizeof(ImageHeader));
+                align(4);
+
+                put(ClassRecord{
+                        cf.thisClassIndex, cf.superClassIndex, cf.accessFlags,
+                        cf.version.majorVersion(), cf.version.minorVersion(),
+                        (u2) cf.interfaces.size(), (u4) cf.fields.size(), (u4) cf.methods.size()
+                });
+
+                for (ConstPool::Index interface : cf.interfaces) {
+                    put(interface);
+                }
+                align(4);
+
+                for (const Field& f : cf.fields) {
+                    writeMember(f);
+                }
+
+                for (const Method& m : cf.methods) {
+                    writeMember(m);
+                }
+
+                writeAttrs(cf.attrs);
+            }
+
+        private:
+
+            void writeMember(const Member& m) {
+                put(MemberRecord{m.accessFlags, m.nameIndex, m.descIndex, 0});
+                writeAttrs(m.attrs);
+            }
+
+            void writeAttrs(const Attrs& attrs) {
+                put((u4) attrs.size());
+
+                for (Attr* attr : attrs) {
+                    put(AttrRecord{(u1) attr->kind, 0, attr->nameIndex, attr->len});
+                    writeAttr(*attr);
+                    align(4);
+                }
+            }
+
+            void writeAttr(Attr& attr) {
+                switch (attr.kind) {
+                    case ATTR_UNKNOWN:
+                        append(((UnknownAttr&) attr).data, attr.len);
+                        return;
+                    case ATTR_SOURCEFILE:
+                        put(((SourceFileAttr&) attr).sourceFileIndex);
+                        return;
+                    case ATTR_SIGNATURE:
+                        put(((SignatureAttr&) attr).signatureIndex);
+                        return;
+                    case ATTR_EXCEPTIONS: {
+                        const ExceptionsAttr& ea = (const ExceptionsAttr&) attr;
+                        put((u4) ea.es.size());
+                        append(ea.es.data(), ea.es.size() * sizeof(ConstPool::Index));
+                        return;
+                    }
+                    case ATTR_CODE:
+                        writeCode((CodeAttr&) attr);
+                        return;
+                    case ATTR_LVT:
+                    case ATTR_LVTT: {
+                        const LvtAttr& la = (const LvtAttr&) attr;
+                        put((u4) la.lvt.size());
+
+                        for (const LvtAttr::LvEntry& e : la.lvt) {
+                            put(LvRecord{
+                                    e.startPc, e.len, e.varNameIndex, e.varDescIndex, e.index, 0,
+                                    label(e.startPcLabel)
+                            });
+                        }
+                        return;
+                    }
+                    case ATTR_LNT: {
+                        const LntAttr& la = (const LntAttr&) attr;
+                        put((u4) la.lnt.size());
+
+                        for (const LntAttr::LnEntry& e : la.lnt) {
+                            put(LnRecord{e.startpc, e.lineno, label(e.startPcLabel)});
+                        }
+                        return;
+                    }
+                    case ATTR_SMT:
+                        writeSmt((const SmtAttr&) attr);
+                        return;
+                }
+
+                throw Exception("Invalid attribute kind: ", attr.kind);
+            }
+
+            void writeCode(CodeAttr& code) {
+                code.decode();
+
+                JnifError::check(labels.empty(), "Nested Code attribute");
+
+                size_t codeOffset = reserve(sizeof(CodeRecord));
+
+                u4 instCount = 0;
+                for (Inst* inst : code.instList) {
+                    writeInst(inst);
+                    instCount++;
+                }
+
+                for (const CodeAttr::ExceptionHandler& e : code.exceptions) {
+                    put(ExceptionRecord{label(e.startpc), label(e.endpc), label(e.handlerpc), e.catchtype, 0});
+                }
+
+                writeAttrs(code.attrs);
+
+                u4 labelsOffset = image.size();
+                for (const LabelInst* l : labels) {
+                    put(LabelRecord{
+                            l->_offset, l->offset, l->deltaOffset,
+                            l->isBranchTarget, l->isTryStart, l->isCatchHandler, 0
+                    });
+                }
+
+                CodeRecord record{
+                        code.maxStack, code.maxLocals, code.codeLen, instCount,
+                        (u4) code.exceptions.size(), (u4) labels.size(), labelsOffset
+                };
+                memcpy(&image[codeOffset], &record, sizeof(CodeRecord));
+
+                labels.clear();
+                ids.clear();
+            }
+
+            void writeInst(const Inst* inst) {
+                InstRecord record{(u1) inst->kind, (u1) inst->opcode, 0, inst->_offset};
+
+                switch (inst->kind) {
+                    case KIND_LABEL:
+                        put(record);
+                        put(label(inst));
+                        return;
+                    case KIND_ZERO:
+                        if (inst->opcode == Opcode::wide) {
+                            const WideInst* wi = inst->wide();
+                            if (wi->subOpcode == Opcode::iinc) {
+                                record.a = wi->iinc.index;
+                                put(record);
+                                put((u4) wi->subOpcode | (u4) wi->iinc.value << 8);
+                            } else {
+                                record.a = wi->var.lvindex;
+                                put(record);
+                                put((u4) wi->subOpcode);
+                            }
+                            return;
+                        }
+                        break;
+                    case KIND_BIPUSH:
+                    case KIND_SIPUSH:
+                        record.a = inst->push()->value;
+                        break;
+                    case KIND_LDC:
+                        record.a = inst->ldc()->valueIndex;
+                        break;
+                    case KIND_VAR:
+                        record.a = inst->var()->lvindex;
+                        break;
+                    case KIND_IINC:
+                        record.a = inst->iinc()->index | inst->iinc()->value << 8;
+                        break;
+                    case KIND_JUMP:
+                        put(record);
+                        put(label(inst->jump()->label2));
+                        return;
+                    case KIND_TABLESWITCH: {
+                        const TableSwitchInst* ts = inst->ts();
+                        put(record);
+                        put(label(ts->def));
+                        put(ts->low);
+                        put(ts->high);
+                        writeTargets(ts->targets);
+                        return;
+                    }
+                    case KIND_LOOKUPSWITCH: {
+                        const LookupSwitchInst* ls = inst->ls();
+                        put(record);
+                        put(label(ls->defbyte));
+                        put(ls->npairs);
+                        put((u4) ls->keys.size());
+                        append(ls->keys.data(), ls->keys.size() * sizeof(u4));
+                        writeTargets(ls->targets);
+                        return;
+                    }
+                    case KIND_FIELD:
+                        record.a = inst->field()->fieldRefIndex;
+                        break;
+                    case KIND_INVOKE:
+                        record.a = inst->invoke()->methodRefIndex;
+                        break;
+                    case KIND_INVOKEINTERFACE:
+                        record.a = inst->invokeinterface()->interMethodRefIndex;
+                        put(record);
+                        put((u4) inst->invokeinterface()->count);
+                        return;
+                    case KIND_INVOKEDYNAMIC:
+                        record.a = inst->indy()->callSite();
+                        break;
+                    case KIND_TYPE:
+                        record.a = inst->type()->classIndex;
+                        break;
+                    case KIND_NEWARRAY:
+                        record.a = inst->newarray()->atype;
+                        break;
+                    case KIND_MULTIARRAY:
+                        record.a = inst->multiarray()->classIndex;
+                        put(record);
+                        put((u4) inst->multiarray()->dims);
+                        return;
+                    default:
+                        throw Exception("Invalid instruction kind to write: ", inst->kind);
+                }
+
+                put(record);
+            }
+
+            void writeTargets(const ArenaVector<Inst*>& targets) {
+                put((u4) targets.size());
+                for (const Inst* target : targets) {
+                    put(label(target));
+                }
+            }
+
+            void writeSmt(const SmtAttr& smt) {
+                put((u4) smt.entries.size());
+
+                for (const SmtAttr::Entry& e : smt.entries) {
+                    put(FrameRecord{
+                            e.frameType, label(e.label),
+                            e.same_locals_1_stack_item_frame_extended.offset_delta,
+                            e.chop_frame.offset_delta,
+                            e.same_frame_extended.offset_delta,
+                            e.append_frame.offset_delta,
+                            e.full_frame.offset_delta,
+                            (u2) e.sameLocals_1_stack_item_frame.stack.size(),
+                            (u2) e.same_locals_1_stack_item_frame_extended.stack.size(),
+                            (u2) e.append_frame.locals.size(),
+                            (u2) e.full_frame.locals.size(),
+                            (u2) e.full_frame.stack.size()
+                    });
+
+                    writeTypes(e.sameLocals_1_stack_item_frame.stack);
+                    writeTypes(e.same_locals_1_stack_item_frame_extended.stack);
+                    writeTypes(e.append_frame.locals);
+                    writeTypes(e.full_frame.locals);
+                    writeTypes(e.full_frame.stack);
+                }
+            }
+
+            /**
+             * Writes types as verification types, as the class file
+             * writer does.
+             */
+            void writeTypes(const ArenaVector<Type>& types) {
+                for (const Type& type : types) {
+                    TypeRecord record{0, 0, 0, NOLABEL};
+
+                    if (type.isTop()) {
+                        record.tag = TYPE_TOP;
+                    } else if (type.isIntegral()) {
+                        record.tag = TYPE_INTEGER;
+                    } else if (type.isFloat()) {
+                        record.tag = TYPE_FLOAT;
+                    } else if (type.isLong()) {
+                        record.tag = TYPE_LONG;
+                    } else if (type.isDouble()) {
+                        record.tag = TYPE_DOUBLE;
+                    } else if (type.isNull()) {
+                        record.tag = TYPE_NULL;
+                    } else if (type.isUninitThis()) {
+                        record.tag = TYPE_UNINITTHIS;
+                    } else if (type.isObject()) {
+                        record.tag = TYPE_OBJECT;
+                        record.index = type.getCpIndex();
+                    } else if (type.isUninit()) {
+                        record.tag = TYPE_UNINIT;
+                        record.index = type.uninit.offset;
+                        record.label = label(type.uninit.label);
+                    } else {
+                        throw Exception("Invalid type on write: ", type);
+                    }
+
+                    put(record);
+                }
+            }
+
+            /**
+             * Returns the id of the given label in the label table of the
+             * Code attribute being written, adding it on first use.
+             */
+            u4 label(const Inst* inst) {
+                if (inst == nullptr) {
+                    return NOLABEL;
+                }
+
+                const LabelInst* l = inst->label();
+                if ((size_t) l->id >= ids.size()) {
+                    ids.resize(l->id + 1, NOLABEL);
+                }
+
+                u4& id = ids[l->id];
+                if (id == NOLABEL) {
+                    id = labels.size();
+                    labels.push_back(l);
+                }
+
+                return id;
+            }
+
+            template<typename T>
+            void put(const T& value) {
+                append(&value, sizeof(T));
+            }
+
+            void append(const void* data, size_t len) {
+                const u1* bytes = (const u1*) data;
+                image.insert(image.end(), bytes, bytes + len);
+            }
+
+            /**
+             * Appends len zero bytes, to be filled later,
+             * and returns their offset.
+             */
+            size_t reserve(size_t len) {
+                size_t offset = image.size();
+                image.resize(offset + len, 0);
+                return offset;
+            }
+
+            void align(size_t alignment) {
+                image.resize((image.size() + alignment - 1) & ~(alignment - 1), 0);
+            }
+
+            vector<u1>& image;
+
+            /**
+             * The labels of the Code attribute being written,
+             * in the order of their image ids.
+             */
+            vector<const LabelInst*> labels;
+
+            /**
+             * The image id of each label, indexed by label id.
+             */
+            vector<u4> ids;
+        };
+
+        class ImageReader {
+        public:
+
+            ImageReader(const u1* image, u4 len) : image(image), pos(image), end(image + len) {
+                JnifError::check(((uintptr_t) image) % 8 == 0, "Class image is not 8-byte aligned");
+            }
+
+            void readClassFile(ClassFile* cf) {
+                ConstPool& cp = *cf;
+
+                const ImageHeader& header = *take<ImageHeader>();
+                JnifError::check(header.magic == IMAGE_MAGIC, "Invalid class image magic: ", header.magic);
+                JnifError::check(header.version == IMAGE_VERSION, "Invalid class image version: ", header.version);
+                JnifError::check(header.cpCount > 0 && header.cpCount <= 65536, "Invalid constant pool count: ",
+                                 header.cpCount);
+
+                align(8);
+                const ConstPool::Value* values = take<ConstPool::Value>(header.cpCount);
+                const u1* tags = take<u1>(header.cpCount);
+                align(4);
+
+                vector<ConstPool::Value>(values, values + header.cpCount).swap(cp.values);
+                cp.tags.assign(tags, tags + header.cpCount);
+
+                const Utf8Record* utf8s = take<Utf8Record>(header.utf8Count);
+                size_t utf8Start = pos - image;
+                const u1* utf8End = take<u1>(header.utf8Size) + header.utf8Size;
+                align(4);
+
+                cp.utf8s.clear();
+                cp.utf8s.reserve(header.utf8Count);
+                for (u4 i = 0; i < header.utf8Count; i++) {
+                    const Utf8Record& r = utf8s[i];
+                    JnifError::check(r.offset >= utf8Start && r.len <= 0xffff
+                                     && r.len < (size_t) (utf8End - image) - r.offset
+                                     && image[r.offset + r.len] == '\0', "Invalid utf8 in class image: ", i);
+
+                    // The bytes are terminated in the image, so they are used as they are.
+                    cp.utf8s.push_back(ConstPool::Utf8({(const char*) image + r.offset, (u2) r.len, false}));
+                }
+
+                for (u4 i = 0; i < header.cpCount; i++) {
+                    JnifError::check(tags[i] != ConstPool::UTF8 || values[i].utf8Index < header.utf8Count,
+                                     "Invalid utf8 index in class image: ", i);
+                }
+
+                const ClassRecord& record = *take<ClassRecord>();
+                cf->thisClassIndex = record.thisClassIndex;
+                cf->superClassIndex = record.superClassIndex;
+                cf->accessFlags = record.accessFlags;
+                cf->version = Version(record.majorVersion, record.minorVersion);
+
+                const ConstPool::Index* interfaces = take<ConstPool::Index>(record.interfacesCount);
+                cf->interfaces.assign(interfaces, interfaces + record.interfacesCount);
+                align(4);
+
+                for (u4 i = 0; i < record.fieldsCount; i++) {
+                    const MemberRecord& m = *take<MemberRecord>();
+                    readAttrs(cf, &cf->addField(m.nameIndex, m.descIndex, m.accessFlags).attrs);
+                }
+
+                for (u4 i = 0; i < record.methodsCount; i++) {
+                    const MemberRecord& m = *take<MemberRecord>();
+                    readAttrs(cf, &cf->addMethod(m.nameIndex, m.descIndex, m.accessFlags).attrs);
+                }
+
+                readAttrs(cf, &cf->attrs);
+            }
+
+        private:
+
+            void readAttrs(ClassFile* cf, Attrs* attrs) {
+                u4 count = *take<u4>();
+
+                for (u4 i = 0; i < count; i++) {
+                    const AttrRecord& record = *take<AttrRecord>();
+                    Attr* attr = readAttr(cf, record);
+                    attr->len = record.len;
+                    attrs->add(attr);
+                    align(4);
+                }
+            }
+
+            Attr* readAttr(ClassFile* cf, const AttrRecord& record) {
+                Arena& arena = cf->_arena;
+
+                switch (record.kind) {
+                    case ATTR_UNKNOWN:
+                        // The data is used from the image, as the parser does with its buffer.
+                        return arena.create<UnknownAttr>(record.nameIndex, record.len, take<u1>(record.len), cf);
+                    case ATTR_SOURCEFILE:
+                        return arena.create<SourceFileAttr>(record.nameIndex, *take<ConstPool::Index>(), cf);
+                    case ATTR_SIGNATURE:
+                        return arena.create<SignatureAttr>(record.nameIndex, *take<ConstPool::Index>(), cf);
+                    case ATTR_EXCEPTIONS: {
+                        u4 count = *take<u4>();
+                        const ConstPool::Index* es = take<ConstPool::Index>(count);
+                        return arena.create<ExceptionsAttr>(record.nameIndex, cf, vector<u2>(es, es + count));
+                    }
+                    case ATTR_CODE:
+                        return readCode(cf, record);
+                    case ATTR_LVT:
+                    case ATTR_LVTT: {
+                        LvtAttr* lvt = arena.create<LvtAttr>((AttrKind) record.kind, record.nameIndex, cf);
+                        u4 count = *take<u4>();
+                        const LvRecord* entries = take<LvRecord>(count);
+                        lvt->lvt.reserve(count);
+
+                        for (u4 i = 0; i < count; i++) {
+                            const LvRecord& e = entries[i];
+                            lvt->lvt.push_back({
+                                                       e.startPc, label(e.startPcLabel), nullptr, e.len,
+                                                       e.varNameIndex, e.varDescIndex, e.index
+                                               });
+                        }
+
+                        return lvt;
+                    }
+                    case ATTR_LNT: {
+                        LntAttr* lnt = arena.create<LntAttr>(record.nameIndex, cf);
+                        u4 count = *take<u4>();
+                        const LnRecord* entries = take<LnRecord>(count);
+                        lnt->lnt.reserve(count);
+
+                        for (u4 i = 0; i < count; i++) {
+                            const LnRecord& e = entries[i];
+                            lnt->lnt.push_back({e.startpc, label(e.startPcLabel), e.lineno});
+                        }
+
+                        return lnt;
+                    }
+                    case ATTR_SMT:
+                        return readSmt(cf, record);
+                }
+
+                throw Exception("Invalid attribute kind in class image: ", (int) record.kind);
+            }
+
+            CodeAttr* readCode(ClassFile* cf, const AttrRecord& attr) {
+                JnifError::check(instList == nullptr, "Nested Code attribute in class image");
+
+                CodeAttr* code = cf->_arena.create<CodeAttr>(attr.nameIndex, cf);
+                const CodeRecord& record = *take<CodeRecord>();
+                code->maxStack = record.maxStack;
+                code->maxLocals = record.maxLocals;
+                code->codeLen = record.codeLen;
+
+                instList = &code->instList;
+
+                // The label table follows the body, labels are created
+                // first as anything in the body can refer to them.
+                const u1* body = pos;
+                JnifError::check(record.labelsOffset <= size(), "Invalid label table in class image");
+                pos = image + record.labelsOffset;
+                const LabelRecord* labelRecords = take<LabelRecord>(record.labelCount);
+                const u1* next = pos;
+
+                labels.resize(record.labelCount);
+                for (u4 i = 0; i < record.labelCount; i++) {
+                    const LabelRecord& r = labelRecords[i];
+                    LabelInst* l = instList->createLabel();
+                    l->_offset = r._offset;
+                    l->offset = r.offset;
+                    l->deltaOffset = r.deltaOffset;
+                    l->isBranchTarget = r.isBranchTarget;
+                    l->isTryStart = r.isTryStart;
+                    l->isCatchHandler = r.isCatchHandler;
+                    labels[i] = l;
+                }
+
+                pos = body;
+                for (u4 i = 0; i < record.instCount; i++) {
+                    const InstRecord& r = *take<InstRecord>();
+                    Inst* inst = readInst(r);
+                    inst->_offset = r._offset;
+                }
+
+                const ExceptionRecord* exceptions = take<ExceptionRecord>(record.exceptionCount);
+                code->exceptions.reserve(record.exceptionCount);
+                for (u4 i = 0; i < record.exceptionCount; i++) {
+                    const ExceptionRecord& e = exceptions[i];
+                    code->exceptions.push_back({label(e.startpc), label(e.endpc), label(e.handlerpc), e.catchtype});
+                }
+
+                readAttrs(cf, &code->attrs);
+                JnifError::check(pos == image + record.labelsOffset, "Invalid label table in class image");
+                pos = next;
+
+                labels.clear();
+                instList = nullptr;
+
+                return code;
+            }
+
+            Inst* readInst(const InstRecord& r) {
+                Opcode opcode = (Opcode) r.opcode;
+
+                switch (r.kind) {
+                    case KIND_LABEL: {
+                        LabelInst* l = label(*take<u4>());
+                        JnifError::check(l != nullptr, "Null label in class image");
+                        instList->addLabel(l);
+                        return l;
+                    }
+                    case KIND_ZERO:
+                        if (opcode == Opcode::wide) {
+                            u4 operand = *take<u4>();
+                            Opcode subOpcode = (Opcode) (operand & 0xff);
+                            if (subOpcode == Opcode::iinc) {
+                                return instList->addWideIinc(r.a, operand >> 8);
+                            } else {
+                                return instList->addWideVar(subOpcode, r.a);
+                            }
+                        }
+
+                        return instList->addZero(opcode);
+                    case KIND_BIPUSH:
+                        return instList->addBiPush(r.a);
+                    case KIND_SIPUSH:
+                        return instList->addSiPush(r.a);
+                    case KIND_LDC:
+                        return instList->addLdc(opcode, r.a);
+                    case KIND_VAR:
+                        return instList->addVar(opcode, r.a);
+                    case KIND_IINC:
+                        return instList->addIinc(r.a & 0xff, r.a >> 8);
+                    case KIND_JUMP:
+                        return instList->addJump(opcode, label(*take<u4>()));
+                    case KIND_TABLESWITCH: {
+                        LabelInst* def = label(*take<u4>());
+                        int low = *take<int>();
+                        int high = *take<int>();
+                        TableSwitchInst* ts = instList->addTableSwitch(def, low, high);
+                        readTargets(ts);
+                        return ts;
+                    }
+                    case KIND_LOOKUPSWITCH: {
+                        LabelInst* def = label(*take<u4>());
+                        u4 npairs = *take<u4>();
+                        LookupSwitchInst* ls = instList->addLookupSwitch(def, npairs);
+                        u4 count = *take<u4>();
+                        const u4* keys = take<u4>(count);
+                        ls->keys.assign(keys, keys + count);
+                        readTargets(ls);
+                        return ls;
+                    }
+                    case KIND_FIELD:
+                        return instList->addField(opcode, r.a);
+                    case KIND_INVOKE:
+                        return instList->addInvoke(opcode, r.a);
+                    case KIND_INVOKEINTERFACE:
+                        return instList->addInvokeInterface(r.a, *take<u4>());
+                    case KIND_INVOKEDYNAMIC:
+                        return instList->addInvokeDynamic(r.a);
+                    case KIND_TYPE:
+                        return instList->addType(opcode, r.a);
+                    case KIND_NEWARRAY:
+                        return instList->addNewArray(r.a);
+                    case KIND_MULTIARRAY:
+                        return instList->addMultiArray(r.a, *take<u4>());
+                }
+
+                throw Exception("Invalid instruction kind in class image: ", (int) r.kind);
+            }
+
+            void readTargets(SwitchInst* si) {
+                u4 count = *take<u4>();
+                const u4* targets = take<u4>(count);
+
+                si->targets.reserve(count);
+                for (u4 i = 0; i < count; i++) {
+                    si->addTarget(label(targets[i]));
+                }
+            }
+
+            SmtAttr* readSmt(ClassFile* cf, const AttrRecord& attr) {
+                SmtAttr* smt = cf->_arena.create<SmtAttr>(attr.nameIndex, cf);
+                u4 count = *take<u4>();
+                smt->entries.reserve(count);
+
+                for (u4 i = 0; i < count; i++) {
+                    const FrameRecord& r = *take<FrameRecord>();
+
+                    smt->entries.emplace_back(&cf->_arena);
+
+                    SmtAttr::Entry& e = smt->entries.back();
+                    e.frameType = r.frameType;
+                    e.label = label(r.label);
+                    e.same_locals_1_stack_item_frame_extended.offset_delta = r.sameLocalsExtendedDelta;
+                    e.chop_frame.offset_delta = r.chopDelta;
+                    e.same_frame_extended.offset_delta = r.sameExtendedDelta;
+                    e.append_frame.offset_delta = r.appendDelta;
+                    e.full_frame.offset_delta = r.fullDelta;
+
+                    readTypes(cf, r.sameLocalsStackCount, &e.sameLocals_1_stack_item_frame.stack);
+                    readTypes(cf, r.sameLocalsExtendedStackCount, &e.same_locals_1_stack_item_frame_extended.stack);
+                    readTypes(cf, r.appendLocalsCount, &e.append_frame.locals);
+                    readTypes(cf, r.fullLocalsCount, &e.full_frame.locals);
+                    readTypes(cf, r.fullStackCount, &e.full_frame.stack);
+                }
+
+                return smt;
+            }
+
+            void readTypes(const ClassFile* cf, u2 count, ArenaVector<Type>* types) {
+                const TypeRecord* records = take<TypeRecord>(count);
+                types->reserve(count);
+
+                for (u2 i = 0; i < count; i++) {
+                    const TypeRecord& r = records[i];
+
+                    switch (r.tag) {
+                        case TYPE_TOP:
+                            types->push_back(TypeFactory::topType());
+                            break;
+                        case TYPE_INTEGER:
+                            types->push_back(TypeFactory::intType());
+                            break;
+                        case TYPE_FLOAT:
+                            types->push_back(TypeFactory::floatType());
+                            break;
+                        case TYPE_LONG:
+                            types->push_back(TypeFactory::longType());
+                            break;
+                        case TYPE_DOUBLE:
+                            types->push_back(TypeFactory::doubleType());
+                            break;
+                        case TYPE_NULL:
+                            types->push_back(TypeFactory::nullType());
+                            break;
+                        case TYPE_UNINITTHIS:
+                            types->push_back(TypeFactory::uninitThisType());
+                            break;
+                        case TYPE_OBJECT:
+                            JnifError::check(cf->isClass(r.index), "Bad cpindex: ", r.index);
+                            types->push_back(TypeFactory::objectType(cf->getClassSymbol(r.index), r.index));
+                            break;
+                        case TYPE_UNINIT:
+                            types->push_back(TypeFactory::uninitType(r.index, label(r.label)));
+                            break;
+                        default:
+                            throw Exception("Invalid type in class image: ", (int) r.tag);
+                    }
+                }
+            }
+
+            LabelInst* label(u4 id) {
+                if (id == NOLABEL) {
+                    return nullptr;
+                }
+
+                JnifError::check(id < labels.size(), "Invalid label id in class image: ", id);
+                return labels[id];
+            }
+
+            /**
+             * Returns the next count records and skips them.
+             */
+            template<typename T>
+            const T* take(u4 count = 1) {
+                JnifError::check(count <= (size_t) (end - pos) / sizeof(T), "Truncated class image");
+
+                const T* records = (const T*) pos;
+                pos += count * sizeof(T);
+                return records;
+            }
+
+            void align(size_t alignment) {
+                size_t offset = (pos - image + alignment - 1) & ~(alignment - 1);
+                pos = image + std::min(offset, size());
+            }
+
+            size_t size() const {
+                return end - image;
+            }
+
+            const u1* const image;
+
+            const u1* pos;
+
+            const u1* const end;
+
+            /**
+             * The instruction list of the Code attribute being read.
+             */
+            InstList* instList = nullptr;
+
+            /**
+             * The labels of the Code attribute being read, by image id.
+             */
+            vector<LabelInst*> labels;
+        };
+
+        void ClassFile::writeImage(vector<u1>* image) {
+            image->clear();
+            ImageWriter(image).writeClassFile(*this);
+        }
+
+        ClassFile::ClassFile(const u1* image, u4 imageLen, ArenaPool* pool) :
+                _arena(Arena::INITIAL_BLOCK_SIZE, pool),
+                interfaces(_create<ArenaList<ConstPool::Index> >()), fields(_create<ArenaList<Field> >()),
+                methods(_create<ArenaList<Method> >()), attrs(_create<Attrs>()), sig(&attrs) {
+            ImageReader(image, imageLen).readClassFile(this);
+        }
+
+    }
+}
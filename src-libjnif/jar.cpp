@@ -5,6 +5,14 @@
 #include "jnif.hpp"
 #include "zip/unzip.h"
 
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace jnif {
 
     namespace jar {
@@ -101,5 +109,142 @@ namespace jnif {
             free(buf);
             return err;
         }
+
+        constexpr const char* ClassCache::MAGIC;
+
+        constexpr u4 ClassCache::VERSION;
+
+        constexpr u4 ClassCache::HEADER_SIZE;
+
+        constexpr u4 ClassCache::ENTRY_SIZE;
+
+        void ClassCache::Builder::add(const char* fileName, const u1* data, u4 len, ClassFile* classFile) {
+            size_t nameLen = strlen(fileName);
+
+            _entries.push_back(_names.size());
+            _entries.push_back(nameLen);
+            _names.insert(_names.end(), fileName, fileName + nameLen + 1);
+
+            // Keeps each class 8-byte aligned in the image.
+            _data.resize((_data.size() + 7) & ~(size_t) 7);
+
+            _entries.push_back(_data.size());
+            _entries.push_back(len);
+            _data.insert(_data.end(), data, data + len);
+
+            vector<u1> image;
+            if (classFile != nullptr) {
+                classFile->writeImage(&image);
+            }
+
+            _data.resize((_data.size() + 7) & ~(size_t) 7);
+
+            _entries.push_back(_data.size());
+            _entries.push_back(image.size());
+            _data.insert(_data.end(), image.begin(), image.end());
+
+            _count++;
+        }
+
+        void ClassCache::Builder::write(const char* path) const {
+            size_t namesOffset = HEADER_SIZE + _entries.size() * sizeof(u4);
+            size_t dataOffset = (namesOffset + _names.size() + 7) & ~(size_t) 7;
+
+            if (dataOffset + _data.size() > UINT32_MAX) {
+                throw JarException("Cache file too large");
+            }
+
+            vector<u1> header(namesOffset, 0);
+            memcpy(header.data(), MAGIC, 8);
+            memcpy(header.data() + 8, &VERSION, 4);
+            memcpy(header.data() + 12, &_count, 4);
+
+            u4* entries = (u4*) (header.data() + HEADER_SIZE);
+            for (int i = 0; i < _count; i++) {
+                const u4* e = &_entries[ENTRY_SIZE * i];
+                u4* entry = entries + ENTRY_SIZE * i;
+                entry[0] = namesOffset + e[0];
+                entry[1] = e[1];
+                entry[2] = dataOffset + e[2];
+                entry[3] = e[3];
+                entry[4] = dataOffset + e[4];
+                entry[5] = e[5];
+            }
+
+            static const u1 padding[8] = {};
+            size_t paddingLen = dataOffset - namesOffset - _names.size();
+
+            std::string tmpPath = std::string(path) + ".tmp";
+            FILE* f = fopen(tmpPath.c_str(), "wb");
+            if (f == nullptr) {
+                throw JarException("Can't open cache file for writing");
+            }
+
+            bool ok = fwrite(header.data(), 1, header.size(), f) == header.size()
+                      && fwrite(_names.data(), 1, _names.size(), f) == _names.size()
+                      && fwrite(padding, 1, paddingLen, f) == paddingLen
+                      && fwrite(_data.data(), 1, _data.size(), f) == _data.size();
+
+            if (fclose(f) != 0 || !ok || rename(tmpPath.c_str(), path) != 0) {
+                remove(tmpPath.c_str());
+                throw JarException("Can't write cache file");
+            }
+        }
+
+        ClassCache::ClassCache(const char* path) : _image(nullptr), _size(0), _count(0) {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0) {
+                throw JarException("Can't open cache file");
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t) st.st_size < HEADER_SIZE) {
+                close(fd);
+                throw JarException("Invalid cache file");
+            }
+
+            _size = st.st_size;
+            void* image = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if (image == MAP_FAILED) {
+                throw JarException("Can't map cache file");
+            }
+
+            _image = (const u1*) image;
+
+            u4 version;
+            u4 count;
+            memcpy(&version, _image + 8, 4);
+            memcpy(&count, _image + 12, 4);
+
+            bool valid = memcmp(_image, MAGIC, 8) == 0 && version == VERSION
+                         && count <= (_size - HEADER_SIZE) / (ENTRY_SIZE * sizeof(u4));
+
+            _count = valid ? count : 0;
+            for (int i = 0; i < _count && valid; i++) {
+                const u4* e = _entry(i);
+                valid = e[0] < _size && e[1] < _size - e[0] && _image[e[0] + e[1]] == '\0'
+                        && e[2] <= _size && e[3] <= _size - e[2]
+                        && e[4] <= _size && e[5] <= _size - e[4] && e[4] % 8 == 0;
+            }
+
+            if (!valid) {
+                munmap((void*) _image, _size);
+                throw JarException("Invalid cache file");
+            }
+        }
+
+        ClassCache::~ClassCache() {
+            munmap((void*) _image, _size);
+        }
+
+        int ClassCache::forEach(void* args, int jarid, JarFile::ZipCallback callback) const {
+            for (int i = 0; i < _count; i++) {
+                callback(args, jarid, (void*) data(i), len(i), fileName(i));
+            }
+
+            return _count;
+        }
     }
 }
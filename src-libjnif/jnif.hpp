@@ -2,11 +2,14 @@
 #ifndef JNIF_HPP
 #define JNIF_HPP
 
+#include <algorithm>
+#include <cstdint>
 #include <sstream>
 #include <vector>
 #include <list>
 #include <map>
 #include <set>
+#include <thread>
 
 /**
  * The jnif namespace contains all type definitions, constants, enumerations
@@ -54,6 +57,12 @@ namespace jnif {
      */
     typedef unsigned int u4;
 
+    /**
+     * Represents eight bytes, e.g., the two halves of a long constant.
+     * The sizeof(u8) must be equal to 8.
+     */
+    typedef unsigned long long u8;
+
     /**
      * Represents the base exception that JNIF can throw.
      */
@@ -163,9 +172,34 @@ namespace jnif {
                 expected, ", actual=", actual, ", message: ", args...);
     }
 
+    /**
+     * Bump allocator for the objects of a class file.
+     *
+     * Blocks are allocated on demand.
+     * The first block has the given block size, and each following block
+     * doubles the size of the previous one, up to BLOCK_SIZE.
+     * Allocations larger than the current block size get a dedicated block.
+     *
+     * When created with an ArenaPool, blocks are taken from the pool and
+     * given back to it when the arena is destroyed.
+     *
+     * Objects created in an arena are never destroyed, their memory is
+     * reclaimed with the blocks, so that they must not own heap memory.
+     * Heap objects that live as long as the arena are given to own.
+     */
     class Arena {
+        friend class ArenaPool;
+
     public:
 
+        /**
+         * Default size of the first block.
+         */
+        static constexpr int INITIAL_BLOCK_SIZE = 4 * 1024;
+
+        /**
+         * Maximum size of a block, except dedicated blocks.
+         */
         static constexpr int BLOCK_SIZE = 1024 * 1024;
 
         Arena(const Arena&) = delete;
@@ -174,38 +208,268 @@ namespace jnif {
 
         Arena(const Arena&&) = delete;
 
-        explicit Arena(size_t blockSize = BLOCK_SIZE);
+        explicit Arena(size_t blockSize = INITIAL_BLOCK_SIZE, class ArenaPool* pool = nullptr);
 
         ~Arena();
 
-        void* alloc(int size);
+        /**
+         * Allocates size bytes aligned to align, which must be a power of two.
+         */
+        void* alloc(size_t size, size_t align = 1);
+
+        /**
+         * Ensures that at least size bytes can be allocated without
+         * allocating a new block.
+         * Used by the parser to size the arena from the class file length.
+         */
+        void reserve(size_t size);
 
         template<typename T, typename ... TArgs>
         T* create(const TArgs& ... args) {
-            void* buf = alloc(sizeof(T));
+            void* buf = alloc(sizeof(T), alignof(T));
             return new(buf) T(args ...);
         }
 
         template<typename T>
-        T* newArray(int size) {
-            void* buf = alloc(sizeof(T) * size);
+        T* newArray(size_t size) {
+            void* buf = alloc(sizeof(T) * size, alignof(T));
             return new(buf) T[size];
         }
 
+        /**
+         * Deletes obj, a heap object, when this arena is destroyed,
+         * before its blocks are released.
+         * Objects are deleted in the reverse order they were given.
+         */
+        template<typename T>
+        T* own(T* obj) {
+            _addFinalizer([](void* p) { delete (T*) p; }, obj);
+            return obj;
+        }
+
     private:
 
         class Block;
 
+        struct Finalizer;
+
+        void _newBlock(size_t size);
+
+        void _addFinalizer(void (* fn)(void*), void* obj);
+
+        /**
+         * Size of the next block to allocate.
+         */
         size_t blockSize;
 
         Block* _head;
 
+        Finalizer* _finalizers;
+
+        ArenaPool* const _pool;
+
+    };
+
+    /**
+     * Recycles arena blocks across short-lived class files.
+     *
+     * All blocks in a pool have the same size.
+     * Arenas using a pool take their blocks from it, and give them back
+     * when destroyed, so that parsing a stream of classes does not
+     * allocate new blocks once the pool is warm.
+     *
+     * A pool is not thread-safe.
+     * Use local() to get a pool for the current thread.
+     * Arenas using a pool must be destroyed on a thread that may use it.
+     * At most maxFree blocks are kept for reuse, blocks given back beyond
+     * that are freed, so that a thread that once parsed a large class does
+     * not hold its blocks for the rest of its life.
+     */
+    class ArenaPool {
+        friend class Arena;
+
+    public:
+
+        /**
+         * Size of a huge page.
+         */
+        static constexpr int HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        /**
+         * Default number of blocks kept for reuse.
+         */
+        static constexpr int MAX_FREE = 8;
+
+        ArenaPool(const ArenaPool&) = delete;
+
+        ArenaPool& operator=(const ArenaPool&) = delete;
+
+        /**
+         * Creates an empty pool.
+         *
+         * @param hugePages when true, blocks are aligned to and sized as
+         * huge pages, and the kernel is advised to back them with
+         * transparent huge pages.
+         * Otherwise, blocks have Arena::BLOCK_SIZE bytes.
+         * @param maxFree the maximum number of blocks kept for reuse.
+         */
+        explicit ArenaPool(bool hugePages = false, int maxFree = MAX_FREE);
+
+        ~ArenaPool();
+
+        size_t blockSize() const {
+            return _blockSize;
+        }
+
+        /**
+         * Returns the number of blocks ready to be reused.
+         */
+        int freeBlocks() const {
+            return _freeCount;
+        }
+
+        /**
+         * Returns the pool of the current thread.
+         *
+         * Arenas, and thus class files, using it must be destroyed on the
+         * same thread, before that thread exits.
+         * Taking or giving back a block of this pool on another thread
+         * raises a JnifError, which terminates the program when it is
+         * given back by the destructor of an arena.
+         */
+        static ArenaPool& local();
+
+    private:
+
+        Arena::Block* _acquire(Arena::Block* next);
+
+        void _release(Arena::Block* block);
+
+        const bool _hugePages;
+
+        const size_t _blockSize;
+
+        const int _maxFree;
+
+        Arena::Block* _free;
+
+        int _freeCount;
+
+        /**
+         * The thread of a pool returned by local(), otherwise no thread.
+         */
+        std::thread::id _owner;
+
+    };
+
+    /**
+     * Standard allocator that takes its memory from an arena.
+     *
+     * Deallocation does nothing, the memory is reclaimed when the arena
+     * is destroyed.
+     * Containers of a class file use the arena of the class file,
+     * so that their elements need no separate heap allocation.
+     * A default constructed allocator, i.e., without arena,
+     * uses the heap.
+     */
+    template<typename T>
+    class ArenaAllocator {
+    public:
+
+        typedef T value_type;
+
+        ArenaAllocator(Arena* arena = nullptr) : arena(arena) {
+        }
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {
+        }
+
+        T* allocate(size_t n) {
+            JnifError::check(n <= SIZE_MAX / sizeof(T), "Allocation too large: ", n, " elements");
+
+            if (arena == nullptr) {
+                return (T*) ::operator new(n * sizeof(T));
+            }
+
+            return (T*) arena->alloc(n * sizeof(T), alignof(T));
+        }
+
+        void deallocate(T* p, size_t) {
+            if (arena == nullptr) {
+                ::operator delete(p);
+            }
+        }
+
+        template<typename U>
+        friend bool operator==(const ArenaAllocator& lhs, const ArenaAllocator<U>& rhs) {
+            return lhs.arena == rhs.arena;
+        }
+
+        template<typename U>
+        friend bool operator!=(const ArenaAllocator& lhs, const ArenaAllocator<U>& rhs) {
+            return lhs.arena != rhs.arena;
+        }
+
+        Arena* arena;
     };
 
+    template<typename T>
+    using ArenaVector = vector<T, ArenaAllocator<T> >;
+
+    template<typename T>
+    using ArenaList = list<T, ArenaAllocator<T> >;
+
     class ControlFlowGraph;
 
     namespace model {
 
+        /**
+         * Process-wide table of class names.
+         *
+         * Each distinct class name is given a small number, its symbol,
+         * so that types and class hierarchies compare and copy classes as
+         * integers instead of strings.
+         * Symbols are never released, and interning is thread-safe.
+         */
+        class ClassNames {
+        public:
+
+            typedef u4 Symbol;
+
+            /**
+             * Symbols interned up front.
+             */
+            enum : Symbol {
+                NONE = 0,
+                OBJECT = 1,
+                STRING = 2,
+                THROWABLE = 3,
+            };
+
+            /**
+             * Returns the symbol of the class name given by its bytes,
+             * adding it when not yet interned.
+             */
+            static Symbol intern(const char* name, size_t len);
+
+            static Symbol intern(const string& name) {
+                return intern(name.data(), name.size());
+            }
+
+            /**
+             * Returns the symbol of the given class name, or NONE when it
+             * was never interned.
+             */
+            static Symbol find(const char* name, size_t len);
+
+            /**
+             * Returns the class name of symbol, which stays valid
+             * for the lifetime of the process.
+             */
+            static const string& name(Symbol symbol);
+        };
+
         /**
          * Represents the Java class file's constant pool.
          * Provides the base services to manage the constant pool.
@@ -218,8 +482,18 @@ namespace jnif {
          * This class works by adding these kinds of entries in an array-like
          * structure. When an entry is removed, all entries after the one removed will
          * be invalidated, for this reason, no removed operations are allowed.
+         *
+         * Entries are stored as parallel tag, payload and UTF8 arrays.
+         * The entries member still gives an Item per index, but items are
+         * copies built on access, not references into the pool.
+         * Their UTF8 bytes are not null-terminated when borrowed from a
+         * lazily parsed class file; use getUtf8 for a C string.
          */
         class ConstPool {
+            friend class ImageWriter;
+
+            friend class ImageReader;
+
         public:
 
             ConstPool(const ConstPool&) = delete;
@@ -319,15 +593,32 @@ namespace jnif {
             };
 
             /// Contains a modified UTF-8 string.
+            /// The bytes are either in the byte arena of the constant pool,
+            /// where they are null-terminated, or borrowed from the buffer of
+            /// a lazily parsed class file.
             /// @see UTF8
             struct Utf8 {
 
-                Utf8() {}
+                /// The string bytes, not null-terminated when borrowed.
+                const char* bytes() const {
+                    return data;
+                }
+
+                /// The length in bytes of this string.
+                u2 length() const {
+                    return len;
+                }
+
+                /// Whether the bytes of this string are borrowed.
+                bool isBorrowed() const {
+                    return borrowed;
+                }
+
+                const char* data;
 
-                Utf8(const string& str) : str(str) {}
+                u2 len;
 
-                /// The string data.
-                const string str;
+                bool borrowed;
             };
 
             /// Represents a method handle entry.
@@ -418,41 +709,93 @@ namespace jnif {
             };
 
             /**
-             * The const item.
+             * The fixed-width payload of an entry.
+             * The tag of each entry is kept apart, and the UTF8 entries
+             * only hold their position in the UTF8 table.
              */
-            struct Item {
+            union Value {
+
+                Value() : utf8Index(0) {}
+
+                Value(Class clazz) : clazz(clazz) {}
 
-                Item() : tag(NULLENTRY) {}
+                Value(MemberRef memberRef) : memberRef(memberRef) {}
 
-                explicit Item(Class clazz) : tag(CLASS), clazz(clazz) {}
+                Value(String s) : s(s) {}
 
-                Item(Tag tag, MemberRef memberRef) : tag(tag), memberRef(memberRef) {}
+                Value(Integer i) : i(i) {}
 
-                Item(String s) : tag(STRING), s(s) {}
+                Value(Float f) : f(f) {}
 
-                Item(Integer i) : tag(INTEGER), i(i) {}
+                Value(Long l) : l(l) {}
 
-                Item(Float f) : tag(FLOAT), f(f) {}
+                Value(Double d) : d(d) {}
 
-                Item(Long l) : tag(LONG), l(l) {}
+                Value(NameAndType nat) : nameAndType(nat) {}
+
+                Value(MethodHandle mh) : methodHandle(mh) {}
+
+                Value(MethodType mt) : methodType(mt) {}
+
+                Value(InvokeDynamic id) : invokeDynamic(id) {}
+
+                explicit Value(u4 utf8Index) : utf8Index(utf8Index) {}
+
+                Class clazz;
+                MemberRef memberRef;
+                String s;
+                Integer i;
+                Float f;
+                Long l;
+                Double d;
+                NameAndType nameAndType;
+                MethodHandle methodHandle;
+                MethodType methodType;
+                InvokeDynamic invokeDynamic;
+                u4 utf8Index;
+            };
+
+            /**
+             * Defines how to iterate the constant pool.
+             */
+            class Iterator {
+                friend class ConstPool;
 
-                Item(Double d) : tag(DOUBLE), d(d) {}
+            public:
 
-                Item(NameAndType nat) : tag(NAMEANDTYPE), nameAndType(nat) {}
+                bool hasNext() const {
+                    return index < cp.size();
+                }
 
-                Item(MethodHandle mh) : tag(METHODHANDLE), methodHandle(mh) {}
+                Index operator*() const {
+                    return index;
+                }
 
-                Item(MethodType mt) : tag(METHODTYPE), methodType(mt) {}
+                Iterator& operator++(int) {
+                    index += cp._isDoubleEntry(index) ? 2 : 1;
 
-                Item(InvokeDynamic id) : tag(INVOKEDYNAMIC), invokeDynamic(id) {}
+                    return *this;
+                }
 
-                Item(const string& value) : tag(UTF8), utf8(value) {}
+            private:
+                Iterator(const ConstPool& cp, Index index) :
+                        cp(cp), index(index) {
+                }
 
-                Item(const Item&) = delete;
+                const ConstPool& cp;
+                Index index;
+            };
 
-                Item& operator=(const Item&) = delete;
+            /**
+             * A copy of an entry, with its tag, payload and UTF8 bytes.
+             * Entries are stored apart in the tag, payload and UTF8 arrays,
+             * so items are only built on access through entries, which is
+             * kept for compatibility.
+             * Prefer getTag, getValue and getUtf8Entry.
+             */
+            struct Item {
 
-                Item(Item&&) = default;
+                Item(Tag tag, const Value& value, const Utf8& utf8);
 
                 const Tag tag;
 
@@ -470,39 +813,32 @@ namespace jnif {
                     InvokeDynamic invokeDynamic;
                 };
 
+                /**
+                 * The bytes of a UTF8 entry, empty for other entries.
+                 */
                 const Utf8 utf8;
-
             };
 
             /**
-             * Defines how to iterate the constant pool.
+             * Read-only view of the entries by index, including the null
+             * entry and the second slot of long and double entries.
              */
-            class Iterator {
-                friend class ConstPool;
-
+            class Entries {
             public:
 
-                bool hasNext() const {
-                    return index < cp.size();
+                explicit Entries(const ConstPool& cp) : cp(cp) {
                 }
 
-                Index operator*() const {
-                    return index;
+                Item operator[](Index index) const {
+                    return cp._item(index);
                 }
 
-                Iterator& operator++(int) {
-                    index += cp._isDoubleEntry(index) ? 2 : 1;
-
-                    return *this;
+                size_t size() const {
+                    return cp.tags.size();
                 }
 
             private:
-                Iterator(const ConstPool& cp, Index index) :
-                        cp(cp), index(index) {
-                }
-
                 const ConstPool& cp;
-                Index index;
             };
 
             /// Represents the invalid (null) item, which must not be asked for.
@@ -511,10 +847,21 @@ namespace jnif {
             /**
              * Initializes an empty constant pool. The valid indices start from 1
              * inclusive, because the null entry (index 0) is added by default.
+             * The parser reserves the exact number of entries from the
+             * constant_pool_count of the class file.
+             */
+            explicit ConstPool(size_t initialCapacity = 64) {
+                reserve(initialCapacity);
+                tags.push_back(NULLENTRY);
+                values.emplace_back();
+            }
+
+            /**
+             * Reserves space for count entries, including the null entry.
              */
-            explicit ConstPool(size_t initialCapacity = 4096) {
-                entries.reserve(initialCapacity);
-                entries.emplace_back();
+            void reserve(size_t count) {
+                tags.reserve(count);
+                values.reserve(count);
             }
 
             /// Returns the number of elements in this constant pool.
@@ -522,9 +869,10 @@ namespace jnif {
             u4 size() const;
 
             /**
-             *
+             * Iterates the entries from start, which must not be the second
+             * slot of a long or double entry.
              */
-            Iterator iterator() const;
+            Iterator iterator(Index start = 1) const;
 
             /// Adds a class reference to the constant pool.
             /// @param classNameIndex the utf8 index that represents the name of this
@@ -645,6 +993,17 @@ namespace jnif {
              */
             Index addUtf8(const char* str);
 
+            /**
+             * Adds a modified UTF8 string without copying it.
+             * The entry borrows utf8, so it must outlive this constant pool.
+             * Used when parsing lazily.
+             *
+             * @param utf8 the char array containing the modified UTF8 string.
+             * @param len the len in bytes of utf8.
+             * @returns the Index of the newly created entry.
+             */
+            Index addUtf8View(const char* utf8, u2 len);
+
             /**
              * @returns the Index of the newly created entry.
              */
@@ -660,23 +1019,39 @@ namespace jnif {
              *
              */
             Tag getTag(Index index) const {
-                const Item* entry = _getEntry(index);
-                return entry->tag;
+                _getEntry(index);
+                return (Tag) tags[index];
             }
 
             /**
              * Checks whether the requested index holds a class reference.
              */
             bool isClass(Index index) const {
-                return _getEntry(index)->tag == CLASS;
+                return getTag(index) == CLASS;
             }
 
             bool isUtf8(Index index) const {
-                return _getEntry(index)->tag == UTF8;
+                return getTag(index) == UTF8;
+            }
+
+            /**
+             * Returns the payload of the entry at index, e.g., the raw indices
+             * of a member reference.
+             */
+            const Value& getValue(Index index) const {
+                return *_getEntry(index);
+            }
+
+            /**
+             * Returns the bytes of the UTF8 entry at index without
+             * null-terminating them.
+             */
+            const Utf8& getUtf8Entry(Index utf8Index) const {
+                return utf8s[_getEntry(utf8Index, UTF8, "Utf8")->utf8Index];
             }
 
             Index getClassNameIndex(Index classIndex) const {
-                const Item* e = _getEntry(classIndex, CLASS, "CONSTANT_Class");
+                const Value* e = _getEntry(classIndex, CLASS, "CONSTANT_Class");
                 Index ni = e->clazz.nameIndex;
 
                 return ni;
@@ -684,14 +1059,14 @@ namespace jnif {
 
             void getFieldRef(Index index, string* className, string* name,
                              string* desc) const {
-                const Item* e = _getEntry(index, FIELDREF, "FieldRef");
+                const Value* e = _getEntry(index, FIELDREF, "FieldRef");
                 const MemberRef& mr = e->memberRef;
                 _getMemberRef(className, name, desc, mr);
             }
 
             void getMethodRef(Index index, string* clazzName, string* name,
                               string* desc) const {
-                const Item* e = _getEntry(index, METHODREF, "MethodRef");
+                const Value* e = _getEntry(index, METHODREF, "MethodRef");
                 const MemberRef& mr = e->memberRef;
                 _getMemberRef(clazzName, name, desc, mr);
             }
@@ -699,13 +1074,13 @@ namespace jnif {
             void getInterMethodRef(
                     Index index, string* clazzName, string* name,
                     string* desc) const {
-                const Item* e = _getEntry(index, INTERMETHODREF, "imr");
+                const Value* e = _getEntry(index, INTERMETHODREF, "imr");
                 const MemberRef& mr = e->memberRef;
                 _getMemberRef(clazzName, name, desc, mr);
             }
 
             const char* getString(Index index) const {
-                const Item* e = _getEntry(index, STRING, "String");
+                const Value* e = _getEntry(index, STRING, "String");
                 return getUtf8(e->s.stringIndex);
             }
 
@@ -725,18 +1100,27 @@ namespace jnif {
                 return _getEntry(index, DOUBLE, "CONSTANT_Double")->d.value;
             }
 
-            const char* getUtf8(Index utf8Index) const {
-                const Item* entry = _getEntry(utf8Index, UTF8, "Utf8");
-                return entry->utf8.str.c_str();
-            }
+            /**
+             * Returns the null-terminated string of the UTF8 entry at index.
+             * A borrowed string is copied into the byte arena on the first
+             * call.
+             */
+            const char* getUtf8(Index utf8Index) const;
 
             const char* getClassName(Index classIndex) const {
                 Index classNameIndex = getClassNameIndex(classIndex);
                 return getUtf8(classNameIndex);
             }
 
+            /**
+             * Returns the interned class name of the class entry at
+             * classIndex.
+             * The symbol is cached, so each entry is interned at most once.
+             */
+            ClassNames::Symbol getClassSymbol(Index classIndex) const;
+
             void getNameAndType(Index index, string* name, string* desc) const {
-                const Item* e = _getEntry(index, NAMEANDTYPE, "NameAndType");
+                const Value* e = _getEntry(index, NAMEANDTYPE, "NameAndType");
                 u2 nameIndex = e->nameAndType.nameIndex;
                 u2 descIndex = e->nameAndType.descriptorIndex;
 
@@ -745,7 +1129,7 @@ namespace jnif {
             }
 
             const InvokeDynamic& getInvokeDynamic(Index index) const {
-                const Item* e = _getEntry(index, INVOKEDYNAMIC, "Indy");
+                const Value* e = _getEntry(index, INVOKEDYNAMIC, "Indy");
                 return e->invokeDynamic;
             }
 
@@ -765,72 +1149,278 @@ namespace jnif {
             Index putClass(const char* className) {
                 Index i = getIndexOfClass(className);
                 if (i == NULLENTRY) {
-                    i = addClass(className);
-                    classes[className] = i;
-                    return i;
+                    return addClass(className);
                 } else {
                     return i;
                 }
             }
 
-            vector<Item> entries;
+            /**
+             * Returns the index of a field reference equal to the given one,
+             * adding it when this constant pool does not contain it yet.
+             * The put* family of methods are the deduplicating counterparts
+             * of the add* methods, i.e., instrumentation passes can call them
+             * repeatedly without growing the constant pool.
+             */
+            Index putFieldRef(Index classIndex, Index nameAndTypeIndex);
 
-        private:
+            Index putFieldRef(Index classIndex, const char* name, const char* desc);
 
-            template<class... TArgs>
-            Index _addSingle(TArgs... args);
+            Index putMethodRef(Index classIndex, Index nameAndTypeIndex);
 
-            template<class... TArgs>
-            Index _addDoubleEntry(TArgs... args);
+            Index putMethodRef(Index classIndex, const char* name, const char* desc);
 
-            const Item* _getEntry(Index i) const;
+            Index putInterMethodRef(Index classIndex, Index nameAndTypeIndex);
 
-            const Item* _getEntry(Index index, u1 tag, const char* message) const;
+            Index putInterMethodRef(Index classIndex, const char* name, const char* desc);
 
-            bool _isDoubleEntry(Index index) const {
-                const Item* e = _getEntry(index);
-                return e->tag == LONG || e->tag == DOUBLE;
-            }
+            Index putNameAndType(Index nameIndex, Index descIndex);
 
-            void _getMemberRef(
-                    string* clazzName, string* name, string* desc,
-                    const MemberRef& memberRef) const {
-                Index classIndex = memberRef.classIndex;
-                Index nameAndTypeIndex = memberRef.nameAndTypeIndex;
+            Index putNameAndType(const char* name, const char* desc);
 
-                *clazzName = getClassName(classIndex);
-                getNameAndType(nameAndTypeIndex, name, desc);
-            }
+            Index putString(Index utf8Index);
 
-            map<string, Index> utf8s;
-            map<string, Index> classes;
-        };
+            Index putString(const string& str);
 
-        ostream& operator<<(ostream& os, const ConstPool::Tag& tag);
+            Index putStringFromClass(Index classIndex);
 
-        /**
-         * The Version class is a tuple containing a major and minor
-         * version numbers fields.
-         *
-         * The values of the major and minor fields are the minor
-         * and major version numbers of this class file.
-         * Together, a major and a minor version number determine the version of the
-         * class file format.
-         * If a class file has major version number M and minor version number m,
-         * we denote the version of its class file format as M.m.
-         * Thus, class file format versions may be ordered lexicographically,
-         * for example, 1.5 < 2.0 < 2.1.
-         *
-         * A Java Virtual Machine implementation can support a class file format of
-         * version v if and only if v lies in some contiguous range Mi.0 <= v <= Mj.m.
-         * The release level of the Java SE platform to which a Java Virtual Machine
-         * implementation conforms is responsible for determining the range.
-         */
-        class Version {
-        public:
+            Index putInteger(int value);
+
+            Index putFloat(float value);
+
+            Index putLong(long value);
+
+            Index putDouble(double value);
+
+            Index putMethodType(Index descIndex);
 
             /**
-             * Using default 51, which is supported by JDK 1.7.
+             * Returns true when entries were added to this constant pool
+             * since the last call to setModified(false).
+             */
+            bool isModified() const {
+                return modified;
+            }
+
+            void setModified(bool modified) {
+                this->modified = modified;
+            }
+
+            /**
+             * The entries of this constant pool, indexed by constant pool
+             * index.
+             */
+            const Entries entries{*this};
+
+            /**
+             * When not null, points to the encoded entries in the parsed
+             * buffer, from index 1 up to _sourceCount exclusive.
+             * Entries can only be appended, so the writer copies this range
+             * verbatim and encodes only the entries after it.
+             * Set by the parser when parsing lazily.
+             */
+            const u1* _source = nullptr;
+
+            /**
+             * The length in bytes of _source.
+             */
+            u4 _sourceLen = 0;
+
+            /**
+             * The number of entries, including the null entry, encoded in
+             * _source.
+             */
+            Index _sourceCount = 0;
+
+        protected:
+
+            /**
+             * Removes the entries not marked in live, nor referenced by
+             * another live entry, and renumbers the remaining ones in order.
+             * Long and double entries keep their second slot.
+             *
+             * @param live marks the entries referenced from outside
+             * this constant pool. It is updated with the entries they
+             * reference in turn.
+             * @returns the new index of each old index, NULLENTRY for
+             * removed entries.
+             */
+            vector<Index> _compact(vector<bool>& live);
+
+            /**
+             * Replaces the entries of this constant pool with a copy of the
+             * entries of source, keeping their indices.
+             * Borrowed UTF8 entries keep borrowing the same bytes.
+             */
+            void _copy(const ConstPool& source);
+
+            /**
+             * Open-addressing hash table of constant pool indices.
+             * Only the hash of each key is stored, lookups compare the
+             * candidate entries themselves.
+             */
+            class IndexTable {
+            public:
+
+                /**
+                 * Whether this table has been populated.
+                 * Tables are built on the first lookup.
+                 */
+                bool built = false;
+
+                template<typename TEquals>
+                Index find(u4 hash, TEquals equals) const {
+                    if (slots.empty()) {
+                        return NULLENTRY;
+                    }
+
+                    u4 mask = slots.size() - 1;
+                    for (u4 i = hash & mask; slots[i].index != NULLENTRY; i = (i + 1) & mask) {
+                        if (slots[i].hash == hash && equals(slots[i].index)) {
+                            return slots[i].index;
+                        }
+                    }
+
+                    return NULLENTRY;
+                }
+
+                void insert(u4 hash, Index index);
+
+            private:
+
+                struct Slot {
+                    u4 hash;
+                    Index index;
+                };
+
+                vector<Slot> slots;
+
+                u4 count = 0;
+            };
+
+            static u4 _hash(const char* str, size_t len);
+
+        private:
+
+            Item _item(Index index) const;
+
+            /**
+             * The tag of each entry.
+             * Together with values, it is indexed by constant pool index.
+             */
+            vector<u1> tags;
+
+            vector<Value> values;
+
+            /**
+             * The UTF8 entries, in order of addition.
+             * Mutable since getUtf8 copies borrowed strings on demand.
+             */
+            mutable vector<Utf8> utf8s;
+
+            /**
+             * Holds the bytes of the UTF8 entries not borrowed.
+             */
+            mutable Arena _utf8Arena;
+
+            /**
+             * The symbol of each class entry, indexed by constant pool
+             * index, or NONE when not yet interned.
+             */
+            mutable vector<ClassNames::Symbol> _classSymbols;
+
+            bool modified = true;
+
+            Index _addSingle(Tag tag, Value value);
+
+            Index _addDoubleEntry(Tag tag, Value value);
+
+            /**
+             * Looks up an entry equal to the given one,
+             * adding it when not found.
+             */
+            Index _putValue(Tag tag, Value value);
+
+            const Value* _getEntry(Index i) const;
+
+            const Value* _getEntry(Index index, u1 tag, const char* message) const;
+
+            const Utf8& _getUtf8(Index utf8Index) const {
+                return utf8s[values[utf8Index].utf8Index];
+            }
+
+            bool _isDoubleEntry(Index index) const {
+                _getEntry(index);
+                return tags[index] == LONG || tags[index] == DOUBLE;
+            }
+
+            void _getMemberRef(
+                    string* clazzName, string* name, string* desc,
+                    const MemberRef& memberRef) const {
+                Index classIndex = memberRef.classIndex;
+                Index nameAndTypeIndex = memberRef.nameAndTypeIndex;
+
+                *clazzName = getClassName(classIndex);
+                getNameAndType(nameAndTypeIndex, name, desc);
+            }
+
+
+            u4 _classHash(Index classIndex) const;
+
+            /**
+             * Packs the payload of a non-symbolic entry, i.e., not Utf8 nor
+             * Class, into 64 bits.
+             * Two such entries are equal iff their tags and keys are equal.
+             */
+            static u8 _valueKey(Tag tag, const Value& entry);
+
+            static u4 _valueHash(Tag tag, const Value& entry);
+
+            static bool _isValue(Tag tag);
+
+            /**
+             * Inserts the newly added entry in the index tables already built.
+             */
+            void _indexEntry(Index index);
+
+            void _buildUtf8Index();
+
+            void _buildClassIndex();
+
+            void _buildValueIndex();
+
+            IndexTable _utf8Index;
+
+            IndexTable _classIndex;
+
+            IndexTable _valueIndex;
+        };
+
+        ostream& operator<<(ostream& os, const ConstPool::Tag& tag);
+
+        /**
+         * The Version class is a tuple containing a major and minor
+         * version numbers fields.
+         *
+         * The values of the major and minor fields are the minor
+         * and major version numbers of this class file.
+         * Together, a major and a minor version number determine the version of the
+         * class file format.
+         * If a class file has major version number M and minor version number m,
+         * we denote the version of its class file format as M.m.
+         * Thus, class file format versions may be ordered lexicographically,
+         * for example, 1.5 < 2.0 < 2.1.
+         *
+         * A Java Virtual Machine implementation can support a class file format of
+         * version v if and only if v lies in some contiguous range Mi.0 <= v <= Mj.m.
+         * The release level of the Java SE platform to which a Java Virtual Machine
+         * implementation conforms is responsible for determining the range.
+         */
+        class Version {
+        public:
+
+            /**
+             * Using default 51, which is supported by JDK 1.7.
              *
              * @param majorVersion
              * @param minorVersion
@@ -1152,6 +1742,62 @@ namespace jnif {
             KIND_FRAME
         };
 
+        class Inst;
+
+/**
+ * Set of instructions used to link definitions and uses.
+ * The underlying set is allocated on the first insertion, so that
+ * instructions not involved in def-use analysis only pay for a pointer.
+ * It lives in the arena of the class file, like the instructions.
+ */
+        class InstSet {
+            typedef set<Inst*, std::less<Inst*>, ArenaAllocator<Inst*> > Set;
+
+        public:
+
+            typedef Set::const_iterator const_iterator;
+
+            InstSet() : _set(nullptr) {
+            }
+
+            InstSet(const InstSet&) = delete;
+
+            InstSet& operator=(const InstSet&) = delete;
+
+            void insert(Inst* inst, Arena* arena) {
+                if (_set == nullptr) {
+                    _set = arena->create<Set>(std::less<Inst*>(), ArenaAllocator<Inst*>(arena));
+                }
+
+                _set->insert(inst);
+            }
+
+            bool empty() const {
+                return _set == nullptr || _set->empty();
+            }
+
+            size_t size() const {
+                return _set == nullptr ? 0 : _set->size();
+            }
+
+            const_iterator begin() const {
+                return _set == nullptr ? _empty().begin() : _set->begin();
+            }
+
+            const_iterator end() const {
+                return _set == nullptr ? _empty().end() : _set->end();
+            }
+
+        private:
+
+            static const Set& _empty() {
+                static const Set empty;
+                return empty;
+            }
+
+            Set* _set;
+        };
+
 /**
  * Represent a bytecode instruction.
  */
@@ -1281,7 +1927,7 @@ namespace jnif {
             /**
              * The opcode of this instruction.
              */
-            const Opcode opcode;
+            Opcode opcode;
 
             /**
              * The kind of this instruction.
@@ -1290,6 +1936,11 @@ namespace jnif {
 
             int _offset;
 
+            /**
+             * The slot of this instruction in the order buffer of its list.
+             */
+            u4 _pos;
+
             const ConstPool* const constPool;
             Inst* prev;
             Inst* next;
@@ -1418,20 +2069,25 @@ namespace jnif {
                 return cast<MultiArrayInst>(isMultiArray(), "multiarray");
             }
 
-            set<Inst*> consumes;
-            set<Inst*> produces;
+            /**
+             * Returns the arena of the class file of this instruction.
+             */
+            Arena* arena() const;
+
+            InstSet consumes;
+            InstSet produces;
             int id = 0;
 
         private:
 
             Inst() :
-                    opcode(Opcode::nop), kind(KIND_ZERO), _offset(0), constPool(nullptr), prev(nullptr), next(nullptr) {
+                    opcode(Opcode::nop), kind(KIND_ZERO), _offset(0), _pos(0), constPool(nullptr), prev(nullptr),
+                    next(nullptr) {
             }
 
             Inst(Opcode opcode, OpKind kind, const ConstPool* constPool, Inst* prev = nullptr, Inst* next = nullptr) :
-                    opcode(opcode), kind(kind), _offset(0), constPool(constPool), prev(prev), next(next) {
+                    opcode(opcode), kind(kind), _offset(0), _pos(0), constPool(constPool), prev(prev), next(next) {
             }
-
             template<typename TKind>
             TKind* cast(bool cond, const char* kindName) {
                 checkCast(cond, kindName);
@@ -1514,7 +2170,7 @@ namespace jnif {
                     Inst(opcode, KIND_LDC, constPool), valueIndex(valueIndex) {
             }
 
-            const ConstPool::Index valueIndex;
+            ConstPool::Index valueIndex;
         };
 
 /**
@@ -1615,7 +2271,7 @@ namespace jnif {
                     Inst(opcode, KIND_FIELD, constPool), fieldRefIndex(fieldRefIndex) {
             }
 
-            const ConstPool::Index fieldRefIndex;
+            ConstPool::Index fieldRefIndex;
 
         };
 
@@ -1631,7 +2287,7 @@ namespace jnif {
                     Inst(opcode, KIND_INVOKE, constPool), methodRefIndex(methodRefIndex) {
             }
 
-            const ConstPool::Index methodRefIndex;
+            ConstPool::Index methodRefIndex;
 
         };
 
@@ -1649,7 +2305,7 @@ namespace jnif {
                     interMethodRefIndex), count(count) {
             }
 
-            const u2 interMethodRefIndex;
+            u2 interMethodRefIndex;
             const u1 count;
 
         };
@@ -1673,6 +2329,10 @@ namespace jnif {
                 return _callSite;
             }
 
+            void setCallSite(ConstPool::Index callSite) {
+                _callSite = callSite;
+            }
+
         private:
 
             ConstPool::Index _callSite;
@@ -1755,7 +2415,11 @@ namespace jnif {
 
         public:
 
-            vector<Inst*> targets;
+            /**
+             * The targets of this switch, held in a side table of the
+             * arena rather than in the record of the instruction.
+             */
+            ArenaVector<Inst*>& targets;
 
             void addTarget(LabelInst* label) {
                 targets.push_back(label);
@@ -1764,8 +2428,8 @@ namespace jnif {
 
         private:
 
-            SwitchInst(Opcode opcode, OpKind kind, ConstPool* constPool) :
-                    Inst(opcode, kind, constPool) {
+            SwitchInst(Opcode opcode, OpKind kind, ConstPool* constPool, Arena* arena) :
+                    Inst(opcode, kind, constPool), targets(*arena->create<ArenaVector<Inst*> >(arena)) {
             }
 
         };
@@ -1778,8 +2442,9 @@ namespace jnif {
 
         public:
 
-            TableSwitchInst(LabelInst* def, int low, int high, ConstPool* constPool) :
-                    SwitchInst(Opcode::tableswitch, KIND_TABLESWITCH, constPool), def(def), low(low), high(high) {
+            TableSwitchInst(LabelInst* def, int low, int high, ConstPool* constPool, Arena* arena) :
+                    SwitchInst(Opcode::tableswitch, KIND_TABLESWITCH, constPool, arena), def(def), low(low),
+                    high(high) {
             }
 
             Inst* def;
@@ -1796,35 +2461,180 @@ namespace jnif {
 
         public:
 
-            LookupSwitchInst(LabelInst* def, u4 npairs, ConstPool* constPool) :
-                    SwitchInst(Opcode::lookupswitch, KIND_LOOKUPSWITCH, constPool), defbyte(def), npairs(npairs) {
+            LookupSwitchInst(LabelInst* def, u4 npairs, ConstPool* constPool, Arena* arena) :
+                    SwitchInst(Opcode::lookupswitch, KIND_LOOKUPSWITCH, constPool, arena), defbyte(def),
+                    npairs(npairs), keys(*arena->create<ArenaVector<u4> >(arena)) {
             }
 
 
             Inst* defbyte;
             u4 npairs;
-            vector<u4> keys;
+
+            /**
+             * The keys of this switch, held in the side table next to its
+             * targets.
+             */
+            ArenaVector<u4>& keys;
 
         };
 
         ostream& operator<<(ostream& os, const Inst& inst);
 
+/**
+ * Summary of the instructions of a method.
+ * Lets instrumentation passes skip methods, or whole classes,
+ * that cannot match, without walking or decoding their instructions.
+ */
+        class InstSummary {
+        public:
+
+            /**
+             * Returns true when an instruction with the given opcode is
+             * present.
+             */
+            bool has(Opcode opcode) const {
+                return (opcodes[(u1) opcode >> 6] >> ((u1) opcode & 63)) & 1;
+            }
+
+            /**
+             * Returns true when an instruction of the given kind is present.
+             */
+            bool has(OpKind kind) const {
+                return (kinds >> kind) & 1;
+            }
+
+            /**
+             * Accounts an instruction, labels are ignored.
+             */
+            void add(Opcode opcode, OpKind kind) {
+                if (kind == KIND_LABEL) {
+                    return;
+                }
+
+                opcodes[(u1) opcode >> 6] |= 1ull << ((u1) opcode & 63);
+                kinds |= 1u << kind;
+
+                switch (kind) {
+                    case KIND_INVOKE:
+                    case KIND_INVOKEINTERFACE:
+                    case KIND_INVOKEDYNAMIC:
+                        invokes++;
+                        break;
+                    case KIND_JUMP:
+                    case KIND_TABLESWITCH:
+                    case KIND_LOOKUPSWITCH:
+                        branches++;
+                        break;
+                    case KIND_NEWARRAY:
+                    case KIND_MULTIARRAY:
+                        allocations++;
+                        break;
+                    case KIND_TYPE:
+                        if (opcode == Opcode::NEW || opcode == Opcode::anewarray) {
+                            allocations++;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            /**
+             * Accounts the instructions of another summary, e.g., to
+             * summarize a whole class.
+             */
+            void add(const InstSummary& other) {
+                for (int i = 0; i < 4; i++) {
+                    opcodes[i] |= other.opcodes[i];
+                }
+
+                kinds |= other.kinds;
+                invokes += other.invokes;
+                branches += other.branches;
+                allocations += other.allocations;
+                hasHandlers = hasHandlers || other.hasHandlers;
+            }
+
+            /**
+             * Bitmap of the opcodes present.
+             */
+            u8 opcodes[4] = {};
+
+            /**
+             * Bitmap of the kinds present.
+             */
+            u4 kinds = 0;
+
+            /**
+             * Number of invoke instructions, including invokeinterface and
+             * invokedynamic.
+             */
+            u4 invokes = 0;
+
+            /**
+             * Number of jump and switch instructions.
+             */
+            u4 branches = 0;
+
+            /**
+             * Number of new, newarray, anewarray and multianewarray
+             * instructions.
+             */
+            u4 allocations = 0;
+
+            /**
+             * Whether the exception table is not empty.
+             */
+            bool hasHandlers = false;
+        };
+
+        class CompiledSnippet;
+
 /**
  * Represents the bytecode of a method.
+ *
+ * Instructions are stored as fixed-size records, RECORD_SIZE bytes each,
+ * in contiguous chunks of the arena that never move, so that an Inst* is
+ * a stable view of its record.
+ * Switches take two records, and their targets and keys are held in a
+ * side table.
+ *
+ * The order of the instructions is kept in a gap buffer of pointers to
+ * their records.
+ * An insertion moves the gap to its position, so consecutive insertions
+ * at the same place, e.g., with a pos argument, only fill the gap.
+ * Iteration scans the buffer, and the prev and next links of each
+ * instruction are kept for code that walks them.
  */
         class InstList {
             friend class CodeAttr;
 
         public:
 
+            /**
+             * The size in bytes of an instruction record.
+             */
+            static constexpr size_t RECORD_SIZE = 72;
+
+            /**
+             * Position in the order buffer.
+             * It stays valid when instructions are inserted, as the slot of
+             * its instruction is looked up again when the buffer changed.
+             */
             class Iterator {
                 friend class InstList;
 
             public:
 
-                Inst* operator*();
+                Inst* operator*() {
+                    JnifError::assert(position != nullptr, "Dereferencing * on NULL");
+                    return position;
+                }
 
-                Inst* operator->() const;
+                Inst* operator->() const {
+                    JnifError::assert(position != nullptr, "Dereferencing -> on NULL");
+                    return position;
+                }
 
                 bool friend operator==(const Iterator& lhs, const Iterator& rhs) {
                     return lhs.position == rhs.position;
@@ -1834,18 +2644,49 @@ namespace jnif {
                     return lhs.position != rhs.position;
                 }
 
-                Iterator& operator++();
+                Iterator& operator++() {
+                    JnifError::assert(position != nullptr, "Doing ++ at NULL");
+                    _seek(_slot() + 1, true);
+
+                    return *this;
+                }
+
+                Iterator& operator--() {
+                    u4 slot = position == nullptr ? list->_capacity : _slot();
+                    JnifError::assert(slot > 0, "Doing -- at NULL after last");
+                    _seek(slot - 1, false);
+
+                    JnifError::assert(position != nullptr, "Doing -- at NULL after last");
 
-                Iterator& operator--();
+                    return *this;
+                }
 
             private:
 
-                Iterator(Inst* position, Inst* last) :
-                        position(position), last(last) {
+                Iterator(const InstList* list, u4 slot) : list(list) {
+                    _seek(slot, true);
+                }
+
+                u4 _slot() const {
+                    return slot < list->_capacity && list->_order[slot] == position ? slot : position->_pos;
+                }
+
+                /**
+                 * Moves to the given slot, skipping the gap forward or
+                 * backward.
+                 */
+                void _seek(u4 to, bool forward) {
+                    if (to >= list->_gapStart && to < list->_gapEnd) {
+                        to = forward ? list->_gapEnd : list->_gapStart - 1;
+                    }
+
+                    slot = to;
+                    position = to < list->_capacity ? list->_order[to] : nullptr;
                 }
 
+                const InstList* list;
                 Inst* position;
-                Inst* last;
+                u4 slot;
             };
 
             LabelInst* createLabel();
@@ -1891,6 +2732,19 @@ namespace jnif {
 
             LookupSwitchInst* addLookupSwitch(LabelInst* def, u4 npairs, Inst* pos = nullptr);
 
+            /**
+             * Inserts a copy of the instructions of a compiled snippet before
+             * pos, or at the end when pos is nullptr.
+             * The copy is linked as a whole chain,
+             * and args are the constant pool indices bound to the
+             * parameters of the snippet, in order.
+             *
+             * @returns the first instruction inserted,
+             * or nullptr if the snippet is empty.
+             */
+            Inst* addSnippet(const CompiledSnippet& snippet, Inst* pos = nullptr,
+                             std::initializer_list<ConstPool::Index> args = {});
+
             bool hasBranches() const {
                 return branchesCount > 0;
             }
@@ -1899,36 +2753,120 @@ namespace jnif {
                 return jsrOrRet;
             }
 
+            /**
+             * Returns the summary of the instructions added to this list.
+             * It does not account the exception table.
+             */
+            const InstSummary& summary() const {
+                return _summary;
+            }
+
+            /**
+             * Changes the opcode of an instruction of this list to another
+             * one of the same kind, accounting it in the summary.
+             */
+            void setOpcode(Inst* inst, Opcode opcode) {
+                inst->opcode = opcode;
+                _summary.add(opcode, inst->kind);
+            }
+
             int size() const {
                 return _size;
             }
 
             Iterator begin() const {
-                return Iterator(first, last);
+                return Iterator(this, 0);
             }
 
             Iterator end() const {
-                return Iterator(nullptr, last);
+                return Iterator(this, _capacity);
             }
 
+            /**
+             * Returns the instruction at the given bytecode offset,
+             * or nullptr if no instruction starts there.
+             * Offsets are the ones assigned by the last parse or write.
+             * The offset index is built on the first call,
+             * and it is dropped when an instruction is added or
+             * the offsets are reassigned.
+             */
             Inst* getInst(int offset);
 
-            ClassFile* const constPool;
+            /**
+             * Returns the bytecode offset of the given instruction,
+             * as assigned by the last parse or write.
+             */
+            int getOffset(const Inst* inst) const {
+                return inst->_offset;
+            }
 
-        private:
+            /**
+             * Drops the offset index used by getInst.
+             * It must be called when the offsets of the instructions are
+             * changed outside of the parser and the writer.
+             */
+            void invalidateOffsets() {
+                _offsetIndex.clear();
+            }
+
+            /**
+             * Returns true when instructions were added to this list since
+             * the last call to setModified(false).
+             * Instructions changed in place are not tracked,
+             * in that case setModified must be called.
+             */
+            bool isModified() const {
+                return modified;
+            }
 
-            InstList(ClassFile* arena) :
-                    constPool(arena), first(nullptr), last(nullptr), _size(0), nextLabelId(1), branchesCount(0),
-                    jsrOrRet(false) {
+            void setModified(bool modified = true) {
+                this->modified = modified;
             }
 
-            ~InstList();
+            ClassFile* const constPool;
+
+        private:
+
+            explicit InstList(ClassFile* arena);
 
             void addInst(Inst* inst, Inst* pos);
 
+            /**
+             * Returns the index in program order of an instruction of this
+             * list.
+             */
+            u4 _indexOf(const Inst* inst) const;
+
+            /**
+             * Inserts inst in the order buffer at the given index in
+             * program order.
+             */
+            void _insertAt(u4 index, Inst* inst);
+
+            void _moveGap(u4 index);
+
+            void _grow();
+
             Inst* first;
             Inst* last;
 
+            /**
+             * The order buffer, with _capacity slots and the gap in
+             * [_gapStart, _gapEnd).
+             */
+            Inst** _order = nullptr;
+            u4 _capacity = 0;
+            u4 _gapStart = 0;
+            u4 _gapEnd = 0;
+
+            /**
+             * The current chunk of records, and the number of records used
+             * and available in it.
+             */
+            u1* _records = nullptr;
+            u4 _recordCount = 0;
+            u4 _recordCapacity = 0;
+
             int _size;
 
             int nextLabelId;
@@ -1937,6 +2875,17 @@ namespace jnif {
 
             bool jsrOrRet;
 
+            bool modified;
+
+            /**
+             * Instruction starting at each offset, or empty when not built.
+             */
+            ArenaVector<Inst*> _offsetIndex;
+
+            InstSummary _summary;
+
+            void _buildOffsetIndex();
+
             template<typename TInst, typename ... TArgs>
             TInst* _create(const TArgs& ... args);
 
@@ -1944,6 +2893,173 @@ namespace jnif {
 
         ostream& operator<<(ostream& os, const InstList& instList);
 
+/**
+ * A sequence of instructions defined once and inserted at many places,
+ * e.g., the probe of an instrumentation pass.
+ * Constants are symbolic, i.e., they are given by name and resolved
+ * only when the snippet is compiled for a class file.
+ * Labels are local to the snippet,
+ * and each insertion gets its own copy of them.
+ *
+ * A snippet is independent of any class file,
+ * so it can be built once and compiled for every class instrumented.
+ */
+        class Snippet {
+        public:
+
+            /**
+             * Symbolic constant pool entry of a snippet.
+             */
+            typedef u2 Symbol;
+
+            Symbol putString(const string& value);
+
+            Symbol putClass(const string& className);
+
+            Symbol putFieldRef(const string& className, const string& name, const string& desc);
+
+            Symbol putMethodRef(const string& className, const string& name, const string& desc);
+
+            Symbol putInterMethodRef(const string& className, const string& name, const string& desc);
+
+            /**
+             * Returns a constant pool entry not known in advance,
+             * given at each insertion of the snippet.
+             */
+            Symbol param();
+
+            /**
+             * Returns a new label local to this snippet,
+             * to be placed with addLabel.
+             */
+            int createLabel() {
+                return _labelCount++;
+            }
+
+            void addLabel(int label);
+
+            void addZero(Opcode opcode);
+
+            void addBiPush(u1 value);
+
+            void addSiPush(u2 value);
+
+            void addLdc(Opcode opcode, Symbol value);
+
+            void addVar(Opcode opcode, u1 lvindex);
+
+            void addIinc(u1 index, u1 value);
+
+            void addJump(Opcode opcode, int label);
+
+            void addField(Opcode opcode, Symbol fieldRef);
+
+            void addInvoke(Opcode opcode, Symbol methodRef);
+
+            void addInvokeInterface(Symbol interMethodRef, u1 count);
+
+            void addType(Opcode opcode, Symbol classRef);
+
+            void addNewArray(u1 atype);
+
+            /**
+             * Resolves the constants of this snippet in the given class file,
+             * adding them to its constant pool when needed.
+             * Throws JnifError when a label is placed more than once,
+             * or a jump targets a label that is not placed.
+             */
+            CompiledSnippet compile(ClassFile& cf) const;
+
+            int size() const {
+                return _insts.size();
+            }
+
+        private:
+
+            friend class CompiledSnippet;
+
+            struct Constant {
+                ConstPool::Tag tag;
+                string className;
+                string name;
+                string desc;
+            };
+
+            struct SnippetInst {
+                Opcode opcode;
+                OpKind kind;
+                u2 operand;
+                u2 operand2;
+            };
+
+            Symbol _put(ConstPool::Tag tag, const string& className,
+                        const string& name = "", const string& desc = "");
+
+            void _add(Opcode opcode, OpKind kind, u2 operand = 0, u2 operand2 = 0);
+
+            void _addRef(Opcode opcode, OpKind kind, Symbol symbol,
+                         ConstPool::Tag tag, u2 operand2 = 0);
+
+            vector<Constant> _constants;
+
+            vector<SnippetInst> _insts;
+
+            int _labelCount = 0;
+
+            int _paramCount = 0;
+        };
+
+/**
+ * A snippet whose constants are resolved for a given class file.
+ * It is inserted into the methods of that class file with
+ * InstList::addSnippet.
+ */
+        class CompiledSnippet {
+            friend class Snippet;
+            friend class InstList;
+
+        public:
+
+            int size() const {
+                return _insts.size();
+            }
+
+            /**
+             * Returns the number of constant pool indices to give to
+             * each insertion.
+             */
+            int paramCount() const {
+                return _paramCount;
+            }
+
+        private:
+
+            /**
+             * A snippet instruction with its operand resolved.
+             * When param is not negative, the operand is the argument at
+             * that position given to the insertion.
+             */
+            struct ResolvedInst {
+                Opcode opcode;
+                OpKind kind;
+                u2 operand;
+                u2 operand2;
+                int param;
+            };
+
+            vector<ResolvedInst> _insts;
+
+            int _labelCount = 0;
+
+            int _paramCount = 0;
+
+            int _branches = 0;
+
+            bool _jsrOrRet = false;
+
+            InstSummary _summary;
+        };
+
         enum TypeTag {
             TYPE_TOP = 0,
             TYPE_INTEGER = 1,
@@ -1964,6 +3080,17 @@ namespace jnif {
 
 /**
  * Verification type class
+ *
+ * The tag, dimensions and class of a type are packed into a single
+ * 64-bit word, with the class given by its ClassNames symbol.
+ * Types are compared by this word only, and are copied without
+ * allocation.
+ *
+ * The uninit site and typeId are kept outside of the word. They are
+ * not part of the identity of a type: two types that differ only in
+ * them compare equal, as the frame analysis expects when joining.
+ * The uninit site also needs two pointers, which do not fit next to
+ * the tag, dimensions and symbol.
  */
         class Type {
             friend class TypeFactory;
@@ -1971,17 +3098,19 @@ namespace jnif {
         public:
 
             bool operator==(const Type& other) const {
-                return tag == other.tag
-                       && (tag != TYPE_OBJECT || className == other.className)
-                       && dims == other.dims;
+                return _bits == other._bits;
             }
 
             friend bool operator!=(const Type& lhs, const Type& rhs) {
                 return !(lhs == rhs);
             }
 
+            TypeTag getTag() const {
+                return (TypeTag) (_bits & 0xff);
+            }
+
             bool isTop() const {
-                return tag == TYPE_TOP && !isArray();
+                return getTag() == TYPE_TOP && !isArray();
             }
 
             /**
@@ -1989,7 +3118,7 @@ namespace jnif {
              * False otherwise.
              */
             bool isInt() const {
-                return tag == TYPE_INTEGER && !isArray();
+                return getTag() == TYPE_INTEGER && !isArray();
             }
 
             /**
@@ -1998,7 +3127,7 @@ namespace jnif {
              * False otherwise.
              */
             bool isIntegral() const {
-                switch (tag) {
+                switch (getTag()) {
                     case TYPE_INTEGER:
                     case TYPE_BOOLEAN:
                     case TYPE_BYTE:
@@ -2011,39 +3140,39 @@ namespace jnif {
             }
 
             bool isFloat() const {
-                return tag == TYPE_FLOAT && !isArray();
+                return getTag() == TYPE_FLOAT && !isArray();
             }
 
             bool isLong() const {
-                return tag == TYPE_LONG && !isArray();
+                return getTag() == TYPE_LONG && !isArray();
             }
 
             bool isDouble() const {
-                return tag == TYPE_DOUBLE && !isArray();
+                return getTag() == TYPE_DOUBLE && !isArray();
             }
 
             bool isNull() const {
-                return tag == TYPE_NULL;
+                return getTag() == TYPE_NULL;
             }
 
             bool isUninitThis() const {
-                return tag == TYPE_UNINITTHIS;
+                return getTag() == TYPE_UNINITTHIS;
             }
 
             bool isUninit() const {
-                return tag == TYPE_UNINIT;
+                return getTag() == TYPE_UNINIT;
             }
 
             bool isObject() const {
-                return tag == TYPE_OBJECT || isArray();
+                return getTag() == TYPE_OBJECT || isArray();
             }
 
             bool isArray() const {
-                return dims > 0;
+                return getDims() > 0;
             }
 
             bool isVoid() const {
-                return tag == TYPE_VOID;
+                return getTag() == TYPE_VOID;
             }
 
             bool isOneWord() const {
@@ -2065,6 +3194,15 @@ namespace jnif {
 
             string getClassName() const;
 
+            /**
+             * Returns the class of this type, without dimensions, or NONE
+             * when its base type is not a class.
+             * An uninitialized this has the class of the method.
+             */
+            ClassNames::Symbol getClassSymbol() const {
+                return _bits >> 32;
+            }
+
             u2 getCpIndex() const;
 
             void setCpIndex(u2 index) {
@@ -2073,7 +3211,17 @@ namespace jnif {
             }
 
             u4 getDims() const {
-                return dims;
+                return (_bits >> 8) & 0xff;
+            }
+
+            /**
+             * Marks this type as initialized, i.e., its constructor was
+             * called.
+             * An uninitialized this becomes an object of its class.
+             */
+            void setInit() {
+                init = true;
+                _bits = _pack(TYPE_OBJECT, getDims(), getClassSymbol());
             }
 
             /**
@@ -2114,43 +3262,38 @@ namespace jnif {
 
             static long nextTypeId;
 
-            TypeTag tag;
-            u4 dims;
             u2 classIndex;
-            string className;
 
         private:
 
+            static u8 _pack(TypeTag tag, u4 dims, ClassNames::Symbol symbol) {
+                return (u8) tag | ((u8) dims << 8) | ((u8) symbol << 32);
+            }
+
             Type(TypeTag tag) :
-                    init(true), typeId(0), tag(tag), dims(0), classIndex(0) {
+                    init(true), typeId(0), classIndex(0), _bits(_pack(tag, 0, ClassNames::NONE)) {
             }
 
             Type(TypeTag tag, short offset, Inst* label) :
-                    init(true), typeId(0), tag(tag), dims(0), classIndex(0) {
+                    init(true), typeId(0), classIndex(0), _bits(_pack(tag, 0, ClassNames::NONE)) {
                 uninit.offset = offset;
                 uninit.label = label;
             }
 
-            Type(TypeTag tag, const string& className, u2 classIndex = 0) :
-                    init(true), typeId(0), tag(tag), dims(0), classIndex(classIndex), className(
-                    className) {
+            Type(TypeTag tag, ClassNames::Symbol symbol, u2 classIndex = 0) :
+                    init(true), typeId(0), classIndex(classIndex), _bits(_pack(tag, 0, symbol)) {
             }
 
-            Type(const Type& other, u4 dims) {
-                this->dims = dims;
-
-                // Type(other)
-                uninit.offset = other.uninit.offset;
-                uninit.label = other.uninit.label;
-                uninit.newinst = other.uninit.newinst;
-
-                init = other.init;
-                typeId = other.typeId;
-                tag = other.tag;
-                classIndex = other.classIndex;
-                className = other.className;
+            Type(const Type& other, u4 dims) : Type(other) {
+                _bits = _pack(other.getTag(), dims, other.getClassSymbol());
             }
 
+            /**
+             * Tag in bits 0-7, dimensions in bits 8-15 and class symbol in
+             * bits 32-63.
+             */
+            u8 _bits;
+
         };
 
         ostream& operator<<(ostream& os, const Type& type);
@@ -2207,10 +3350,18 @@ namespace jnif {
 
             static Type uninitThisType();
 
+            /**
+             * Returns the uninitialized this of a constructor of the given
+             * class.
+             */
+            static Type uninitThisType(ClassNames::Symbol className);
+
             static Type uninitType(short offset, class Inst* label);
 
             static Type objectType(const string& className, u2 cpindex = 0);
 
+            static Type objectType(ClassNames::Symbol className, u2 cpindex = 0);
+
             static Type arrayType(const Type& baseType, u4 dims);
 
             /**
@@ -2221,6 +3372,12 @@ namespace jnif {
              */
             static Type fromConstClass(const string& className);
 
+            /**
+             * Returns the type of the class entry at classIndex, without
+             * copying its class name.
+             */
+            static Type fromConstClass(const ConstPool& cp, ConstPool::Index classIndex);
+
             /**
              * Parses a field descriptor.
              *
@@ -2296,6 +3453,12 @@ namespace jnif {
             virtual ~Attr() {
             }
 
+            /**
+             * Returns the arena of the class file of this attribute, or
+             * nullptr if this attribute does not belong to a class file.
+             */
+            Arena* arena() const;
+
         protected:
 
             Attr(AttrKind kind, u2 nameIndex, u4 len, ClassFile* constPool) :
@@ -2317,42 +3480,92 @@ namespace jnif {
 
             Attrs& operator=(const Attrs&) = delete;
 
-            Attrs() {
+            /**
+             * Creates an empty collection, allocated in the given arena,
+             * or in the heap when arena is nullptr.
+             */
+            explicit Attrs(Arena* arena = nullptr) : attrs(ArenaAllocator<Attr*>(arena)) {
             }
 
-            virtual ~Attrs();
-
             Attr* add(Attr* attr) {
                 attrs.push_back(attr);
+                modified = true;
+
+                if (_byKind[attr->kind] == nullptr) {
+                    _byKind[attr->kind] = attr;
+                }
 
                 return attr;
             }
 
+            /**
+             * Removes the attribute at the given position.
+             */
+            void remove(ArenaVector<Attr*>::const_iterator it) {
+                attrs.erase(it);
+                modified = true;
+
+                _buildKindIndex();
+            }
+
+            /**
+             * Returns the first attribute of the given kind,
+             * or nullptr if there is none.
+             * Attributes are indexed by kind, so that looking up well-known
+             * attributes, e.g., Code or StackMapTable, does not scan
+             * this collection.
+             * The index follows add and remove, the only ways to change
+             * this collection, but not the kind of an attribute changed
+             * in place.
+             */
+            Attr* get(AttrKind kind) const {
+                return _byKind[kind];
+            }
+
+            /**
+             * Returns true when attributes were added to this collection
+             * since the last call to setModified(false).
+             */
+            bool isModified() const {
+                return modified;
+            }
+
+            void setModified(bool modified = true) {
+                this->modified = modified;
+            }
+
             u2 size() const {
                 return attrs.size();
             }
 
+            void reserve(size_t count) {
+                attrs.reserve(count);
+            }
+
             const Attr& operator[](u2 index) const {
                 return *attrs[index];
             }
 
-            vector<Attr*>::iterator begin() {
+            ArenaVector<Attr*>::const_iterator begin() const {
                 return attrs.begin();
             }
 
-            vector<Attr*>::iterator end() {
+            ArenaVector<Attr*>::const_iterator end() const {
                 return attrs.end();
             }
 
-            vector<Attr*>::const_iterator begin() const {
-                return attrs.begin();
-            }
+        private:
 
-            vector<Attr*>::const_iterator end() const {
-                return attrs.end();
-            }
+            ArenaVector<Attr*> attrs;
+
+            void _buildKindIndex();
+
+            bool modified = true;
 
-            vector<Attr*> attrs;
+            /**
+             * The first attribute of each kind.
+             */
+            Attr* _byKind[ATTR_SMT + 1] = {};
         };
 
 /**
@@ -2361,7 +3574,7 @@ namespace jnif {
         class UnknownAttr : public Attr {
         public:
 
-            const u1* const data;
+            const u1* data;
 
             UnknownAttr(u2 nameIndex, u4 len, const u1* data, ClassFile* constPool) :
                     Attr(ATTR_UNKNOWN, nameIndex, len, constPool), data(data) {
@@ -2387,10 +3600,10 @@ namespace jnif {
                 u2 index;
             };
 
-            vector<LvEntry> lvt;
+            ArenaVector<LvEntry> lvt;
 
             LvtAttr(AttrKind kind, u2 nameIndex, ClassFile* constPool) :
-                    Attr(kind, nameIndex, 0, constPool) {
+                    Attr(kind, nameIndex, 0, constPool), lvt(arena()) {
             }
         };
 
@@ -2401,7 +3614,7 @@ namespace jnif {
         public:
 
             LntAttr(u2 nameIndex, ClassFile* constPool) :
-                    Attr(ATTR_LNT, nameIndex, 0, constPool) {
+                    Attr(ATTR_LNT, nameIndex, 0, constPool), lnt(arena()) {
             }
 
             struct LnEntry {
@@ -2411,7 +3624,7 @@ namespace jnif {
                 u2 lineno;
             };
 
-            vector<LnEntry> lnt;
+            ArenaVector<LnEntry> lnt;
 
         };
 
@@ -2422,23 +3635,40 @@ namespace jnif {
         public:
 
             SmtAttr(u2 nameIndex, ClassFile* constPool) :
-                    Attr(ATTR_SMT, nameIndex, 0, constPool) {
+                    Attr(ATTR_SMT, nameIndex, 0, constPool), entries(arena()) {
             }
 
             class Entry {
             public:
 
+                /**
+                 * Creates an entry whose types are allocated in the given arena.
+                 */
+                explicit Entry(Arena* arena) :
+                        sameLocals_1_stack_item_frame{ArenaVector<Type>(arena)},
+                        same_locals_1_stack_item_frame_extended{0, ArenaVector<Type>(arena)},
+                        append_frame{0, ArenaVector<Type>(arena)},
+                        full_frame{0, ArenaVector<Type>(arena), ArenaVector<Type>(arena)} {
+                }
+
+                /**
+                 * Copies other, allocating its types in the given arena.
+                 */
+                Entry(const Entry& other, Arena* arena) : Entry(arena) {
+                    *this = other;
+                }
+
                 int frameType;
                 Inst* label;
 
                 struct {
                 } sameFrame;
                 struct {
-                    vector<Type> stack; // [1]
+                    ArenaVector<Type> stack; // [1]
                 } sameLocals_1_stack_item_frame;
                 struct {
                     short offset_delta;
-                    vector<Type> stack; // [1]
+                    ArenaVector<Type> stack; // [1]
                 } same_locals_1_stack_item_frame_extended;
                 struct {
                     short offset_delta;
@@ -2448,16 +3678,16 @@ namespace jnif {
                 } same_frame_extended;
                 struct {
                     short offset_delta;
-                    vector<Type> locals; // frameType - 251
+                    ArenaVector<Type> locals; // frameType - 251
                 } append_frame;
                 struct {
                     short offset_delta;
-                    vector<Type> locals;
-                    vector<Type> stack;
+                    ArenaVector<Type> locals;
+                    ArenaVector<Type> stack;
                 } full_frame;
             };
 
-            vector<Entry> entries;
+            ArenaVector<Entry> entries;
         };
 
 /**
@@ -2468,11 +3698,11 @@ namespace jnif {
 
             ExceptionsAttr(u2 nameIndex, ClassFile* constPool,
                            const vector<u2>& es) :
-                    Attr(ATTR_EXCEPTIONS, nameIndex, es.size() * 2 + 2, constPool), es(
-                    es) {
+                    Attr(ATTR_EXCEPTIONS, nameIndex, es.size() * 2 + 2, constPool),
+                    es(es.begin(), es.end(), arena()) {
             }
 
-            vector<ConstPool::Index> es;
+            ArenaVector<ConstPool::Index> es;
         };
 
 
@@ -2484,11 +3714,9 @@ namespace jnif {
 
             CodeAttr(u2 nameIndex, ClassFile* constPool) :
                     Attr(ATTR_CODE, nameIndex, 0, constPool), maxStack(0), maxLocals(0), codeLen(
-                    -1), instList(constPool), cfg(nullptr) {
+                    -1), instList(constPool), exceptions(arena()), cfg(nullptr), attrs(arena()) {
             }
 
-            ~CodeAttr();
-
             /**
              * Gives the maximum depth of the operand stack of this
              * method at any point during execution of the method.
@@ -2507,20 +3735,115 @@ namespace jnif {
                 const LabelInst* const startpc;
                 const LabelInst* const endpc;
                 const LabelInst* const handlerpc;
-                const ConstPool::Index catchtype;
+                ConstPool::Index catchtype;
             };
 
-            vector<ExceptionHandler> exceptions;
+            ArenaVector<ExceptionHandler> exceptions;
 
+            /**
+             * The control flow graph of the last frame computation,
+             * owned by the arena of the class file.
+             */
             class ControlFlowGraph* cfg;
 
             Attrs attrs;
+
+            /**
+             * Returns true when the instructions, exception table and
+             * attributes of this Code attribute are available.
+             * Code attributes parsed lazily are not decoded until
+             * decode is called.
+             */
+            bool isDecoded() const {
+                return _decoder == nullptr || _decoded;
+            }
+
+            /**
+             * Decodes the raw bytes of this Code attribute into instList,
+             * exceptions and attrs.
+             * Does nothing if this Code attribute was already decoded.
+             */
+            void decode() {
+                if (!isDecoded()) {
+                    _decoded = true;
+                    instList._summary = InstSummary();
+                    _decoder(this);
+                    setModified(false);
+                }
+            }
+
+            /**
+             * Returns the summary of the instructions and exception table of
+             * this Code attribute.
+             * When parsed lazily, the summary is computed from the raw bytes
+             * without decoding this attribute.
+             */
+            const InstSummary& summary() {
+                if (!isDecoded()) {
+                    if (!_summarized) {
+                        _summarize();
+                        _summarized = true;
+                    }
+                } else {
+                    instList._summary.hasHandlers = !exceptions.empty();
+                }
+
+                return instList._summary;
+            }
+
+            /**
+             * Returns true when this Code attribute cannot be written back
+             * from its original bytes, i.e., it was not parsed lazily
+             * or its instructions or attributes were changed after decoding.
+             * Changes made in place to the exception table, maxStack or
+             * maxLocals are not tracked, in that case setModified must be
+             * called.
+             */
+            bool isModified() const {
+                return _data == nullptr
+                       || (isDecoded() && (instList.isModified() || attrs.isModified()));
+            }
+
+            void setModified(bool modified = true) {
+                instList.setModified(modified);
+                attrs.setModified(modified);
+            }
+
+            /**
+             * When parsed lazily, points to the raw bytes of this Code attribute
+             * in the parsed buffer, starting at the bytecode.
+             * It spans the code, the exception table and the code attributes.
+             */
+            const u1* _data = nullptr;
+
+            /**
+             * The length in bytes of _data.
+             */
+            u4 _dataLen = 0;
+
+            /**
+             * The function that decodes _data, set by the parser.
+             * It is kept after decoding, so that a clone of an unmodified
+             * Code attribute can decode the same bytes.
+             */
+            void (* _decoder)(CodeAttr*) = nullptr;
+
+            bool _decoded = false;
+
+        private:
+
+            /**
+             * Computes the summary of the instructions from _data.
+             */
+            void _summarize();
+
+            bool _summarized = false;
         };
 
         class SignatureAttr : public Attr {
         public:
 
-            const ConstPool::Index signatureIndex;
+            ConstPool::Index signatureIndex;
 
             SignatureAttr(ConstPool::Index nameIndex, ConstPool::Index signatureIndex, ClassFile* constPool) :
                     Attr(ATTR_SIGNATURE, nameIndex, 2, constPool), signatureIndex(signatureIndex) {
@@ -2533,7 +3856,7 @@ namespace jnif {
         class SourceFileAttr : public Attr {
         public:
 
-            const ConstPool::Index sourceFileIndex;
+            ConstPool::Index sourceFileIndex;
 
             SourceFileAttr(ConstPool::Index nameIndex, ConstPool::Index sourceFileIndex,
                            ClassFile* constPool) :
@@ -2551,23 +3874,12 @@ namespace jnif {
             }
 
             bool hasSignature() const {
-                for (Attr* attr : *attrs) {
-                    if (attr->kind == ATTR_SIGNATURE) {
-                        return true;
-                    }
-                }
-
-                return false;
+                return attrs->get(ATTR_SIGNATURE) != nullptr;
             }
 
             const char* signature() const {
-                for (Attr* attr : *attrs) {
-                    if (attr->kind == ATTR_SIGNATURE) {
-                        return ((SignatureAttr*) attr)->signature();
-                    }
-                }
-
-                return nullptr;
+                Attr* attr = attrs->get(ATTR_SIGNATURE);
+                return attr == nullptr ? nullptr : ((SignatureAttr*) attr)->signature();
             }
 
         private:
@@ -2596,8 +3908,8 @@ namespace jnif {
             friend class Method;
 
             const u2 accessFlags;
-            const ConstPool::Index nameIndex;
-            const ConstPool::Index descIndex;
+            ConstPool::Index nameIndex;
+            ConstPool::Index descIndex;
             const ConstPool& constPool;
             Attrs attrs;
             Signature sig;
@@ -2606,9 +3918,18 @@ namespace jnif {
 
             const char* getDesc() const;
 
+            /**
+             * Returns true when attributes were added to this member since
+             * the last call to setModified(false).
+             */
+            bool isModified() const {
+                return attrs.isModified();
+            }
+
         private:
 
-            Member(u2 accessFlags, ConstPool::Index nameIndex, ConstPool::Index descIndex, const ConstPool& constPool);
+            Member(u2 accessFlags, ConstPool::Index nameIndex, ConstPool::Index descIndex, const ConstPool& constPool,
+                   Arena* arena);
 
         };
 
@@ -2654,9 +3975,13 @@ namespace jnif {
                         ENUM = 0x4000
             };
 
+            /**
+             * The attributes of this field are allocated in arena,
+             * or in the heap when arena is nullptr.
+             */
             Field(u2 accessFlags, ConstPool::Index nameIndex, ConstPool::Index descIndex,
-                  const ConstPool& constPool) :
-                    Member(accessFlags, nameIndex, descIndex, constPool) {
+                  const ConstPool& constPool, Arena* arena = nullptr) :
+                    Member(accessFlags, nameIndex, descIndex, constPool, arena) {
             }
 
         };
@@ -2714,33 +4039,54 @@ namespace jnif {
 
             };
 
+            /**
+             * The attributes of this method are allocated in arena,
+             * or in the heap when arena is nullptr.
+             */
             Method(u2 accessFlags, ConstPool::Index nameIndex, ConstPool::Index descIndex,
-                   const ConstPool& constPool) :
-                    Member(accessFlags, nameIndex, descIndex, constPool) {
+                   const ConstPool& constPool, Arena* arena = nullptr) :
+                    Member(accessFlags, nameIndex, descIndex, constPool, arena) {
             }
 
             bool hasCode() const {
-                for (Attr* attr : attrs) {
-                    if (attr->kind == ATTR_CODE) {
-                        return true;
-                    }
-                }
-
-                return false;
+                return attrs.get(ATTR_CODE) != nullptr;
             }
 
+            /**
+             * Returns the Code attribute of this method, or nullptr if this
+             * method has no code.
+             * The Code attribute is decoded if it was parsed lazily.
+             */
             CodeAttr* codeAttr() const {
-                for (Attr* attr : attrs) {
-                    if (attr->kind == ATTR_CODE) {
-                        return (CodeAttr*) attr;
-                    }
+                CodeAttr* code = (CodeAttr*) attrs.get(ATTR_CODE);
+                if (code != nullptr) {
+                    code->decode();
                 }
 
-                return nullptr;
+                return code;
             }
 
             InstList& instList();
 
+            /**
+             * Returns the summary of the instructions of this method,
+             * or nullptr if this method has no code.
+             * It does not decode the Code attribute.
+             */
+            const InstSummary* summary() const {
+                CodeAttr* code = (CodeAttr*) attrs.get(ATTR_CODE);
+                return code == nullptr ? nullptr : &code->summary();
+            }
+
+            /**
+             * Returns true when the attributes or the code of this method
+             * were changed since the last call to setModified(false).
+             * It does not decode the Code attribute.
+             */
+            bool isModified() const;
+
+            void setModified(bool modified);
+
             bool isPublic() const {
                 return accessFlags & PUBLIC;
             }
@@ -2825,6 +4171,13 @@ namespace jnif {
              */
             ClassFile();
 
+            /**
+             * The constructed ClassFile takes its arena blocks from pool
+             * and has no class name neither super class name.
+             * The pool must outlive this class file.
+             */
+            explicit ClassFile(ArenaPool* pool);
+
             /**
              * Constructs a default class file given the class name, the super class
              * name and the access flags.
@@ -2836,6 +4189,32 @@ namespace jnif {
             explicit ClassFile(const char* className, const char* superClassName = OBJECT, u2 accessFlags = PUBLIC,
                                Version version = Version());
 
+            /**
+             * Constructs a deep copy of source, e.g., to instrument several
+             * variants of a class or to keep a pristine copy as a fallback,
+             * without parsing it again.
+             *
+             * Code attributes not decoded or not modified in source share its
+             * raw bytes and are decoded on first access to them in the copy.
+             * Thus, the buffer parsed into source must outlive the copy,
+             * but source itself does not need to.
+             *
+             * The copy takes its arena blocks from pool, if not nullptr.
+             * Control flow graphs computed for source are not copied.
+             */
+            ClassFile(const ClassFile& source, ArenaPool* pool);
+
+            /**
+             * Constructs a class file from an image written by writeImage,
+             * without parsing any class file.
+             *
+             * The utf8 entries and the data of unknown attributes are used
+             * from the image, which must be 8-byte aligned and outlive this
+             * class file, e.g., mapped from a ClassCache.
+             * Throws JnifError when the image is not valid.
+             */
+            ClassFile(const u1* image, u4 imageLen, ArenaPool* pool);
+
             /**
              * Gets the class name of this class file.
              *
@@ -2920,7 +4299,41 @@ namespace jnif {
                 return addMethod(nameIndex, descIndex, accessFlags);
             }
 
-            list<Method>::iterator getMethod(const char* methodName);
+            ArenaList<Method>::iterator getMethod(const char* methodName);
+
+            /**
+             * Returns the field with the given name and descriptor,
+             * or nullptr if there is none.
+             * Fields are found through a hash table on their name and
+             * descriptor, built on the first lookup.
+             * The table follows addField, but not the name or descriptor
+             * of a field changed in place.
+             */
+            Field* findField(const char* fieldName, const char* fieldDesc);
+
+            Field* findField(ConstPool::Index nameIndex, ConstPool::Index descIndex) {
+                return findField(getUtf8(nameIndex), getUtf8(descIndex));
+            }
+
+            /**
+             * Returns the method with the given name and descriptor,
+             * or nullptr if there is none.
+             * Methods are found through a hash table on their name and
+             * descriptor, built on the first lookup.
+             * The table follows addMethod, but not the name or descriptor
+             * of a method changed in place.
+             */
+            Method* findMethod(const char* methodName, const char* methodDesc);
+
+            Method* findMethod(ConstPool::Index nameIndex, ConstPool::Index descIndex) {
+                return findMethod(getUtf8(nameIndex), getUtf8(descIndex));
+            }
+
+            /**
+             * Returns the summary of the instructions of all methods of
+             * this class file, without decoding them.
+             */
+            InstSummary summary() const;
 
             /**
              * Computes the size in bytes of this class file of the in-memory
@@ -2929,9 +4342,15 @@ namespace jnif {
             u4 computeSize();
 
             /**
+             * Computes the StackMapTable and the maxStack of the modified
+             * methods of this class file.
              *
+             * Only the types of the frames are tracked, unless trackDefUse
+             * is set, in which case every instruction is also linked with
+             * the ones defining the values it uses, see Inst::consumes and
+             * Inst::produces.
              */
-            void computeFrames(IClassPath* classPath);
+            void computeFrames(IClassPath* classPath, bool trackDefUse = false);
 
             /**
              * Writes this class file in the specified buffer according to the
@@ -2939,6 +4358,52 @@ namespace jnif {
              */
             void write(u1* classFileData, int classFileLen);
 
+            /**
+             * Writes the model of this class file to image as a binary
+             * image in native byte order: the constant pool, the members,
+             * the attributes and the decoded instructions, whose labels are
+             * kept by id.
+             * The image holds no pointers, so it can be stored and read back
+             * by another process, see ClassFile(const u1*, u4, ArenaPool*).
+             *
+             * Lazily parsed methods are decoded.
+             */
+            void writeImage(vector<u1>* image);
+
+            /**
+             * Removes the constant pool entries that nothing references, and
+             * renumbers every index in the members, attributes, instructions
+             * and frames.
+             * Lazily parsed methods are decoded.
+             * ldc_w instructions whose index fits in a byte become ldc.
+             *
+             * Unknown attributes are rewritten only when their format is
+             * known to this method, e.g., InnerClasses or
+             * BootstrapMethods.
+             *
+             * @returns the number of entries removed, or -1 when this class
+             * file holds an unknown attribute that cannot be rewritten, in
+             * which case it is left untouched.
+             */
+            int compactConstPool();
+
+            /**
+             * Returns true when this class file was changed since the last
+             * call to setModified(false), i.e., its constant pool, attributes,
+             * fields or methods.
+             * A class file not parsed lazily is always modified.
+             * Changes made in place to the access flags, version, this and
+             * super class or interfaces are not tracked.
+             */
+            bool isModified() const;
+
+            /**
+             * Sets the modified state of this class file, its constant pool,
+             * attributes and members.
+             * The lazy parser uses setModified(false) once the class file is parsed.
+             */
+            void setModified(bool modified);
+
             /**
              * Export this class file to dot format.
              *
@@ -2946,37 +4411,222 @@ namespace jnif {
              */
             void dot(ostream& os) const;
 
-            // Must be the first member, as it is needed for the destructors of the other members.
+            // Must be the first member, as the other members are allocated in it.
             Arena _arena;
 
             ConstPool::Index thisClassIndex = ConstPool::NULLINDEX;
             ConstPool::Index superClassIndex = ConstPool::NULLINDEX;
             u2 accessFlags = PUBLIC;
             Version version;
-            list<ConstPool::Index> interfaces;
-            list<Field> fields;
-            list<Method> methods;
-            Attrs attrs;
+
+            // The members, attributes and everything they hold live in _arena,
+            // and are never destroyed, so that destroying a class file
+            // only releases the blocks of its arena.
+            ArenaList<ConstPool::Index>& interfaces;
+            ArenaList<Field>& fields;
+            ArenaList<Method>& methods;
+            Attrs& attrs;
             Signature sig;
+
+        private:
+
+            template<typename T>
+            T& _create() {
+                return *_arena.create<T>(&_arena);
+            }
+
+            /**
+             * Hash table of the fields or the methods of a class file.
+             * The table holds the position of each member plus one.
+             */
+            struct MemberTable {
+                IndexTable table;
+                vector<Member*> members;
+            };
+
+            u4 _memberHash(const Member& member) const;
+
+            void _indexMember(MemberTable& table, Member* member);
+
+            Member* _findMember(MemberTable& table, const char* name, const char* desc) const;
+
+            bool modified = true;
+
+            MemberTable _fieldTable;
+
+            MemberTable _methodTable;
         };
 
         ostream& operator<<(ostream& os, const ClassFile& classFile);
 
+        template<typename TInst, typename ... TArgs>
+        TInst* InstList::_create(const TArgs& ... args) {
+            static_assert(alignof(TInst) <= 8, "Instruction records are aligned to 8 bytes");
+            static_assert(sizeof(TInst) <= 2 * RECORD_SIZE, "Instruction larger than two records");
+
+            u4 count = (sizeof(TInst) + RECORD_SIZE - 1) / RECORD_SIZE;
+            if (_recordCount + count > _recordCapacity) {
+                // The next chunk doubles the previous one, up to 1024 records.
+                _recordCapacity = std::min<u4>(std::max<u4>(_recordCapacity * 2, 16), 1024);
+                _records = (u1*) constPool->_arena.alloc(_recordCapacity * RECORD_SIZE, 8);
+                _recordCount = 0;
+            }
+
+            void* record = _records + _recordCount * RECORD_SIZE;
+            _recordCount += count;
+
+            return new(record) TInst(args ...);
+        }
 
     }
 
 
     using namespace model;
 
-    class Frame {
+    /**
+     * Def-use policy of frames that tracks nothing.
+     *
+     * Frames with this policy only hold types, which is all that the
+     * StackMapTable needs.
+     */
+    class NoDefs {
+    public:
+
+        NoDefs() {
+        }
+
+        explicit NoDefs(Inst*) {
+        }
+
+        bool includes(const NoDefs&) const {
+            return true;
+        }
+
+        void insert(const NoDefs&) {
+        }
+
+        void link(Inst*) const {
+        }
+
+        friend bool operator==(const NoDefs&, const NoDefs&) {
+            return true;
+        }
+    };
+
+    /**
+     * Def-use policy of frames that keeps the instructions that may have
+     * defined each local and stack slot.
+     *
+     * Every instruction reading a slot is linked with its definitions
+     * through Inst::consumes and Inst::produces.
+     */
+    class InstDefs {
+    public:
+
+        InstDefs() {
+        }
+
+        explicit InstDefs(Inst* inst) {
+            if (inst != nullptr) {
+                defs.insert(inst);
+            }
+        }
+
+        bool includes(const InstDefs& other) const {
+            for (Inst* inst : other.defs) {
+                if (defs.find(inst) == defs.end()) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        void insert(const InstDefs& other) {
+            defs.insert(other.defs.begin(), other.defs.end());
+        }
 
-        //Frame(const Frame&) = delete;
+        void link(Inst* inst) const;
 
+        friend bool operator==(const InstDefs& lhs, const InstDefs& rhs) {
+            return lhs.defs == rhs.defs;
+        }
+
+        set<Inst*> defs;
+    };
+
+    /**
+     * The types of the locals and the operand stack at some point of a
+     * method, as computed by the frame analysis.
+     *
+     * Each slot carries the definitions given by the TDefs policy.
+     * The stack is kept bottom to top, i.e., its back is the top of the
+     * stack.
+     */
+    template<class TDefs>
+    class BasicFrame {
     public:
 
-        Frame() :
+        typedef TDefs Defs;
+
+        typedef pair<Type, TDefs> T;
+
+        BasicFrame() :
                 valid(false), topsErased(false), maxStack(0) {
-            lva.reserve(256);
+        }
+
+        /**
+         * Copies a frame keeping its reserved room, so that copies made
+         * while computing frames do not grow again.
+         */
+        BasicFrame(const BasicFrame& other) :
+                valid(other.valid), topsErased(other.topsErased), maxStack(other.maxStack) {
+            lva.reserve(other.lva.capacity());
+            lva = other.lva;
+            stack.reserve(other.stack.capacity());
+            stack = other.stack;
+        }
+
+        BasicFrame(BasicFrame&& other) = default;
+
+        /**
+         * Copies the types of a frame with another def-use policy.
+         */
+        template<class TOtherDefs>
+        explicit BasicFrame(const BasicFrame<TOtherDefs>& other) :
+                valid(other.valid), topsErased(other.topsErased), maxStack(other.maxStack) {
+            lva.reserve(other.lva.capacity());
+            for (const typename BasicFrame<TOtherDefs>::T& t : other.lva) {
+                lva.push_back(T(t.first, TDefs()));
+            }
+
+            stack.reserve(other.stack.capacity());
+            for (const typename BasicFrame<TOtherDefs>::T& t : other.stack) {
+                stack.push_back(T(t.first, TDefs()));
+            }
+        }
+
+        BasicFrame& operator=(const BasicFrame& other) {
+            lva.reserve(other.lva.capacity());
+            lva = other.lva;
+            stack.reserve(other.stack.capacity());
+            stack = other.stack;
+            valid = other.valid;
+            topsErased = other.topsErased;
+            maxStack = other.maxStack;
+
+            return *this;
+        }
+
+        BasicFrame& operator=(BasicFrame&& other) = default;
+
+        /**
+         * Reserves room for the given number of locals and stack slots,
+         * usually the maxLocals and maxStack of the method.
+         */
+        void reserve(u4 maxLocals, u4 maxStack) {
+            lva.reserve(maxLocals);
+            stack.reserve(maxStack);
         }
 
         Type pop(Inst* inst);
@@ -3073,20 +4723,18 @@ namespace jnif {
 
         void cleanTops();
 
-        void join(Frame& how, class jnif::model::IClassPath* classPath);
+        void join(BasicFrame& how, class jnif::model::IClassPath* classPath);
 
         void init(const Type& type);
 
-        typedef pair<Type, set<Inst*> > T;
-
         vector<T> lva;
-        list<T> stack;
+        vector<T> stack;
         bool valid;
         bool topsErased;
 
         unsigned long maxStack;
 
-        friend bool operator==(const Frame& lhs, const Frame& rhs) {
+        friend bool operator==(const BasicFrame& lhs, const BasicFrame& rhs) {
             return lhs.lva == rhs.lva && lhs.stack == rhs.stack
                    && lhs.valid == rhs.valid;
         }
@@ -3097,55 +4745,170 @@ namespace jnif {
 
     };
 
-    ostream& operator<<(ostream& os, const Frame& frame);
+    /**
+     * The frames kept in basic blocks and used to compute the
+     * StackMapTable.
+     */
+    typedef BasicFrame<NoDefs> Frame;
+
+    /**
+     * Frames that also link instructions with the ones defining the values
+     * they use.
+     */
+    typedef BasicFrame<InstDefs> DefUseFrame;
+
+    template<class TDefs>
+    ostream& operator<<(ostream& os, const BasicFrame<TDefs>& frame);
 
 /**
  * Represents a basic block of instructions.
  *
+ * Basic blocks are allocated in the arena of the class file and are
+ * identified by their position in the control flow graph.
+ *
  * @see Inst
  */
     class BasicBlock {
     public:
-        BasicBlock(const BasicBlock&) = delete;
 
-        BasicBlock(BasicBlock&&) = default;
+        /**
+         * Range over the basic blocks given by a list of ids.
+         */
+        class Blocks {
+        public:
+
+            class iterator {
+            public:
+
+                iterator(BasicBlock* const* blocks, const u4* pos) : blocks(blocks), pos(pos) {
+                }
+
+                BasicBlock* operator*() const {
+                    return blocks[*pos];
+                }
+
+                iterator& operator++() {
+                    ++pos;
+                    return *this;
+                }
+
+                friend bool operator==(const iterator& lhs, const iterator& rhs) {
+                    return lhs.pos == rhs.pos;
+                }
+
+                friend bool operator!=(const iterator& lhs, const iterator& rhs) {
+                    return lhs.pos != rhs.pos;
+                }
+
+            private:
+                BasicBlock* const* blocks;
+                const u4* pos;
+            };
+
+            Blocks(BasicBlock* const* blocks, const ArenaVector<u4>& ids) : blocks(blocks), ids(ids) {
+            }
+
+            iterator begin() const {
+                return iterator(blocks, ids.data());
+            }
+
+            iterator end() const {
+                return iterator(blocks, ids.data() + ids.size());
+            }
+
+            u4 size() const {
+                return ids.size();
+            }
+
+            BasicBlock* operator[](u4 i) const {
+                return blocks[ids[i]];
+            }
+
+        private:
+            BasicBlock* const* blocks;
+            const ArenaVector<u4>& ids;
+        };
+
+        BasicBlock(const BasicBlock&) = delete;
 
         friend class ControlFlowGraph;
 
         void addTarget(BasicBlock* target);
 
-        model::InstList::Iterator start;
-        model::InstList::Iterator exit;
-        string name;
-        Frame in;
-        Frame out;
+        /**
+         * Reserves room for count successors, e.g., the targets of a
+         * switch, as the arena does not reclaim grown arrays.
+         */
+        void reserveTargets(u4 count) {
+            _targets.reserve(count);
+        }
 
-        vector<BasicBlock*>::iterator begin() {
-            return targets.begin();
+        /**
+         * The name of this basic block, only meant for printing.
+         */
+        string name() const;
+
+        /**
+         * The successors of this basic block.
+         */
+        Blocks targets() const;
+
+        /**
+         * The predecessors of this basic block.
+         */
+        Blocks ins() const;
+
+        Blocks::iterator begin() const {
+            return targets().begin();
         }
 
-        vector<BasicBlock*>::iterator end() {
-            return targets.end();
+        Blocks::iterator end() const {
+            return targets().end();
         }
 
+        model::InstList::Iterator start;
+        model::InstList::Iterator exit;
+
+        /**
+         * The position of this basic block in its control flow graph.
+         * The entry and exit blocks are 0 and 1 respectively.
+         */
+        const u4 id;
+
+        Frame in;
+        Frame out;
+
         BasicBlock* next = nullptr;
 
         class ControlFlowGraph* const cfg;
 
         const Inst* last = nullptr;
 
-        vector<BasicBlock*> targets;
-        vector<BasicBlock*> ins;
-
         const BasicBlock* dom = nullptr;
 
+        /**
+         * The number of times the frame analysis executed this basic block
+         * until its frames reached a fixed point.
+         */
+        u4 visits = 0;
+
+        /**
+         * The positions in the exception table of the handlers whose try
+         * range covers this basic block.
+         * Only set when the graph is built from a Code attribute.
+         */
+        vector<u4> handlers;
+
     private:
 
-        BasicBlock(InstList::Iterator& start, InstList::Iterator& exit,
-                   const string& name, class ControlFlowGraph* cfg) :
-                start(start), exit(exit), name(name), cfg(cfg) {
+        BasicBlock(InstList::Iterator& start, InstList::Iterator& exit, u4 id,
+                   class ControlFlowGraph* cfg, Arena* arena) :
+                start(start), exit(exit), id(id), cfg(cfg), _targets(arena), _ins(arena) {
         }
 
+        ArenaVector<u4> _targets;
+        ArenaVector<u4> _ins;
+
     };
 
     /**
@@ -3156,31 +4919,47 @@ namespace jnif {
     public:
         vector<BasicBlock*> basicBlocks;
 
+    private:
+
+        /**
+         * The basic block starting at each label, indexed by label id.
+         */
+        vector<BasicBlock*> labelBlocks;
+
     public:
 
         static constexpr const char* EntryName = ".Entry";
         static constexpr const char* ExitName = ".Exit";
 
+        const InstList& instList;
+
         BasicBlock* const entry;
 
         BasicBlock* const exit;
 
-        const InstList& instList;
-
         explicit ControlFlowGraph(InstList& instList);
 
+        /**
+         * Builds the graph of the instructions of code.
+         * The basic blocks are also split at the start and end of each try
+         * range, so that a handler covers either all or none of the
+         * instructions of a block, and the covering handlers are recorded
+         * in each block.
+         * The offsets of the instructions must be computed.
+         */
+        explicit ControlFlowGraph(CodeAttr& code);
+
         ~ControlFlowGraph();
 
         /**
          * Adds a basic block to this control flow graph.
+         * Its id is the number of basic blocks added before.
          *
          * @param start the start of the basic block.
          * @param end the end of the basic block.
-         * @param name the name of the basic block to add.
          * @returns the newly created basic block added to this control flow graph.
          */
-        BasicBlock* addBasicBlock(InstList::Iterator start, InstList::Iterator end,
-                                  const string& name);
+        BasicBlock* addBasicBlock(InstList::Iterator start, InstList::Iterator end);
 
         /**
          * Finds the basic block associated with the given labelId.
@@ -3191,6 +4970,13 @@ namespace jnif {
          */
         BasicBlock* findBasicBlockOfLabel(int labelId) const;
 
+        /**
+         * Returns the number of basic blocks, including entry and exit.
+         */
+        u4 size() const {
+            return basicBlocks.size();
+        }
+
         vector<BasicBlock*>::iterator begin() {
             return basicBlocks.begin();
         }
@@ -3207,19 +4993,33 @@ namespace jnif {
             return basicBlocks.end();
         }
 
+        /**
+         * Returns the number of basic block executions made by the frame
+         * analysis, i.e., the cost to reach its fixed point.
+         */
+        u4 visits() const;
+
         typedef map<BasicBlock*, set<BasicBlock*> > D;
 
         D dominance(BasicBlock* start);
 
     private:
 
-        BasicBlock* addConstBb(InstList& instList, const char* name) {
-            return addBasicBlock(instList.end(), instList.end(), name);
+        BasicBlock* addConstBb() {
+            return addBasicBlock(instList.end(), instList.end());
         }
 
     };
 
-    ostream& operator<<(ostream& os, BasicBlock& bb);
+    inline BasicBlock::Blocks BasicBlock::targets() const {
+        return Blocks(cfg->basicBlocks.data(), _targets);
+    }
+
+    inline BasicBlock::Blocks BasicBlock::ins() const {
+        return Blocks(cfg->basicBlocks.data(), _ins);
+    }
+
+    ostream& operator<<(ostream& os, const BasicBlock& bb);
 
     ostream& operator<<(ostream& os, const ControlFlowGraph& cfg);
 
@@ -3228,12 +5028,366 @@ namespace jnif {
         class ClassFileParser : public model::ClassFile {
         public:
 
-            explicit ClassFileParser(const u1* data, u4 len);
+            /**
+             * Parses the class file in data.
+             *
+             * When lazy is true, the body of each method is not decoded until
+             * its Code attribute is requested, e.g., by Method::instList.
+             * Methods never requested are written back verbatim, and UTF8
+             * constants borrow their bytes from data instead of copying them.
+             * In this case data must outlive the parsed class file.
+             *
+             * When pool is not null, the arena blocks are taken from it.
+             */
+            explicit ClassFileParser(const u1* data, u4 len, bool lazy = false, ArenaPool* pool = nullptr);
 
-            static void parse(const u1* data, u4 len, ClassFile* classFile);
+            static void parse(const u1* data, u4 len, ClassFile* classFile, bool lazy = false);
 
         };
 
+        /**
+         * Read-only view of a class file over the caller's buffer.
+         *
+         * The class file is validated in a single scan, which records the
+         * offset of each constant pool entry, member and attribute.
+         * Accessors read the names, descriptors and attribute payloads
+         * straight from the buffer, no model objects are created.
+         * Meant for consumers that only read a class, e.g., to load a
+         * class hierarchy.
+         *
+         * The buffer must outlive this view.
+         */
+        class ClassFileView {
+        public:
+
+            /**
+             * An attribute of the class, a field, a method or a Code
+             * attribute.
+             */
+            struct Attr {
+
+                /// The utf8 entry index containing the name of this attribute.
+                ConstPool::Index nameIndex;
+
+                /// The length of the payload.
+                u4 len;
+
+                /// The offset of the payload in the buffer.
+                u4 offset;
+            };
+
+            /**
+             * A field or a method.
+             */
+            struct Member {
+                u2 accessFlags;
+                ConstPool::Index nameIndex;
+                ConstPool::Index descIndex;
+
+                /// The number of attributes of this member.
+                u2 attrCount;
+
+                /// The position in the attribute table of the first attribute.
+                u4 firstAttr;
+
+                /// The position in the attribute table of the Code
+                /// attribute, or NOCODE.
+                u4 codeAttr;
+            };
+
+            /**
+             * The ranges of a Code attribute.
+             */
+            struct Code {
+                u2 maxStack;
+                u2 maxLocals;
+
+                /// The offset of the bytecode in the buffer.
+                u4 codeOffset;
+
+                u4 codeLen;
+
+                /// The offset of the exception table in the buffer.
+                u4 exceptionsOffset;
+
+                u2 exceptionCount;
+
+                /// The number of attributes of the Code attribute.
+                u2 attrCount;
+
+                /// The position in the attribute table of the first attribute.
+                u4 firstAttr;
+            };
+
+            static constexpr u4 NOCODE = 0xffffffff;
+
+            ClassFileView() {
+            }
+
+            /**
+             * Scans the class file in data.
+             */
+            ClassFileView(const u1* data, u4 len) {
+                scan(data, len);
+            }
+
+            /**
+             * Scans the class file in data, replacing the previous one.
+             * The tables keep their capacity, so a view reused for many
+             * classes stops allocating memory.
+             */
+            void scan(const u1* data, u4 len);
+
+            const u1* data() const {
+                return _data;
+            }
+
+            u4 size() const {
+                return _len;
+            }
+
+            Version version() const {
+                return _version;
+            }
+
+            u2 accessFlags() const {
+                return _accessFlags;
+            }
+
+            ConstPool::Index thisClassIndex() const {
+                return _thisClassIndex;
+            }
+
+            ConstPool::Index superClassIndex() const {
+                return _superClassIndex;
+            }
+
+            /**
+             * The number of entries of the constant pool,
+             * including the null entry.
+             */
+            u2 constCount() const {
+                return _cp.size();
+            }
+
+            ConstPool::Tag getTag(ConstPool::Index index) const;
+
+            /**
+             * Returns the utf8 entry at index, borrowed from the buffer.
+             */
+            ConstPool::Utf8 getUtf8(ConstPool::Index index) const;
+
+            /**
+             * Returns the name of the class entry at classIndex.
+             */
+            ConstPool::Utf8 getClassName(ConstPool::Index classIndex) const;
+
+            ConstPool::Utf8 getThisClassName() const {
+                return getClassName(_thisClassIndex);
+            }
+
+            /**
+             * Returns the name of the super class.
+             * Only java/lang/Object has no super class.
+             */
+            ConstPool::Utf8 getSuperClassName() const {
+                return getClassName(_superClassIndex);
+            }
+
+            u2 interfaceCount() const {
+                return _interfaceCount;
+            }
+
+            /**
+             * Returns the class entry index of the i-th interface.
+             */
+            ConstPool::Index getInterface(u2 i) const;
+
+            const vector<Member>& fields() const {
+                return _fields;
+            }
+
+            const vector<Member>& methods() const {
+                return _methods;
+            }
+
+            ConstPool::Utf8 getName(const Member& member) const {
+                return getUtf8(member.nameIndex);
+            }
+
+            ConstPool::Utf8 getDesc(const Member& member) const {
+                return getUtf8(member.descIndex);
+            }
+
+            ConstPool::Utf8 getName(const Attr& attr) const {
+                return getUtf8(attr.nameIndex);
+            }
+
+            /**
+             * Returns the payload of attr.
+             */
+            const u1* payload(const Attr& attr) const {
+                return _data + attr.offset;
+            }
+
+            /**
+             * Returns the i-th attribute of the attribute table.
+             */
+            const Attr& attr(u4 i) const {
+                return _attrs[i];
+            }
+
+            /**
+             * Returns the i-th attribute of member.
+             */
+            const Attr& attr(const Member& member, u2 i) const {
+                return _attrs[member.firstAttr + i];
+            }
+
+            /**
+             * Returns the attribute of member with the given name,
+             * or nullptr if there is none.
+             */
+            const Attr* findAttr(const Member& member, const char* name) const {
+                return _findAttr(member.firstAttr, member.attrCount, name);
+            }
+
+            /**
+             * The number of attributes of the class.
+             */
+            u2 attrCount() const {
+                return _attrCount;
+            }
+
+            /**
+             * Returns the i-th attribute of the class.
+             */
+            const Attr& classAttr(u2 i) const {
+                return _attrs[_firstAttr + i];
+            }
+
+            /**
+             * Returns the attribute of the class with the given name,
+             * or nullptr if there is none.
+             */
+            const Attr* findAttr(const char* name) const {
+                return _findAttr(_firstAttr, _attrCount, name);
+            }
+
+            /**
+             * Returns true when method has a Code attribute.
+             */
+            bool hasCode(const Member& method) const {
+                return method.codeAttr != NOCODE;
+            }
+
+            /**
+             * Returns the ranges of the Code attribute of method,
+             * which must have one.
+             */
+            Code getCode(const Member& method) const;
+
+        private:
+
+            const Attr* _findAttr(u4 first, u2 count, const char* name) const;
+
+            const u1* _data = nullptr;
+            u4 _len = 0;
+            Version _version;
+            u2 _accessFlags = 0;
+            ConstPool::Index _thisClassIndex = ConstPool::NULLENTRY;
+            ConstPool::Index _superClassIndex = ConstPool::NULLENTRY;
+            u2 _interfaceCount = 0;
+
+            /// The offset of the first interface in the buffer.
+            u4 _interfacesOffset = 0;
+
+            u2 _attrCount = 0;
+            u4 _firstAttr = 0;
+
+            /// The offset in the buffer of the tag of each constant pool
+            /// entry, or zero for unusable entries.
+            vector<u4> _cp;
+
+            vector<Member> _fields;
+            vector<Member> _methods;
+
+            /// The attributes of the members, the class and the Code
+            /// attributes, in scan order.
+            vector<Attr> _attrs;
+        };
+
+        /**
+         * Decides whether a class file references any of a set of classes,
+         * members or strings, without parsing it.
+         *
+         * Every symbol a class references is a utf8 constant, so only the
+         * constant pool region of the raw bytes is searched.
+         * Each pattern is searched over the whole region with memmem,
+         * and only the tags of the constant pool are decoded,
+         * to find the end of the region and to confirm a candidate match.
+         *
+         * It is conservative: it can report a class that does not use a
+         * pattern, e.g., a member name used by another class, but never
+         * misses one that does.
+         */
+        class ClassFilePrefilter {
+        public:
+
+            /**
+             * Matches classes referencing className, in internal form,
+             * e.g., java/util/ArrayList.
+             * References inside descriptors and signatures are included.
+             * A package prefix, e.g., org/slf4j/, matches all its classes.
+             */
+            void addClass(const string& className);
+
+            /**
+             * Matches classes referencing className and a member named
+             * memberName.
+             */
+            void addMember(const string& className, const string& memberName);
+
+            /**
+             * Matches classes with a utf8 constant equal to value,
+             * e.g., a string literal.
+             */
+            void addString(const string& value);
+
+            /**
+             * Whether no pattern was added.
+             */
+            bool empty() const {
+                return _classes.empty() && _members.empty() && _strings.empty();
+            }
+
+            /**
+             * Returns true when the class file in data references any of
+             * the patterns.
+             */
+            bool matches(const u1* data, u4 len) const;
+
+        private:
+
+            /**
+             * Searches needle in the constant pool entries in [begin, end).
+             * When isEntry is true, needle is an encoded utf8 entry that
+             * must start at an entry, otherwise it must lie inside the
+             * bytes of a utf8 entry.
+             */
+            static bool _find(const u1* begin, const u1* end, const string& needle, bool isEntry);
+
+            /// The class name patterns.
+            vector<string> _classes;
+
+            /// The class name and member name, as an encoded utf8 entry,
+            /// of each member pattern.
+            vector<std::pair<string, string>> _members;
+
+            /// The string patterns, as encoded utf8 entries.
+            vector<string> _strings;
+        };
+
     }
 
     namespace stream {
@@ -3285,6 +5439,139 @@ namespace jnif {
             void* _uf;
         };
 
+        /**
+         * Class cache: the classes of one or more jar files in a single file
+         * that is mapped into memory.
+         *
+         * Each class is kept as its class file bytes, already inflated, and
+         * optionally as the image of its parsed model,
+         * see ClassFile::writeImage.
+         * A class file constructed from the image of a class is ready to use
+         * without parsing, and uses the mapped pages for its utf8 entries.
+         * Otherwise, parsing lazily from the mapped bytes borrows their
+         * constant pools and code instead of copying them.
+         * Either way, the pages are shared by all processes mapping the same
+         * file.
+         *
+         * All offsets in the file are relative to its start,
+         * and integers are in native byte order.
+         */
+        class ClassCache {
+        public:
+
+            /**
+             * Builds an image in memory and writes it to disk.
+             */
+            class Builder {
+            public:
+
+                /**
+                 * Adds a copy of the given class file bytes, and the image
+                 * of classFile when not nullptr, which is usually the class
+                 * file parsed from data.
+                 */
+                void add(const char* fileName, const u1* data, u4 len, ClassFile* classFile = nullptr);
+
+                /**
+                 * Writes the image to path, replacing it atomically.
+                 */
+                void write(const char* path) const;
+
+                int size() const {
+                    return _count;
+                }
+
+            private:
+
+                vector<u1> _names;
+
+                vector<u1> _data;
+
+                vector<u4> _entries;
+
+                int _count = 0;
+            };
+
+            /**
+             * Maps the image at path.
+             * Throws JarException when it cannot be opened or is not a
+             * valid image.
+             */
+            explicit ClassCache(const char* path);
+
+            ~ClassCache();
+
+            ClassCache(const ClassCache&) = delete;
+
+            ClassCache& operator=(const ClassCache&) = delete;
+
+            int size() const {
+                return _count;
+            }
+
+            const char* fileName(int i) const {
+                return (const char*) _image + _entry(i)[0];
+            }
+
+            /**
+             * The bytes of the i-th class, valid while this cache lives.
+             */
+            const u1* data(int i) const {
+                return _image + _entry(i)[2];
+            }
+
+            u4 len(int i) const {
+                return _entry(i)[3];
+            }
+
+            /**
+             * The image of the model of the i-th class, valid while this
+             * cache lives, or nullptr when it was added without one.
+             * It is 8-byte aligned, as ClassFile(const u1*, u4, ArenaPool*)
+             * requires.
+             */
+            const u1* image(int i) const {
+                return imageLen(i) == 0 ? nullptr : _image + _entry(i)[4];
+            }
+
+            u4 imageLen(int i) const {
+                return _entry(i)[5];
+            }
+
+            /**
+             * Calls callback for each class, as JarFile::forEach does.
+             * The buffer given to callback points into the mapped image.
+             */
+            int forEach(void* args, int jarid, JarFile::ZipCallback callback) const;
+
+            static constexpr const char* MAGIC = "JNIFCACH";
+
+            static constexpr u4 VERSION = 2;
+
+        private:
+
+            /**
+             * The offset and length of the file name, the class file bytes
+             * and the image of each class.
+             */
+            static constexpr u4 ENTRY_SIZE = 6;
+
+            const u4* _entry(int i) const {
+                return (const u4*) (_image + HEADER_SIZE) + ENTRY_SIZE * i;
+            }
+
+            /**
+             * The magic, the version and the number of classes.
+             */
+            static constexpr u4 HEADER_SIZE = 16;
+
+            const u1* _image;
+
+            size_t _size;
+
+            int _count;
+        };
+
     }
 
 
@@ -3301,12 +5588,13 @@ namespace jnif {
 //	}
 
         /**
-         *
+         * Classes are kept by their ClassNames symbol, so that walking up
+         * the hierarchy compares integers.
          */
         class ClassEntry {
         public:
-            string className;
-            string superClassName;
+            ClassNames::Symbol className;
+            ClassNames::Symbol superClassName;
             //std::vector<String> interfaces;
         };
 
@@ -3319,6 +5607,11 @@ namespace jnif {
          */
         void addClass(const ClassFile& classFile);
 
+        /**
+         * Adds the class in view, without parsing it into a ClassFile.
+         */
+        void addClass(const parser::ClassFileView& view);
+
         const string& getSuperClass(const string& className) const;
 
         bool isAssignableFrom(const string& sub, const string& sup) const;
@@ -3347,10 +5640,13 @@ namespace jnif {
 
         //list<ClassEntry> classes;
 
-        map<string, ClassEntry> classes;
+        map<ClassNames::Symbol, ClassEntry> classes;
 
-        map<string, ClassEntry>::const_iterator getEntry(
+        map<ClassNames::Symbol, ClassEntry>::const_iterator getEntry(
                 const string& className) const;
+
+        void addClass(const char* className, size_t len,
+                      const char* superClassName, size_t superLen);
     };
 
     typedef map<BasicBlock*, set<BasicBlock*> > DomMap;
@@ -3410,7 +5706,7 @@ namespace jnif {
     struct IDom : DomMap {
         IDom(SDom<TDir>& ds) {
             for (pair<BasicBlock* const, set<BasicBlock*> >& d : ds) {
-                JnifError::assert(!d.second.empty(), "Empty: ", d.first->name);
+                JnifError::assert(!d.second.empty(), "Empty: ", d.first->name());
 
                 set<BasicBlock*> sdomBy = d.second;
                 for (BasicBlock* bb : d.second) {
@@ -3428,13 +5724,13 @@ namespace jnif {
     };
 
     struct Forward {
-        static vector<BasicBlock*>& dir(BasicBlock* bb) { return bb->ins; }
+        static BasicBlock::Blocks dir(BasicBlock* bb) { return bb->ins(); }
 
         static BasicBlock* start(const ControlFlowGraph& cfg) { return cfg.entry; }
     };
 
     struct Backward {
-        static vector<BasicBlock*>& dir(BasicBlock* bb) { return bb->targets; }
+        static BasicBlock::Blocks dir(BasicBlock* bb) { return bb->targets(); }
 
         static BasicBlock* start(const ControlFlowGraph& cfg) { return cfg.exit; }
     };
@@ -4,20 +4,24 @@
 
 #include "jnif.hpp"
 
+#include <cstring>
+#include <atomic>
+#include <mutex>
+
 namespace jnif {
 
     namespace model {
 
         u4 ConstPool::size() const {
-            return entries.size();
+            return tags.size();
         }
 
-        ConstPool::Iterator ConstPool::iterator() const {
-            return Iterator(*this, 1);
+        ConstPool::Iterator ConstPool::iterator(ConstPool::Index start) const {
+            return Iterator(*this, start);
         }
 
         ConstPool::Index ConstPool::addClass(ConstPool::Index classNameIndex) {
-            return _addSingle(Class({classNameIndex}));
+            return _addSingle(CLASS, Class({classNameIndex}));
         }
 
         ConstPool::Index ConstPool::addClass(const char* className) {
@@ -54,7 +58,7 @@ namespace jnif {
         }
 
         ConstPool::Index ConstPool::addString(ConstPool::Index utf8Index) {
-            return _addSingle(String({utf8Index}));
+            return _addSingle(STRING, String({utf8Index}));
         }
 
         ConstPool::Index ConstPool::addString(const std::string &str) {
@@ -70,109 +74,561 @@ namespace jnif {
         }
 
         ConstPool::Index ConstPool::addInteger(int value) {
-            return _addSingle(Integer({value}));
+            return _addSingle(INTEGER, Integer({value}));
         }
 
         ConstPool::Index ConstPool::addFloat(float value) {
-            return _addSingle(Float({value}));
+            return _addSingle(FLOAT, Float({value}));
         }
 
         ConstPool::Index ConstPool::addLong(long value) {
-            return _addDoubleEntry(Long({value}));
+            return _addDoubleEntry(LONG, Long({value}));
         }
 
         ConstPool::Index ConstPool::addDouble(double value) {
-            return _addDoubleEntry(Double({value}));
+            return _addDoubleEntry(DOUBLE, Double({value}));
         }
 
         ConstPool::Index ConstPool::addNameAndType(ConstPool::Index nameIndex,
                                                    ConstPool::Index descIndex) {
-            return _addSingle(NameAndType({nameIndex, descIndex}));
+            return _addSingle(NAMEANDTYPE, NameAndType({nameIndex, descIndex}));
         }
 
         ConstPool::Index ConstPool::addUtf8(const char* utf8, int len) {
-            std::string str(utf8, len);
-            Index i = _addSingle(str);
-            utf8s[str] = i;
+            JnifError::check(len < (1 << 16), "Utf8 too long: len=", len);
+
+            char* str = (char*) _utf8Arena.alloc(len + 1);
+            memcpy(str, utf8, len);
+            str[len] = '\0';
 
-            return i;
+            utf8s.push_back(Utf8({str, (u2) len, false}));
+            return _addSingle(UTF8, Value(utf8s.size() - 1));
         }
 
         ConstPool::Index ConstPool::addUtf8(const char* str) {
-            Index i = _addSingle(str);
-            utf8s[std::string(str)] = i;
+            return addUtf8(str, strlen(str));
+        }
 
-            return i;
+        ConstPool::Index ConstPool::addUtf8View(const char* utf8, u2 len) {
+            utf8s.push_back(Utf8({utf8, len, true}));
+            return _addSingle(UTF8, Value(utf8s.size() - 1));
         }
 
         ConstPool::Index ConstPool::addMethodHandle(u1 refKind, u2 refIndex) {
-            return _addSingle(MethodHandle({refKind, refIndex}));
+            return _addSingle(METHODHANDLE, MethodHandle({refKind, refIndex}));
         }
 
         ConstPool::Index ConstPool::addMethodType(u2 descIndex) {
-            return _addSingle(MethodType({descIndex}));
+            return _addSingle(METHODTYPE, MethodType({descIndex}));
         }
 
         ConstPool::Index ConstPool::addInvokeDynamic(u2 bootstrapMethodAttrIndex,
                                                      u2 nameAndType) {
-            return _addSingle(InvokeDynamic({bootstrapMethodAttrIndex, nameAndType}));
+            return _addSingle(INVOKEDYNAMIC, InvokeDynamic({bootstrapMethodAttrIndex, nameAndType}));
         }
 
-        template<class... TArgs>
-        ConstPool::Index ConstPool::_addSingle(TArgs... args) {
-            int index = entries.size();
+        ConstPool::Index ConstPool::_addSingle(Tag tag, Value value) {
+            int index = tags.size();
 
             JnifError::check(index < (1 << 16), "CP limit reach: index=", index);
-            entries.emplace_back(args...);
+            tags.push_back(tag);
+            values.push_back(value);
+            modified = true;
+            _indexEntry(index);
 
             return (Index) index;
         }
 
-        template<class... TArgs>
-        ConstPool::Index ConstPool::_addDoubleEntry(TArgs... args) {
-            Index index = entries.size();
-            entries.emplace_back(args...);
+        ConstPool::Index ConstPool::_addDoubleEntry(Tag tag, Value value) {
+            int index = tags.size();
 
-            entries.emplace_back();
+            JnifError::check(index + 1 < (1 << 16), "CP limit reach: index=", index);
+            tags.push_back(tag);
+            values.push_back(value);
 
-            return index;
+            tags.push_back(NULLENTRY);
+            values.emplace_back();
+            modified = true;
+            _indexEntry(index);
+
+            return (Index) index;
         }
 
-        ConstPool::Index ConstPool::getIndexOfUtf8(const char* utf8) {
-            auto it = utf8s.find(utf8);
-            if (it != utf8s.end()) {
-                Index idx = it->second;
-                JnifError::assert(getUtf8(idx) != utf8, "Error on get index of utf8");
-                return idx;
+        ConstPool::Index ConstPool::_putValue(Tag tag, Value value) {
+            if (!_valueIndex.built) {
+                _buildValueIndex();
+            }
+
+            u8 key = _valueKey(tag, value);
+            Index i = _valueIndex.find(_valueHash(tag, value), [&](Index j) {
+                return tags[j] == tag && _valueKey(tag, values[j]) == key;
+            });
+
+            if (i != NULLENTRY) {
+                return i;
+            }
+
+            if (tag == LONG || tag == DOUBLE) {
+                return _addDoubleEntry(tag, value);
             } else {
-                return NULLENTRY;
+                return _addSingle(tag, value);
             }
         }
 
+        ConstPool::Index ConstPool::getIndexOfUtf8(const char* utf8) {
+            if (!_utf8Index.built) {
+                _buildUtf8Index();
+            }
+
+            size_t len = strlen(utf8);
+            return _utf8Index.find(_hash(utf8, len), [&](Index i) {
+                const Utf8& entry = _getUtf8(i);
+                return entry.length() == len && memcmp(entry.bytes(), utf8, len) == 0;
+            });
+        }
+
         ConstPool::Index ConstPool::getIndexOfClass(const char* className) {
-            auto it = classes.find(className);
-            if (it != utf8s.end()) {
-                ConstPool::Index idx = it->second;
-                // JnifError::assert(getUtf8(idx) != utf8, "Error on get index of utf8");
-                return idx;
-            } else {
-                return NULLENTRY;
+            if (!_classIndex.built) {
+                _buildClassIndex();
+            }
+
+            size_t len = strlen(className);
+            return _classIndex.find(_hash(className, len), [&](Index i) {
+                const Utf8& entry = _getUtf8(values[i].clazz.nameIndex);
+                return entry.length() == len && memcmp(entry.bytes(), className, len) == 0;
+            });
+        }
+
+        ConstPool::Index ConstPool::putFieldRef(ConstPool::Index classIndex, ConstPool::Index nameAndTypeIndex) {
+            return _putValue(FIELDREF, MemberRef({classIndex, nameAndTypeIndex}));
+        }
+
+        ConstPool::Index ConstPool::putFieldRef(ConstPool::Index classIndex, const char* name, const char* desc) {
+            return putFieldRef(classIndex, putNameAndType(name, desc));
+        }
+
+        ConstPool::Index ConstPool::putMethodRef(ConstPool::Index classIndex, ConstPool::Index nameAndTypeIndex) {
+            return _putValue(METHODREF, MemberRef({classIndex, nameAndTypeIndex}));
+        }
+
+        ConstPool::Index ConstPool::putMethodRef(ConstPool::Index classIndex, const char* name, const char* desc) {
+            return putMethodRef(classIndex, putNameAndType(name, desc));
+        }
+
+        ConstPool::Index ConstPool::putInterMethodRef(ConstPool::Index classIndex, ConstPool::Index nameAndTypeIndex) {
+            return _putValue(INTERMETHODREF, MemberRef({classIndex, nameAndTypeIndex}));
+        }
+
+        ConstPool::Index ConstPool::putInterMethodRef(ConstPool::Index classIndex, const char* name, const char* desc) {
+            return putInterMethodRef(classIndex, putNameAndType(name, desc));
+        }
+
+        ConstPool::Index ConstPool::putNameAndType(ConstPool::Index nameIndex, ConstPool::Index descIndex) {
+            return _putValue(NAMEANDTYPE, NameAndType({nameIndex, descIndex}));
+        }
+
+        ConstPool::Index ConstPool::putNameAndType(const char* name, const char* desc) {
+            return putNameAndType(putUtf8(name), putUtf8(desc));
+        }
+
+        ConstPool::Index ConstPool::putString(ConstPool::Index utf8Index) {
+            return _putValue(STRING, String({utf8Index}));
+        }
+
+        ConstPool::Index ConstPool::putString(const string& str) {
+            return putString(putUtf8(str.c_str()));
+        }
+
+        ConstPool::Index ConstPool::putStringFromClass(ConstPool::Index classIndex) {
+            return putString(getClassNameIndex(classIndex));
+        }
+
+        ConstPool::Index ConstPool::putInteger(int value) {
+            return _putValue(INTEGER, Integer({value}));
+        }
+
+        ConstPool::Index ConstPool::putFloat(float value) {
+            return _putValue(FLOAT, Float({value}));
+        }
+
+        ConstPool::Index ConstPool::putLong(long value) {
+            return _putValue(LONG, Long({value}));
+        }
+
+        ConstPool::Index ConstPool::putDouble(double value) {
+            return _putValue(DOUBLE, Double({value}));
+        }
+
+        ConstPool::Index ConstPool::putMethodType(ConstPool::Index descIndex) {
+            return _putValue(METHODTYPE, MethodType({descIndex}));
+        }
+
+        u4 ConstPool::_hash(const char* str, size_t len) {
+            // FNV-1a
+            u4 hash = 2166136261u;
+            for (size_t i = 0; i < len; i++) {
+                hash ^= (u1) str[i];
+                hash *= 16777619u;
+            }
+
+            return hash;
+        }
+
+        u4 ConstPool::_classHash(Index classIndex) const {
+            const Utf8& className = _getUtf8(values[classIndex].clazz.nameIndex);
+            return _hash(className.bytes(), className.length());
+        }
+
+        u8 ConstPool::_valueKey(Tag tag, const Value& entry) {
+            switch (tag) {
+                case FIELDREF:
+                case METHODREF:
+                case INTERMETHODREF:
+                    return ((u8) entry.memberRef.classIndex << 16) | entry.memberRef.nameAndTypeIndex;
+                case STRING:
+                    return entry.s.stringIndex;
+                case INTEGER:
+                    return (u4) entry.i.value;
+                case FLOAT: {
+                    u4 bits;
+                    memcpy(&bits, &entry.f.value, sizeof(bits));
+                    return bits;
+                }
+                case LONG:
+                    return (u8) entry.l.value;
+                case DOUBLE: {
+                    u8 bits;
+                    memcpy(&bits, &entry.d.value, sizeof(bits));
+                    return bits;
+                }
+                case NAMEANDTYPE:
+                    return ((u8) entry.nameAndType.nameIndex << 16) | entry.nameAndType.descriptorIndex;
+                case METHODHANDLE:
+                    return ((u8) entry.methodHandle.referenceKind << 16) | entry.methodHandle.referenceIndex;
+                case METHODTYPE:
+                    return entry.methodType.descriptorIndex;
+                case INVOKEDYNAMIC:
+                    return ((u8) entry.invokeDynamic.bootstrapMethodAttrIndex << 16)
+                           | entry.invokeDynamic.nameAndTypeIndex;
+                default:
+                    throw Exception("Invalid tag for a value entry: ", (int) tag);
+            }
+        }
+
+        u4 ConstPool::_valueHash(Tag tag, const Value& entry) {
+            u8 key = _valueKey(tag, entry);
+            return _hash((const char*) &key, sizeof(key)) ^ ((u4) tag * 2654435761u);
+        }
+
+        bool ConstPool::_isValue(Tag tag) {
+            return tag != NULLENTRY && tag != UTF8 && tag != CLASS;
+        }
+
+        void ConstPool::_indexEntry(Index index) {
+            u1 tag = tags[index];
+            if (tag == UTF8) {
+                if (_utf8Index.built) {
+                    const Utf8& entry = _getUtf8(index);
+                    _utf8Index.insert(_hash(entry.bytes(), entry.length()), index);
+                }
+            } else if (tag == CLASS) {
+                if (_classIndex.built) {
+                    _classIndex.insert(_classHash(index), index);
+                }
+            } else if (_valueIndex.built) {
+                _valueIndex.insert(_valueHash((Tag) tag, values[index]), index);
             }
         }
 
-        const ConstPool::Item* ConstPool::_getEntry(ConstPool::Index i) const {
+        void ConstPool::_buildUtf8Index() {
+            _utf8Index.built = true;
+
+            // A pool holds up to 65536 entries, so the last index does not fit
+            // the loop bound in an Index.
+            for (u4 i = 1; i < tags.size(); i++) {
+                if (tags[i] == UTF8) {
+                    const Utf8& str = _getUtf8((Index) i);
+                    _utf8Index.insert(_hash(str.bytes(), str.length()), (Index) i);
+                }
+            }
+        }
+
+        void ConstPool::_buildClassIndex() {
+            _classIndex.built = true;
+
+            for (u4 i = 1; i < tags.size(); i++) {
+                if (tags[i] == CLASS) {
+                    _classIndex.insert(_classHash((Index) i), (Index) i);
+                }
+            }
+        }
+
+        void ConstPool::_buildValueIndex() {
+            _valueIndex.built = true;
+
+            for (u4 i = 1; i < tags.size(); i++) {
+                if (_isValue((Tag) tags[i])) {
+                    _valueIndex.insert(_valueHash((Tag) tags[i], values[i]), (Index) i);
+                }
+            }
+        }
+
+        void ConstPool::IndexTable::insert(u4 hash, Index index) {
+            if ((count + 1) * 4 > slots.size() * 3) {
+                vector<Slot> old;
+                old.swap(slots);
+                slots.resize(old.empty() ? 64 : old.size() * 2, Slot({0, NULLENTRY}));
+                count = 0;
+
+                for (const Slot& slot : old) {
+                    if (slot.index != NULLENTRY) {
+                        insert(slot.hash, slot.index);
+                    }
+                }
+            }
+
+            u4 mask = slots.size() - 1;
+            u4 i = hash & mask;
+            while (slots[i].index != NULLENTRY) {
+                i = (i + 1) & mask;
+            }
+
+            slots[i] = {hash, index};
+            count++;
+        }
+
+        vector<ConstPool::Index> ConstPool::_compact(vector<bool>& live) {
+            live.resize(tags.size(), false);
+
+            // Marks the entries referenced by live entries.
+            // Counts in u4, as a full pool ends past the last Index.
+            vector<Index> work;
+            for (u4 i = 1; i < tags.size(); i++) {
+                if (live[i]) {
+                    work.push_back((Index) i);
+                }
+            }
+
+            auto mark = [&](Index ref) {
+                if (ref != NULLENTRY && !live[ref]) {
+                    live[ref] = true;
+                    work.push_back(ref);
+                }
+            };
+
+            while (!work.empty()) {
+                Index i = work.back();
+                work.pop_back();
+
+                const Value& v = values[i];
+                switch (tags[i]) {
+                    case CLASS:
+                        mark(v.clazz.nameIndex);
+                        break;
+                    case FIELDREF:
+                    case METHODREF:
+                    case INTERMETHODREF:
+                        mark(v.memberRef.classIndex);
+                        mark(v.memberRef.nameAndTypeIndex);
+                        break;
+                    case STRING:
+                        mark(v.s.stringIndex);
+                        break;
+                    case NAMEANDTYPE:
+                        mark(v.nameAndType.nameIndex);
+                        mark(v.nameAndType.descriptorIndex);
+                        break;
+                    case METHODHANDLE:
+                        mark(v.methodHandle.referenceIndex);
+                        break;
+                    case METHODTYPE:
+                        mark(v.methodType.descriptorIndex);
+                        break;
+                    case INVOKEDYNAMIC:
+                        mark(v.invokeDynamic.nameAndTypeIndex);
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            vector<Index> map(tags.size(), NULLENTRY);
+            u4 next = 1;
+            for (u4 i = 1; i < tags.size(); i++) {
+                if (live[i]) {
+                    map[i] = (Index) next;
+                    next += _isDoubleEntry((Index) i) ? 2 : 1;
+                }
+            }
+
+            vector<u1> oldTags;
+            vector<Value> oldValues;
+            vector<Utf8> oldUtf8s;
+            oldTags.swap(tags);
+            oldValues.swap(values);
+            oldUtf8s.swap(utf8s);
+
+            tags.reserve(next);
+            values.reserve(next);
+            tags.push_back(NULLENTRY);
+            values.emplace_back();
+
+            for (u4 i = 1; i < oldTags.size(); i++) {
+                if (!live[i]) {
+                    continue;
+                }
+
+                const Value& v = oldValues[i];
+                Tag tag = (Tag) oldTags[i];
+                switch (tag) {
+                    case CLASS:
+                        tags.push_back(tag);
+                        values.push_back(Class({map[v.clazz.nameIndex]}));
+                        break;
+                    case FIELDREF:
+                    case METHODREF:
+                    case INTERMETHODREF:
+                        tags.push_back(tag);
+                        values.push_back(MemberRef({map[v.memberRef.classIndex],
+                                                    map[v.memberRef.nameAndTypeIndex]}));
+                        break;
+                    case STRING:
+                        tags.push_back(tag);
+                        values.push_back(String({map[v.s.stringIndex]}));
+                        break;
+                    case NAMEANDTYPE:
+                        tags.push_back(tag);
+                        values.push_back(NameAndType({map[v.nameAndType.nameIndex],
+                                                      map[v.nameAndType.descriptorIndex]}));
+                        break;
+                    case METHODHANDLE:
+                        tags.push_back(tag);
+                        values.push_back(MethodHandle({v.methodHandle.referenceKind,
+                                                       map[v.methodHandle.referenceIndex]}));
+                        break;
+                    case METHODTYPE:
+                        tags.push_back(tag);
+                        values.push_back(MethodType({map[v.methodType.descriptorIndex]}));
+                        break;
+                    case INVOKEDYNAMIC:
+                        tags.push_back(tag);
+                        values.push_back(InvokeDynamic({v.invokeDynamic.bootstrapMethodAttrIndex,
+                                                        map[v.invokeDynamic.nameAndTypeIndex]}));
+                        break;
+                    case UTF8:
+                        utf8s.push_back(oldUtf8s[v.utf8Index]);
+                        tags.push_back(tag);
+                        values.push_back(Value(utf8s.size() - 1));
+                        break;
+                    case LONG:
+                    case DOUBLE:
+                        tags.push_back(tag);
+                        values.push_back(v);
+                        tags.push_back(NULLENTRY);
+                        values.emplace_back();
+                        break;
+                    default:
+                        tags.push_back(tag);
+                        values.push_back(v);
+                        break;
+                }
+            }
+
+            _utf8Index = IndexTable();
+            _classIndex = IndexTable();
+            _valueIndex = IndexTable();
+            _classSymbols.clear();
+            _source = nullptr;
+            _sourceLen = 0;
+            _sourceCount = 0;
+            modified = true;
+
+            return map;
+        }
+
+        void ConstPool::_copy(const ConstPool& source) {
+            tags = source.tags;
+            vector<Value>(source.values).swap(values);
+            utf8s = source.utf8s;
+
+            for (Utf8& utf8 : utf8s) {
+                if (!utf8.borrowed) {
+                    char* str = (char*) _utf8Arena.alloc(utf8.len + 1);
+                    memcpy(str, utf8.data, utf8.len);
+                    str[utf8.len] = '\0';
+
+                    utf8.data = str;
+                }
+            }
+
+            _utf8Index = IndexTable();
+            _classIndex = IndexTable();
+            _valueIndex = IndexTable();
+            _classSymbols = source._classSymbols;
+            _source = source._source;
+            _sourceLen = source._sourceLen;
+            _sourceCount = source._sourceCount;
+            modified = source.modified;
+        }
+
+        ClassNames::Symbol ConstPool::getClassSymbol(ConstPool::Index classIndex) const {
+            Index classNameIndex = getClassNameIndex(classIndex);
+
+            if (classIndex >= _classSymbols.size()) {
+                _classSymbols.resize(values.size(), ClassNames::NONE);
+            }
+
+            ClassNames::Symbol& symbol = _classSymbols[classIndex];
+            if (symbol == ClassNames::NONE) {
+                const Utf8& className = _getUtf8(classNameIndex);
+                symbol = ClassNames::intern(className.bytes(), className.length());
+            }
+
+            return symbol;
+        }
+
+        const char* ConstPool::getUtf8(ConstPool::Index utf8Index) const {
+            Utf8& utf8 = utf8s[_getEntry(utf8Index, UTF8, "Utf8")->utf8Index];
+            if (utf8.borrowed) {
+                char* str = (char*) _utf8Arena.alloc(utf8.len + 1);
+                memcpy(str, utf8.data, utf8.len);
+                str[utf8.len] = '\0';
+
+                utf8.data = str;
+                utf8.borrowed = false;
+            }
+
+            return utf8.data;
+        }
+
+        const ConstPool::Value* ConstPool::_getEntry(ConstPool::Index i) const {
             JnifError::check(i > NULLENTRY, "Null access to constant pool: index=", i);
-            JnifError::check(i < entries.size(), "Index out of bounds: index=", i);
+            JnifError::check(i < tags.size(), "Index out of bounds: index=", i);
 
-            const Item* entry = &entries[i];
-            return entry;
+            return &values[i];
+        }
+
+        ConstPool::Item::Item(Tag tag, const Value& value, const Utf8& utf8) : tag(tag), utf8(utf8) {
+            memcpy((void*) &clazz, &value, sizeof(Value));
         }
 
-        const ConstPool::Item* ConstPool::_getEntry(
+        ConstPool::Item ConstPool::_item(ConstPool::Index index) const {
+            JnifError::check(index < tags.size(), "Index out of bounds: index=", index);
+
+            Tag tag = (Tag) tags[index];
+            const Value& value = values[index];
+            if (tag == UTF8) {
+                return Item(tag, value, utf8s[value.utf8Index]);
+            }
+
+            return Item(tag, value, Utf8{"", 0, false});
+        }
+
+        const ConstPool::Value* ConstPool::_getEntry(
                 ConstPool::Index index, u1 tag, const char* message) const {
-            const Item* entry = _getEntry(index);
-            JnifError::check(entry->tag == tag, "Invalid constant ", message,
-                             ", expected: ", (int) tag, ", actual: ", (int) entry->tag);
+            const Value* entry = _getEntry(index);
+            JnifError::check(tags[index] == tag, "Invalid constant ", message,
+                             ", expected: ", (int) tag, ", actual: ", (int) tags[index]);
 
             return entry;
         }
@@ -216,11 +672,12 @@ namespace jnif {
         }
 
         Member::Member(u2 accessFlags, ConstPool::Index nameIndex, ConstPool::Index descIndex,
-                       const ConstPool &constPool) :
+                       const ConstPool &constPool, Arena* arena) :
                 accessFlags(accessFlags),
                 nameIndex(nameIndex),
                 descIndex(descIndex),
                 constPool(constPool),
+                attrs(arena),
                 sig(&attrs) {
             JnifError::check(constPool.isUtf8(nameIndex));
             JnifError::check(constPool.isUtf8(descIndex));
@@ -248,22 +705,55 @@ namespace jnif {
         }
 
         InstList &Method::instList() {
+            CodeAttr* code = codeAttr();
+            if (code != nullptr) {
+                return code->instList;
+            }
+
+            throw Exception("ERROR! get inst list");
+        }
+
+        bool Method::isModified() const {
+            if (attrs.isModified()) {
+                return true;
+            }
+
+            for (Attr* attr : attrs) {
+                if (attr->kind == ATTR_CODE && ((CodeAttr*) attr)->isModified()) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void Method::setModified(bool modified) {
+            attrs.setModified(modified);
+
             for (Attr* attr : attrs) {
                 if (attr->kind == ATTR_CODE) {
-                    return ((CodeAttr*) attr)->instList;
+                    ((CodeAttr*) attr)->setModified(modified);
                 }
             }
+        }
 
-            throw Exception("ERROR! get inst list");
+        ClassFile::ClassFile() :
+                interfaces(_create<ArenaList<ConstPool::Index> >()), fields(_create<ArenaList<Field> >()),
+                methods(_create<ArenaList<Method> >()), attrs(_create<Attrs>()), sig(&attrs) {
         }
 
-        ClassFile::ClassFile() : sig(&attrs) {
+        ClassFile::ClassFile(ArenaPool* pool) :
+                _arena(Arena::INITIAL_BLOCK_SIZE, pool),
+                interfaces(_create<ArenaList<ConstPool::Index> >()), fields(_create<ArenaList<Field> >()),
+                methods(_create<ArenaList<Method> >()), attrs(_create<Attrs>()), sig(&attrs) {
         }
 
         ClassFile::ClassFile(const char* className, const char* superClassName, u2 accessFlags, Version version)
                 : thisClassIndex(addClass(className)), superClassIndex(addClass(superClassName)),
                   accessFlags(accessFlags),
-                  version(version), sig(&attrs) {
+                  version(version),
+                  interfaces(_create<ArenaList<ConstPool::Index> >()), fields(_create<ArenaList<Field> >()),
+                  methods(_create<ArenaList<Method> >()), attrs(_create<Attrs>()), sig(&attrs) {
         }
 
         const char* ClassFile::getThisClassName() const {
@@ -275,16 +765,62 @@ namespace jnif {
         }
 
         Field &ClassFile::addField(ConstPool::Index nameIndex, ConstPool::Index descIndex, u2 accessFlags) {
-            fields.emplace_back(accessFlags, nameIndex, descIndex, *this);
+            fields.emplace_back(accessFlags, nameIndex, descIndex, *this, &_arena);
+            modified = true;
+
+            if (_fieldTable.table.built) {
+                _indexMember(_fieldTable, &fields.back());
+            }
+
             return fields.back();
         }
 
         Method &ClassFile::addMethod(ConstPool::Index nameIndex, ConstPool::Index descIndex, u2 accessFlags) {
-            methods.emplace_back(accessFlags, nameIndex, descIndex, *this);
+            methods.emplace_back(accessFlags, nameIndex, descIndex, *this, &_arena);
+            modified = true;
+
+            if (_methodTable.table.built) {
+                _indexMember(_methodTable, &methods.back());
+            }
+
             return methods.back();
         }
 
-        list<Method>::iterator ClassFile::getMethod(const char* methodName) {
+        bool ClassFile::isModified() const {
+            if (modified || ConstPool::isModified() || attrs.isModified()) {
+                return true;
+            }
+
+            for (const Field& field : fields) {
+                if (field.isModified()) {
+                    return true;
+                }
+            }
+
+            for (const Method& method : methods) {
+                if (method.isModified()) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void ClassFile::setModified(bool modified) {
+            this->modified = modified;
+            ConstPool::setModified(modified);
+            attrs.setModified(modified);
+
+            for (Field& field : fields) {
+                field.attrs.setModified(modified);
+            }
+
+            for (Method& method : methods) {
+                method.setModified(modified);
+            }
+        }
+
+        ArenaList<Method>::iterator ClassFile::getMethod(const char* methodName) {
             for (auto it = methods.begin(); it != methods.end(); it++) {
                 if (it->getName() == string(methodName)) {
                     return it;
@@ -294,6 +830,68 @@ namespace jnif {
             return methods.end();
         }
 
+        InstSummary ClassFile::summary() const {
+            InstSummary summary;
+            for (const Method& method : methods) {
+                const InstSummary* methodSummary = method.summary();
+                if (methodSummary != nullptr) {
+                    summary.add(*methodSummary);
+                }
+            }
+
+            return summary;
+        }
+
+        Field* ClassFile::findField(const char* fieldName, const char* fieldDesc) {
+            if (!_fieldTable.table.built) {
+                _fieldTable.table.built = true;
+                for (Field& field : fields) {
+                    _indexMember(_fieldTable, &field);
+                }
+            }
+
+            return (Field*) _findMember(_fieldTable, fieldName, fieldDesc);
+        }
+
+        Method* ClassFile::findMethod(const char* methodName, const char* methodDesc) {
+            if (!_methodTable.table.built) {
+                _methodTable.table.built = true;
+                for (Method& method : methods) {
+                    _indexMember(_methodTable, &method);
+                }
+            }
+
+            return (Method*) _findMember(_methodTable, methodName, methodDesc);
+        }
+
+        static u4 _combineHash(u4 nameHash, u4 descHash) {
+            return nameHash * 31 + descHash;
+        }
+
+        u4 ClassFile::_memberHash(const Member& member) const {
+            const Utf8& name = getUtf8Entry(member.nameIndex);
+            const Utf8& desc = getUtf8Entry(member.descIndex);
+
+            return _combineHash(_hash(name.bytes(), name.length()), _hash(desc.bytes(), desc.length()));
+        }
+
+        void ClassFile::_indexMember(MemberTable& table, Member* member) {
+            JnifError::check(table.members.size() < 0xffff, "Too many members: ", table.members.size());
+
+            table.members.push_back(member);
+            table.table.insert(_memberHash(*member), table.members.size());
+        }
+
+        Member* ClassFile::_findMember(MemberTable& table, const char* name, const char* desc) const {
+            u4 hash = _combineHash(_hash(name, strlen(name)), _hash(desc, strlen(desc)));
+            Index i = table.table.find(hash, [&](Index i) {
+                Member* member = table.members[i - 1];
+                return strcmp(member->getName(), name) == 0 && strcmp(member->getDesc(), desc) == 0;
+            });
+
+            return i == NULLENTRY ? nullptr : table.members[i - 1];
+        }
+
         static std::ostream &dotFrame(std::ostream &os, const Frame &frame) {
             os << " LVA: ";
             for (u4 i = 0; i < frame.lva.size(); i++) {
@@ -304,8 +902,8 @@ namespace jnif {
 
             os << " STACK: ";
             int i = 0;
-            for (auto t : frame.stack) {
-                os << (i == 0 ? "" : "\n  ") << t.first;
+            for (auto t = frame.stack.rbegin(); t != frame.stack.rend(); ++t) {
+                os << (i == 0 ? "" : "\n  ") << t->first;
                 i++;
             }
             return os << " ";
@@ -314,7 +912,7 @@ namespace jnif {
         static void dotCfg(std::ostream &os, const ControlFlowGraph &cfg, int mid) {
 
             for (BasicBlock* bb : cfg) {
-                os << "    m" << mid << bb->name << " [ label = \"<port0> " << bb->name;
+                os << "    m" << mid << bb->name() << " [ label = \"<port0> " << bb->name();
                 os << " |{ ";
                 dotFrame(os, bb->in);
                 os << " | ";
@@ -333,7 +931,7 @@ namespace jnif {
 
             for (BasicBlock* bb : cfg) {
                 for (BasicBlock* bbt : *bb) {
-                    os << "    m" << mid << bb->name << " -> m" << mid << bbt->name
+                    os << "    m" << mid << bb->name() << " -> m" << mid << bbt->name()
                        << "" << std::endl;
                 }
             }
@@ -369,43 +967,14 @@ namespace jnif {
             JnifError::assert(cond, "Inst is not a ", kindName, ": ", *this);
         }
 
-
-        Inst* InstList::Iterator::operator*() {
-            JnifError::assert(position != nullptr, "Dereferencing * on NULL");
-            return position;
+        Arena* Inst::arena() const {
+            // Instructions are only created by the InstList of a class file.
+            return &((ClassFile*) constPool)->_arena;
         }
 
-        Inst* InstList::Iterator::operator->() const {
-            JnifError::assert(position != nullptr, "Dereferencing -> on NULL");
-
-            return position;
-        }
-
-        InstList::Iterator &InstList::Iterator::operator++() {
-            JnifError::assert(position != nullptr, "Doing ++ at NULL");
-            position = position->next;
-
-            return *this;
-        }
-
-        InstList::Iterator &InstList::Iterator::operator--() {
-            if (position == nullptr) {
-                position = last;
-            } else {
-                position = position->prev;
-            }
-
-            JnifError::assert(position != nullptr, "Doing -- at NULL after last");
-
-            return *this;
-        }
-
-        InstList::~InstList() {
-            for (Inst* inst = first; inst != nullptr;) {
-                Inst* next = inst->next;
-                inst->~Inst();
-                inst = next;
-            }
+        InstList::InstList(ClassFile* arena) :
+                constPool(arena), first(nullptr), last(nullptr), _size(0), nextLabelId(1), branchesCount(0),
+                jsrOrRet(false), modified(true), _offsetIndex(&arena->_arena) {
         }
 
         LabelInst* InstList::createLabel() {
@@ -546,7 +1115,7 @@ namespace jnif {
         }
 
         TableSwitchInst* InstList::addTableSwitch(LabelInst* def, int low, int high, Inst* pos) {
-            TableSwitchInst* inst = _create<TableSwitchInst>(def, low, high, constPool);
+            TableSwitchInst* inst = _create<TableSwitchInst>(def, low, high, constPool, &constPool->_arena);
             addInst(inst, pos);
             branchesCount++;
 
@@ -556,7 +1125,7 @@ namespace jnif {
         }
 
         LookupSwitchInst* InstList::addLookupSwitch(LabelInst* def, u4 npairs, Inst* pos) {
-            LookupSwitchInst* inst = _create<LookupSwitchInst>(def, npairs, constPool);
+            LookupSwitchInst* inst = _create<LookupSwitchInst>(def, npairs, constPool, &constPool->_arena);
             addInst(inst, pos);
             branchesCount++;
 
@@ -566,18 +1135,83 @@ namespace jnif {
         }
 
         Inst* InstList::getInst(int offset) {
+            if (_offsetIndex.empty()) {
+                _buildOffsetIndex();
+            }
+
+            if (offset < 0 || (size_t) offset >= _offsetIndex.size()) {
+                return nullptr;
+            }
+
+            return _offsetIndex[offset];
+        }
+
+        void InstList::_buildOffsetIndex() {
+            int maxOffset = 0;
+            for (Inst* inst : *this) {
+                maxOffset = std::max(maxOffset, inst->_offset);
+            }
+
+            _offsetIndex.assign(maxOffset + 1, nullptr);
+
             for (Inst* inst : *this) {
-                if (inst->_offset == offset && !inst->isLabel()) {
-                    return inst;
+                // Keeps the first instruction when offsets are stale.
+                if (!inst->isLabel() && inst->_offset >= 0 && _offsetIndex[inst->_offset] == nullptr) {
+                    _offsetIndex[inst->_offset] = inst;
                 }
             }
+        }
+
+        constexpr size_t InstList::RECORD_SIZE;
+
+        u4 InstList::_indexOf(const Inst* inst) const {
+            u4 slot = inst->_pos;
+            JnifError::assert(slot < _capacity && _order[slot] == inst,
+                              "Instruction is not in this list: ", *inst);
+
+            return slot < _gapStart ? slot : slot - (_gapEnd - _gapStart);
+        }
+
+        void InstList::_moveGap(u4 index) {
+            while (index < _gapStart) {
+                Inst* inst = _order[--_gapStart];
+                _order[--_gapEnd] = inst;
+                inst->_pos = _gapEnd;
+            }
+
+            while (index > _gapStart) {
+                Inst* inst = _order[_gapEnd++];
+                _order[_gapStart] = inst;
+                inst->_pos = _gapStart++;
+            }
+        }
 
-            return nullptr;
+        void InstList::_grow() {
+            u4 capacity = std::max<u4>(_capacity * 2, 16);
+            Inst** order = (Inst**) constPool->_arena.alloc(capacity * sizeof(Inst*), alignof(Inst*));
+
+            u4 tail = _capacity - _gapEnd;
+            std::copy(_order, _order + _gapStart, order);
+            std::copy(_order + _gapEnd, _order + _capacity, order + capacity - tail);
+
+            for (u4 slot = capacity - tail; slot < capacity; slot++) {
+                order[slot]->_pos = slot;
+            }
+
+            _order = order;
+            _gapEnd = capacity - tail;
+            _capacity = capacity;
         }
 
-        template<typename TInst, typename ... TArgs>
-        TInst* InstList::_create(const TArgs &... args) {
-            return constPool->_arena.create<TInst>(args ...);
+        void InstList::_insertAt(u4 index, Inst* inst) {
+            if (_gapStart == _gapEnd) {
+                _grow();
+            }
+
+            _moveGap(index);
+
+            _order[_gapStart] = inst;
+            inst->_pos = _gapStart++;
         }
 
         void InstList::addInst(Inst* inst, Inst* pos) {
@@ -589,6 +1223,12 @@ namespace jnif {
                               "Invalid head/tail/size: head: ", first, ", tail: ", last,
                               ", size: ", _size);
 
+            modified = true;
+            _offsetIndex.clear();
+            _summary.add(inst->opcode, inst->kind);
+
+            _insertAt(pos == nullptr ? _size : _indexOf(pos), inst);
+
             Inst* p;
             Inst* n;
             if (first == nullptr) {
@@ -628,6 +1268,197 @@ namespace jnif {
         }
 
 
+        namespace {
+
+            /**
+             * The table behind ClassNames.
+             * Names are kept in chunks that never move, so a symbol is
+             * resolved without locking.
+             * A name is written before its chunk and the count of names are
+             * published, so a reader that sees a symbol below the count also
+             * sees its name.
+             */
+            class ClassNameTable {
+            public:
+
+                ClassNameTable() {
+                    // In the order of the ClassNames constants.
+                    for (const char* name : {"", "java/lang/Object", "java/lang/String", "java/lang/Throwable"}) {
+                        _add(name, strlen(name), _hash(name, strlen(name)));
+                    }
+                }
+
+                ClassNames::Symbol intern(const char* name, size_t len) {
+                    u4 hash = _hash(name, len);
+
+                    std::lock_guard<std::mutex> lock(_mutex);
+
+                    ClassNames::Symbol symbol = _find(name, len, hash);
+                    return symbol != ClassNames::NONE ? symbol : _add(name, len, hash);
+                }
+
+                ClassNames::Symbol find(const char* name, size_t len) {
+                    u4 hash = _hash(name, len);
+
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    return _find(name, len, hash);
+                }
+
+                const string& name(ClassNames::Symbol symbol) const {
+                    JnifError::check(symbol < _count.load(std::memory_order_acquire),
+                                     "Invalid class name symbol: ", symbol);
+
+                    const string* chunk = _chunks[symbol >> CHUNK_BITS].load(std::memory_order_acquire);
+                    return chunk[symbol & (CHUNK_SIZE - 1)];
+                }
+
+            private:
+
+                static const u4 CHUNK_BITS = 12;
+
+                static const u4 CHUNK_SIZE = 1 << CHUNK_BITS;
+
+                static const u4 MAX_CHUNKS = 1 << 12;
+
+                struct Slot {
+                    u4 hash;
+                    ClassNames::Symbol symbol;
+                };
+
+                static u4 _hash(const char* str, size_t len) {
+                    // FNV-1a
+                    u4 hash = 2166136261u;
+                    for (size_t i = 0; i < len; i++) {
+                        hash ^= (u1) str[i];
+                        hash *= 16777619u;
+                    }
+
+                    return hash;
+                }
+
+                /**
+                 * The empty name is NONE, and it is never in the slots.
+                 */
+                ClassNames::Symbol _find(const char* str, size_t len, u4 hash) const {
+                    if (len == 0 || _slots.empty()) {
+                        return ClassNames::NONE;
+                    }
+
+                    u4 mask = _slots.size() - 1;
+                    for (u4 i = hash & mask; _slots[i].symbol != ClassNames::NONE; i = (i + 1) & mask) {
+                        if (_slots[i].hash == hash) {
+                            const string& other = name(_slots[i].symbol);
+                            if (other.size() == len && memcmp(other.data(), str, len) == 0) {
+                                return _slots[i].symbol;
+                            }
+                        }
+                    }
+
+                    return ClassNames::NONE;
+                }
+
+                ClassNames::Symbol _add(const char* name, size_t len, u4 hash) {
+                    ClassNames::Symbol symbol = _count.load(std::memory_order_relaxed);
+
+                    u4 index = symbol >> CHUNK_BITS;
+                    JnifError::check(index < MAX_CHUNKS, "Too many class names");
+
+                    string* chunk = _chunks[index].load(std::memory_order_relaxed);
+                    if (chunk == nullptr) {
+                        chunk = new string[CHUNK_SIZE];
+                        _chunks[index].store(chunk, std::memory_order_release);
+                    }
+
+                    chunk[symbol & (CHUNK_SIZE - 1)].assign(name, len);
+                    _count.store(symbol + 1, std::memory_order_release);
+
+                    if (len == 0) {
+                        return symbol;
+                    }
+
+                    if ((_used + 1) * 2 > _slots.size()) {
+                        vector<Slot> slots(_slots.empty() ? 1024 : _slots.size() * 2, Slot{0, ClassNames::NONE});
+                        _slots.swap(slots);
+
+                        for (const Slot& slot : slots) {
+                            if (slot.symbol != ClassNames::NONE) {
+                                _insert(slot);
+                            }
+                        }
+                    }
+
+                    _insert({hash, symbol});
+                    _used++;
+
+                    return symbol;
+                }
+
+                void _insert(const Slot& slot) {
+                    u4 mask = _slots.size() - 1;
+                    u4 i = slot.hash & mask;
+                    while (_slots[i].symbol != ClassNames::NONE) {
+                        i = (i + 1) & mask;
+                    }
+
+                    _slots[i] = slot;
+                }
+
+                std::mutex _mutex;
+
+                std::atomic<string*> _chunks[MAX_CHUNKS] = {};
+
+                std::atomic<ClassNames::Symbol> _count{0};
+
+                vector<Slot> _slots;
+
+                u4 _used = 0;
+            };
+
+            ClassNameTable& classNameTable() {
+                static ClassNameTable table;
+                return table;
+            }
+
+            /**
+             * The descriptor of each primitive tag, to name arrays of them.
+             */
+            const char* primitiveDesc(TypeTag tag) {
+                switch (tag) {
+                    case TYPE_INTEGER:
+                        return "I";
+                    case TYPE_FLOAT:
+                        return "F";
+                    case TYPE_LONG:
+                        return "J";
+                    case TYPE_DOUBLE:
+                        return "D";
+                    case TYPE_BOOLEAN:
+                        return "Z";
+                    case TYPE_BYTE:
+                        return "B";
+                    case TYPE_CHAR:
+                        return "C";
+                    case TYPE_SHORT:
+                        return "S";
+                    default:
+                        return "";
+                }
+            }
+
+        }
+
+        ClassNames::Symbol ClassNames::intern(const char* name, size_t len) {
+            return classNameTable().intern(name, len);
+        }
+
+        ClassNames::Symbol ClassNames::find(const char* name, size_t len) {
+            return classNameTable().find(name, len);
+        }
+
+        const string& ClassNames::name(ClassNames::Symbol symbol) {
+            return classNameTable().name(symbol);
+        }
+
         u2 Type::getCpIndex() const {
             JnifError::check(isObject(), "Type is not object type to get cp index: ",
                              *this);
@@ -639,26 +1470,26 @@ namespace jnif {
                              *this);
             if (isArray()) {
                 stringstream ss;
-                for (u4 i = 0; i < dims; i++) {
+                for (u4 i = 0; i < getDims(); i++) {
                     ss << "[";
                 }
 
-                if (tag == TYPE_OBJECT) {
-                    ss << "L" << className << ";";
+                if (getTag() == TYPE_OBJECT) {
+                    ss << "L" << ClassNames::name(getClassSymbol()) << ";";
                 } else {
-                    ss << className;
+                    ss << primitiveDesc(getTag());
                 }
 
                 return ss.str();
             } else {
-                return className;
+                return ClassNames::name(getClassSymbol());
             }
         }
 
         Type Type::elementType() const {
             JnifError::check(isArray(), "Type is not array: ", *this);
 
-            Type type = Type(*this, dims - 1);
+            Type type = Type(*this, getDims() - 1);
             return type;
         }
 
@@ -675,6 +1506,10 @@ namespace jnif {
             return Type(TYPE_UNINITTHIS);
         }
 
+        Type TypeFactory::uninitThisType(ClassNames::Symbol className) {
+            return Type(TYPE_UNINITTHIS, className);
+        }
+
         Type TypeFactory::uninitType(short offset, class Inst* label) {
             return Type(TYPE_UNINIT, offset, label);
         }
@@ -684,6 +1519,14 @@ namespace jnif {
                     !className.empty(),
                     "Expected non-empty class name for object type");
 
+            return objectType(ClassNames::intern(className), cpindex);
+        }
+
+        Type TypeFactory::objectType(ClassNames::Symbol className, u2 cpindex) {
+            JnifError::check(
+                    className != ClassNames::NONE,
+                    "Expected non-empty class name for object type");
+
             return Type(TYPE_OBJECT, className, cpindex);
         }
 
@@ -712,6 +1555,19 @@ namespace jnif {
             }
         }
 
+        Type TypeFactory::fromConstClass(const ConstPool& cp, ConstPool::Index classIndex) {
+            const char* className = cp.getClassName(classIndex);
+            JnifError::assert(className[0] != '\0', "Invalid string class");
+
+            if (className[0] == '[') {
+                const Type& arrayType = fromFieldDesc(className);
+                JnifError::assert(arrayType.isArray(), "Not an array: ", arrayType);
+                return arrayType;
+            } else {
+                return objectType(cp.getClassSymbol(classIndex));
+            }
+        }
+
         Type TypeFactory::_parseBaseType(const char*&fieldDesc,
                                          const char* originalFieldDesc) {
             switch (*fieldDesc) {
@@ -742,8 +1598,7 @@ namespace jnif {
                         len++;
                     }
 
-                    string className(classNameStart, len);
-                    return objectType(className);
+                    return objectType(ClassNames::intern(classNameStart, len));
                 }
                 default:
                     throw Exception("Invalid field desc ", originalFieldDesc);
@@ -822,28 +1677,32 @@ namespace jnif {
         }
 
         Type TypeFactory::_topType(TYPE_TOP);
-        Type TypeFactory::_intType(TYPE_INTEGER, "I");
-        Type TypeFactory::_floatType(TYPE_FLOAT, "F");
-        Type TypeFactory::_longType(TYPE_LONG, "J");
-        Type TypeFactory::_doubleType(TYPE_DOUBLE, "D");
-        Type TypeFactory::_booleanType(TYPE_BOOLEAN, "Z");
-        Type TypeFactory::_byteType(TYPE_BYTE, "B");
-        Type TypeFactory::_charType(TYPE_CHAR, "C");
-        Type TypeFactory::_shortType(TYPE_SHORT, "S");
+        Type TypeFactory::_intType(TYPE_INTEGER);
+        Type TypeFactory::_floatType(TYPE_FLOAT);
+        Type TypeFactory::_longType(TYPE_LONG);
+        Type TypeFactory::_doubleType(TYPE_DOUBLE);
+        Type TypeFactory::_booleanType(TYPE_BOOLEAN);
+        Type TypeFactory::_byteType(TYPE_BYTE);
+        Type TypeFactory::_charType(TYPE_CHAR);
+        Type TypeFactory::_shortType(TYPE_SHORT);
         Type TypeFactory::_nullType(TYPE_NULL);
         Type TypeFactory::_voidType(TYPE_VOID);
 
 
-        Attrs::~Attrs() {
+        void Attrs::_buildKindIndex() {
+            for (Attr*& attr : _byKind) {
+                attr = nullptr;
+            }
+
             for (Attr* attr : attrs) {
-                attr->~Attr();
+                if (_byKind[attr->kind] == nullptr) {
+                    _byKind[attr->kind] = attr;
+                }
             }
         }
 
-        CodeAttr::~CodeAttr() {
-            if (cfg != nullptr) {
-                delete cfg;
-            }
+        Arena* Attr::arena() const {
+            return constPool == nullptr ? nullptr : &constPool->_arena;
         }
 
         const char* SignatureAttr::signature() const {
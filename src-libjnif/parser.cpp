@@ -1,6 +1,8 @@
 
 #include "jnif.hpp"
 
+#include <cstring>
+
 namespace jnif {
 
     namespace parser {
@@ -109,7 +111,16 @@ namespace jnif {
         struct ConstPoolParser {
 
             void parse(BufferReader *br, ConstPool *cp) {
+                parse(br, cp, false);
+            }
+
+        protected:
+
+            void parse(BufferReader *br, ConstPool *cp, bool borrowUtf8) {
                 u2 count = br->readu2();
+                const u1 *source = br->pos();
+
+                cp->reserve(count);
 
                 for (int i = 1; i < count; i++) {
                     u1 tag = br->readu1();
@@ -179,7 +190,11 @@ namespace jnif {
                         }
                         case ConstPool::UTF8: {
                             u2 len = br->readu2();
-                            cp->addUtf8((const char *) br->pos(), len);
+                            if (borrowUtf8) {
+                                cp->addUtf8View((const char *) br->pos(), len);
+                            } else {
+                                cp->addUtf8((const char *) br->pos(), len);
+                            }
                             br->skip(len);
                             break;
                         }
@@ -204,6 +219,23 @@ namespace jnif {
                             throw Exception("Error while reading tag: ", tag);
                     }
                 }
+
+                if (borrowUtf8) {
+                    cp->_source = source;
+                    cp->_sourceLen = br->pos() - source;
+                    cp->_sourceCount = count;
+                }
+            }
+        };
+
+        /**
+         * Parses the constant pool borrowing the UTF8 constants and the
+         * encoded entries from the class file buffer.
+         */
+        struct LazyConstPoolParser : ConstPoolParser {
+
+            void parse(BufferReader *br, ConstPool *cp) {
+                ConstPoolParser::parse(br, cp, true);
             }
         };
 
@@ -241,6 +273,7 @@ namespace jnif {
             template<class... TArgs>
             void parse(BufferReader *br, ClassFile *cp, Attrs *as, TArgs... args) {
                 u2 attrCount = br->readu2();
+                as->reserve(as->size() + attrCount);
 
                 for (int i = 0; i < attrCount; i++) {
                     u2 nameIndex = br->readu2();
@@ -384,6 +417,7 @@ namespace jnif {
                 u2 lntlen = br->readu2();
 
                 LntAttr *lnt = cp->_arena.create<LntAttr>(nameIndex, cp);
+                lnt->lnt.reserve(lntlen);
 
                 for (int i = 0; i < lntlen; i++) {
                     LntAttr::LnEntry e;
@@ -437,6 +471,7 @@ namespace jnif {
                 u2 count = br->readu2();
 
                 LvtAttr *lvt = cp->_arena.create<LvtAttr>(ATTR_LVTT, nameIndex, cp);
+                lvt->lvt.reserve(count);
 
                 for (u2 i = 0; i < count; i++) {
                     LvtAttr::LvEntry e;
@@ -486,8 +521,7 @@ namespace jnif {
                     case TYPE_OBJECT: {
                         u2 cpIndex = br->readu2();
                         JnifError::check(cp->isClass(cpIndex), "Bad cpindex: ", cpIndex);
-                        string className = cp->getClassName(cpIndex);
-                        return TypeFactory::objectType(className, cpIndex);
+                        return TypeFactory::objectType(cp->getClassSymbol(cpIndex), cpIndex);
                     }
                     case TYPE_UNINIT: {
                         u2 offset = br->readu2();
@@ -499,7 +533,7 @@ namespace jnif {
                 }
             }
 
-            void parseTs(BufferReader *br, int count, std::vector<Type> &locs,
+            void parseTs(BufferReader *br, int count, ArenaVector<Type> &locs,
                          const ConstPool *cp, LabelManager *labelManager) {
                 for (u1 i = 0; i < count; i++) {
                     Type t = parseType(br, cp, labelManager);
@@ -511,13 +545,16 @@ namespace jnif {
                 SmtAttr *smt = cp->_arena.create<SmtAttr>(nameIndex, cp);
 
                 u2 numberOfEntries = br->readu2();
+                smt->entries.reserve(numberOfEntries);
 
                 int toff = -1;
 
                 for (u2 i = 0; i < numberOfEntries; i++) {
                     u1 frameType = br->readu1();
 
-                    SmtAttr::Entry e;
+                    smt->entries.emplace_back(&cp->_arena);
+
+                    SmtAttr::Entry& e = smt->entries.back();
                     e.frameType = frameType;
 
                     if (0 <= frameType && frameType <= 63) {
@@ -566,8 +603,6 @@ namespace jnif {
                     LabelInst *label = labelManager->createLabel(toff);
 
                     e.label = label;
-
-                    smt->entries.push_back(e);
                 }
 
                 return smt;
@@ -609,6 +644,7 @@ namespace jnif {
                 u2 count = br->readu2();
 
                 LvtAttr *lvt = cp->_arena.create<LvtAttr>(ATTR_LVT, nameIndex, cp);
+                lvt->lvt.reserve(count);
 
                 for (u2 i = 0; i < count; i++) {
                     LvtAttr::LvEntry e;
@@ -849,8 +885,14 @@ namespace jnif {
                     JnifError::assert(low <= high,
                                       "low (%d) must be less or equal than high (%d)", low, high);
 
+                    // The count and the reservation are bounded, as they are
+                    // read from the class file before its targets are.
+                    long long count = (long long) high - low + 1;
+                    size_t left = (br.size() - br.offset()) / 4;
+
                     TableSwitchInst *ts = instList.addTableSwitch(def, low, high);
-                    for (int i = 0; i < high - low + 1; i++) {
+                    ts->targets.reserve(std::min<long long>(count, left));
+                    for (long long i = 0; i < count; i++) {
                         u4 targetOffset = br.readu4();
                         //ts->targets.push_back(labelManager[offset + targetOffset]);
                         ts->addTarget(labelManager[offset + targetOffset]);
@@ -870,6 +912,9 @@ namespace jnif {
                     u4 npairs = br.readu4();
 
                     LookupSwitchInst *ls = instList.addLookupSwitch(defbyte, npairs);
+                    size_t left = (br.size() - br.offset()) / 8;
+                    ls->targets.reserve(std::min<size_t>(npairs, left));
+                    ls->keys.reserve(std::min<size_t>(npairs, left));
                     for (u4 i = 0; i < npairs; i++) {
                         u4 key = br.readu4();
                         u4 offsetTarget = br.readu4();
@@ -937,10 +982,7 @@ namespace jnif {
                 }
             }
 
-            Attr *parse(BufferReader *br, ClassFile *cp, u2 nameIndex) {
-
-                CodeAttr *ca = cp->_arena.create<CodeAttr>(nameIndex, cp);
-
+            void parseHeader(BufferReader *br, CodeAttr *ca) {
                 ca->maxStack = br->readu2();
                 ca->maxLocals = br->readu2();
 
@@ -950,6 +992,10 @@ namespace jnif {
                 JnifError::check(codeLen < (2 << 16), "");
 
                 ca->codeLen = codeLen;
+            }
+
+            void parseBody(BufferReader *br, ClassFile *cp, CodeAttr *ca) {
+                u4 codeLen = ca->codeLen;
 
                 const u1 *codeBuf = br->pos();
                 br->skip(ca->codeLen);
@@ -962,6 +1008,7 @@ namespace jnif {
                 }
 
                 u2 exceptionTableCount = br->readu2();
+                ca->exceptions.reserve(exceptionTableCount);
                 for (int i = 0; i < exceptionTableCount; i++) {
                     u2 startPc = br->readu2();
                     u2 endPc = br->readu2();
@@ -989,6 +1036,45 @@ namespace jnif {
                 }
 
                 labelManager.putLabelIfExists(codeLen);
+            }
+
+            Attr *parse(BufferReader *br, ClassFile *cp, u2 nameIndex) {
+                CodeAttr *ca = cp->_arena.create<CodeAttr>(nameIndex, cp);
+
+                parseHeader(br, ca);
+                parseBody(br, cp, ca);
+
+                return ca;
+            }
+
+        };
+
+/**
+ * Parses the Code attribute of a method without decoding its body.
+ *
+ * Only the header (maxStack, maxLocals and codeLen) is parsed.
+ * The raw bytes of the code, exception table and code attributes are
+ * recorded in the CodeAttr, and decoded on first access to the
+ * Code attribute (see CodeAttr::decode).
+ */
+        template<typename ... TAttrParserList>
+        struct LazyCodeAttrParser : CodeAttrParser<TAttrParserList...> {
+
+            static void decode(CodeAttr *ca) {
+                BufferReader br(ca->_data, ca->_dataLen);
+                CodeAttrParser<TAttrParserList...>().parseBody(&br, ca->constPool, ca);
+            }
+
+            Attr *parse(BufferReader *br, ClassFile *cp, u2 nameIndex) {
+                CodeAttr *ca = cp->_arena.create<CodeAttr>(nameIndex, cp);
+
+                this->parseHeader(br, ca);
+
+                ca->_data = br->pos();
+                ca->_dataLen = br->size() - br->offset();
+                ca->_decoder = &decode;
+
+                JnifError::check(ca->codeLen <= ca->_dataLen, "Invalid code length: ", ca->codeLen);
 
                 return ca;
             }
@@ -1088,19 +1174,20 @@ namespace jnif {
 
         };
 
-        ClassFileParser::ClassFileParser(const u1 *data, u4 len) {
-            parse(data, len, this);
+        ClassFileParser::ClassFileParser(const u1 *data, u4 len, bool lazy, ArenaPool *pool) : ClassFile(pool) {
+            parse(data, len, this, lazy);
         }
 
-        void ClassFileParser::parse(const u1 *data, u4 len, ClassFile *classFile) {
+        template<typename TConstPoolParser, template<typename...> class TCodeAttrParser>
+        static void parseClassFile(const u1 *data, u4 len, ClassFile *classFile) {
             BufferReader br(data, len);
             ClassParser<
-                    ConstPoolParser,
+                    TConstPoolParser,
                     AttrsParser<
                             SourceFileAttrParser,
                             SignatureAttrParser>,
                     AttrsParser<
-                            CodeAttrParser<
+                            TCodeAttrParser<
                                     LineNumberTableAttrParser,
                                     LocalVariableTableAttrParser,
                                     LocalVariableTypeTableAttrParser,
@@ -1113,5 +1200,413 @@ namespace jnif {
             parser.parse(&br, classFile);
         }
 
+        void ClassFileParser::parse(const u1 *data, u4 len, ClassFile *classFile, bool lazy) {
+            // Decoded method bodies take most of the arena, about 8 times the
+            // class file length on average, while lazy parsing takes less
+            // than the class file length.
+            // Larger classes make the arena grow geometrically.
+            classFile->_arena.reserve(lazy ? len : len * 8);
+
+            if (lazy) {
+                parseClassFile<LazyConstPoolParser, LazyCodeAttrParser>(data, len, classFile);
+                classFile->setModified(false);
+            } else {
+                parseClassFile<ConstPoolParser, CodeAttrParser>(data, len, classFile);
+            }
+        }
+
+        /**
+         * Skips the constant pool entry at the position of br,
+         * decoding only its tag, and returns the tag.
+         * Long and double entries take two constant pool slots.
+         */
+        static u1 skipConstEntry(BufferReader *br) {
+            u1 tag = br->readu1();
+
+            switch (tag) {
+                case ConstPool::CLASS:
+                case ConstPool::STRING:
+                case ConstPool::METHODTYPE:
+                    br->skip(2);
+                    break;
+                case ConstPool::METHODHANDLE:
+                    br->skip(3);
+                    break;
+                case ConstPool::FIELDREF:
+                case ConstPool::METHODREF:
+                case ConstPool::INTERMETHODREF:
+                case ConstPool::INTEGER:
+                case ConstPool::FLOAT:
+                case ConstPool::NAMEANDTYPE:
+                case ConstPool::INVOKEDYNAMIC:
+                    br->skip(4);
+                    break;
+                case ConstPool::LONG:
+                case ConstPool::DOUBLE:
+                    br->skip(8);
+                    break;
+                case ConstPool::UTF8:
+                    br->skip(br->readu2());
+                    break;
+                default:
+                    throw Exception("Error while reading tag: ", tag);
+            }
+
+            return tag;
+        }
+
+        void ClassFileView::scan(const u1 *data, u4 len) {
+            _data = data;
+            _len = len;
+            _cp.clear();
+            _fields.clear();
+            _methods.clear();
+            _attrs.clear();
+
+            BufferReader br(data, len);
+
+            u4 magic = br.readu4();
+            JnifError::check(
+                    magic == ClassFile::MAGIC,
+                    "Invalid magic number. Expected 0xcafebabe, found: ",
+                    magic);
+
+            u2 minorVersion = br.readu2();
+            u2 majorVersion = br.readu2();
+            _version = Version(majorVersion, minorVersion);
+
+            u2 count = br.readu2();
+            JnifError::check(count > 0, "Invalid constant pool count");
+            _cp.resize(count, 0);
+
+            for (int i = 1; i < count; i++) {
+                _cp[i] = br.offset();
+                u1 tag = skipConstEntry(&br);
+
+                if (tag == ConstPool::LONG || tag == ConstPool::DOUBLE) {
+                    i++;
+                }
+            }
+
+            _accessFlags = br.readu2();
+            _thisClassIndex = br.readu2();
+            _superClassIndex = br.readu2();
+
+            getThisClassName();
+            if (_superClassIndex != ConstPool::NULLENTRY) {
+                getSuperClassName();
+            }
+
+            _interfaceCount = br.readu2();
+            _interfacesOffset = br.offset();
+            for (int i = 0; i < _interfaceCount; i++) {
+                getClassName(br.readu2());
+            }
+
+            auto scanAttrs = [&](BufferReader &br, u2 *attrCount, u4 *firstAttr) {
+                *attrCount = br.readu2();
+                *firstAttr = _attrs.size();
+
+                for (int i = 0; i < *attrCount; i++) {
+                    Attr attr;
+                    attr.nameIndex = br.readu2();
+                    attr.len = br.readu4();
+                    attr.offset = br.pos() - data;
+                    getUtf8(attr.nameIndex);
+                    br.skip(attr.len);
+
+                    _attrs.push_back(attr);
+                }
+            };
+
+            auto scanMembers = [&](vector<Member> &members, bool isMethod) {
+                u2 memberCount = br.readu2();
+                members.reserve(memberCount);
+
+                for (int i = 0; i < memberCount; i++) {
+                    Member m;
+                    m.accessFlags = br.readu2();
+                    m.nameIndex = br.readu2();
+                    m.descIndex = br.readu2();
+                    m.codeAttr = NOCODE;
+                    getUtf8(m.nameIndex);
+                    getUtf8(m.descIndex);
+
+                    scanAttrs(br, &m.attrCount, &m.firstAttr);
+
+                    if (isMethod) {
+                        const Attr *codeAttr = findAttr(m, "Code");
+                        if (codeAttr != nullptr) {
+                            m.codeAttr = codeAttr - &_attrs[0];
+
+                            // Validates the ranges of the Code attribute.
+                            // Its attributes follow the ones of the method.
+                            Attr code = *codeAttr;
+                            BufferReader cbr(payload(code), code.len);
+                            cbr.skip(4);
+                            cbr.skip(cbr.readu4());
+                            cbr.skip(cbr.readu2() * 8);
+
+                            u2 codeAttrCount;
+                            u4 codeFirstAttr;
+                            scanAttrs(cbr, &codeAttrCount, &codeFirstAttr);
+                            JnifError::check(cbr.eor(), "Invalid Code attribute length: ", code.len);
+                        }
+                    }
+
+                    members.push_back(m);
+                }
+            };
+
+            scanMembers(_fields, false);
+            scanMembers(_methods, true);
+
+            scanAttrs(br, &_attrCount, &_firstAttr);
+
+            JnifError::check(br.eor(), "Expected end of class file, found: ", len - br.offset(), " bytes left");
+        }
+
+        ConstPool::Tag ClassFileView::getTag(ConstPool::Index index) const {
+            JnifError::check(index < _cp.size(), "Index out of bounds: ", index);
+
+            u4 offset = _cp[index];
+            return offset == 0 ? ConstPool::NULLENTRY : (ConstPool::Tag) _data[offset];
+        }
+
+        ConstPool::Utf8 ClassFileView::getUtf8(ConstPool::Index index) const {
+            JnifError::check(getTag(index) == ConstPool::UTF8, "Not a utf8 entry: ", index);
+
+            const u1 *p = _data + _cp[index];
+            return {(const char *) p + 3, (u2) (p[1] << 8 | p[2]), true};
+        }
+
+        ConstPool::Utf8 ClassFileView::getClassName(ConstPool::Index classIndex) const {
+            JnifError::check(getTag(classIndex) == ConstPool::CLASS, "Not a class entry: ", classIndex);
+
+            const u1 *p = _data + _cp[classIndex];
+            return getUtf8(p[1] << 8 | p[2]);
+        }
+
+        ConstPool::Index ClassFileView::getInterface(u2 i) const {
+            JnifError::check(i < _interfaceCount, "Invalid interface: ", i);
+
+            const u1 *p = _data + _interfacesOffset + i * 2;
+            return p[0] << 8 | p[1];
+        }
+
+        ClassFileView::Code ClassFileView::getCode(const Member &method) const {
+            JnifError::check(hasCode(method), "Method without code");
+
+            const Attr &attr = _attrs[method.codeAttr];
+            BufferReader br(payload(attr), attr.len);
+
+            Code code;
+            code.maxStack = br.readu2();
+            code.maxLocals = br.readu2();
+            code.codeLen = br.readu4();
+            code.codeOffset = attr.offset + br.offset();
+            br.skip(code.codeLen);
+            code.exceptionCount = br.readu2();
+            code.exceptionsOffset = attr.offset + br.offset();
+            br.skip(code.exceptionCount * 8);
+            code.attrCount = br.readu2();
+
+            // The attributes of a Code attribute follow the ones of its method.
+            code.firstAttr = method.firstAttr + method.attrCount;
+
+            return code;
+        }
+
+        const ClassFileView::Attr *ClassFileView::_findAttr(u4 first, u2 count, const char *name) const {
+            size_t nameLen = strlen(name);
+
+            for (u4 i = first; i < first + count; i++) {
+                ConstPool::Utf8 utf8 = getUtf8(_attrs[i].nameIndex);
+                if (utf8.len == nameLen && memcmp(utf8.data, name, nameLen) == 0) {
+                    return &_attrs[i];
+                }
+            }
+
+            return nullptr;
+        }
+
+        /**
+         * Encodes value as a utf8 constant pool entry, i.e., tag, length and
+         * bytes.
+         */
+        static string utf8Entry(const string& value) {
+            JnifError::check(value.size() <= 0xffff, "Invalid utf8 length: ", value.size());
+
+            string entry;
+            entry.reserve(value.size() + 3);
+            entry += (char) ConstPool::UTF8;
+            entry += (char) (value.size() >> 8);
+            entry += (char) (value.size() & 0xff);
+            entry += value;
+
+            return entry;
+        }
+
+        void ClassFilePrefilter::addClass(const string& className) {
+            JnifError::check(!className.empty(), "Empty class name pattern");
+            _classes.push_back(className);
+        }
+
+        void ClassFilePrefilter::addMember(const string& className, const string& memberName) {
+            JnifError::check(!className.empty(), "Empty class name pattern");
+            _members.push_back({className, utf8Entry(memberName)});
+        }
+
+        void ClassFilePrefilter::addString(const string& value) {
+            _strings.push_back(utf8Entry(value));
+        }
+
+        bool ClassFilePrefilter::matches(const u1 *data, u4 len) const {
+            BufferReader br(data, len);
+
+            u4 magic = br.readu4();
+            JnifError::check(
+                    magic == ClassFile::MAGIC,
+                    "Invalid magic number. Expected 0xcafebabe, found: ",
+                    magic);
+
+            br.skip(4);
+            u2 count = br.readu2();
+
+            const u1 *begin = br.pos();
+            for (int i = 1; i < count; i++) {
+                u1 tag = skipConstEntry(&br);
+
+                if (tag == ConstPool::LONG || tag == ConstPool::DOUBLE) {
+                    i++;
+                }
+            }
+            const u1 *end = br.pos();
+
+            for (const string &className : _classes) {
+                if (_find(begin, end, className, false)) {
+                    return true;
+                }
+            }
+
+            for (const string &entry : _strings) {
+                if (_find(begin, end, entry, true)) {
+                    return true;
+                }
+            }
+
+            for (const std::pair<string, string> &member : _members) {
+                if (_find(begin, end, member.first, false) && _find(begin, end, member.second, true)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool ClassFilePrefilter::_find(const u1 *begin, const u1 *end, const string &needle, bool isEntry) {
+            // The entry containing the last candidate, [entry, br.pos()).
+            BufferReader br(begin, end - begin);
+            const u1 *entry = begin;
+            u1 tag = ConstPool::NULLENTRY;
+
+            for (const u1 *p = begin; (size_t) (end - p) >= needle.size(); ) {
+                const u1 *hit = (const u1 *) memmem(p, end - p, needle.data(), needle.size());
+                if (hit == nullptr) {
+                    return false;
+                }
+
+                // Candidates are found in order, so the tags are walked once.
+                while (br.pos() <= hit) {
+                    entry = br.pos();
+                    tag = skipConstEntry(&br);
+                }
+
+                if (tag == ConstPool::UTF8) {
+                    if (isEntry ? hit == entry : hit >= entry + 3 && hit + needle.size() <= br.pos()) {
+                        return true;
+                    }
+                }
+
+                p = hit + 1;
+            }
+
+            return false;
+        }
+
+    }
+
+    namespace model {
+
+        void CodeAttr::_summarize() {
+            parser::BufferReader br(_data, codeLen);
+
+            InstSummary& summary = instList._summary;
+            while (!br.eor()) {
+                int offset = br.offset();
+
+                Opcode opcode = (Opcode) br.readu1();
+                OpKind kind = parser::OPKIND[(int) opcode];
+                summary.add(opcode, kind);
+
+                switch (kind) {
+                    case KIND_ZERO:
+                        if (opcode == Opcode::wide) {
+                            br.skip(br.readu1() == (u1) Opcode::iinc ? 4 : 2);
+                        }
+                        break;
+                    case KIND_BIPUSH:
+                    case KIND_VAR:
+                    case KIND_NEWARRAY:
+                        br.skip(1);
+                        break;
+                    case KIND_SIPUSH:
+                    case KIND_IINC:
+                    case KIND_FIELD:
+                    case KIND_INVOKE:
+                    case KIND_TYPE:
+                    case KIND_JUMP:
+                        br.skip(2);
+                        break;
+                    case KIND_MULTIARRAY:
+                        br.skip(3);
+                        break;
+                    case KIND_INVOKEINTERFACE:
+                    case KIND_INVOKEDYNAMIC:
+                        br.skip(4);
+                        break;
+                    case KIND_LDC:
+                        br.skip(opcode == Opcode::ldc ? 1 : 2);
+                        break;
+                    case KIND_TABLESWITCH: {
+                        br.skip((((-offset - 1) % 4) + 4) % 4);
+                        br.skip(4);
+                        int low = br.readu4();
+                        int high = br.readu4();
+
+                        long long count = (long long) high - low + 1;
+                        JnifError::check(low <= high && count * 4 <= br.size() - br.offset(),
+                                         "Invalid tableswitch bounds: ", low, ", ", high);
+                        br.skip(count * 4);
+                        break;
+                    }
+                    case KIND_LOOKUPSWITCH: {
+                        br.skip((((-offset - 1) % 4) + 4) % 4);
+                        br.skip(4);
+                        u4 npairs = br.readu4();
+                        JnifError::check(npairs <= (u4) (br.size() - br.offset()) / 8,
+                                         "Invalid lookupswitch npairs: ", npairs);
+                        br.skip(npairs * 8);
+                        break;
+                    }
+                    default:
+                        throw Exception("default kind in summarize: opcode: ", opcode, ", kind: ", kind);
+                }
+            }
+
+            parser::BufferReader exceptionTable(_data + codeLen, _dataLen - codeLen);
+            summary.hasHandlers = exceptionTable.readu2() > 0;
+        }
+
     }
-}
\ No newline at end of file
+}
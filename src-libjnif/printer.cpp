@@ -37,40 +37,45 @@ namespace jnif {
         return value ? str : "";
     }
 
-    std::ostream& operator<<(std::ostream& os, const Frame& frame) {
+    template<class TDefs>
+    std::ostream& operator<<(std::ostream& os, const BasicFrame<TDefs>& frame) {
         os << "{";
         for (u4 i = 0; i < frame.lva.size(); i++) {
             os << (i == 0 ? "" : " ") << i << ":" << frame.lva[i].first;
         }
         os << "}[";
         int i = 0;
-        for (auto t : frame.stack) {
-            os << (i == 0 ? "" : " | ") << t.first;
+        for (auto t = frame.stack.rbegin(); t != frame.stack.rend(); ++t) {
+            os << (i == 0 ? "" : " | ") << t->first;
             i++;
         }
         return os << "]";
     }
 
-    std::ostream& operator<<(std::ostream& os, BasicBlock& bb) {
-        os << "    " << yellow << bb.name << reset;
+    template std::ostream& operator<<(std::ostream& os, const Frame& frame);
 
-        auto p = [&os](const std::vector<BasicBlock*>& bs, const char* arrow) {
+    template std::ostream& operator<<(std::ostream& os, const DefUseFrame& frame);
+
+    std::ostream& operator<<(std::ostream& os, const BasicBlock& bb) {
+        os << "    " << yellow << bb.name() << reset;
+
+        auto p = [&os](const BasicBlock::Blocks& bs, const char* arrow) {
             os << "{";
             bool f = true;
             for (BasicBlock* bbt : bs) {
                 if (!f) {
                     os << " ";
                 }
-                os << arrow << bbt->name;
+                os << arrow << bbt->name();
                 f = false;
             }
             os << "}";
         };
 
         os << " ";
-        p(bb.targets, "->");
+        p(bb.targets(), "->");
         os << " ";
-        p(bb.ins, "<-");
+        p(bb.ins(), "<-");
 
         os << " " << bb.in << " ~> " << bb.out;
 
@@ -370,7 +375,7 @@ namespace jnif {
             } else if (type.isNull()) {
                 os << "Null";
             } else if (type.isUninitThis()) {
-                os << "Uninitialized this:" << type.className;
+                os << "Uninitialized this:" << ClassNames::name(type.getClassSymbol());
             } else if (type.isObject()) {
                 string s = type.getClassName();
                 size_t i = s.find_last_of('/');
@@ -529,7 +534,7 @@ namespace jnif {
 
                     line() << "#" << i << " [" << ConstNames[tag] << "]: ";
 
-                    const ConstPool::Item* entry = &cp.entries[i];
+                    const ConstPool::Value* entry = &cp.getValue(i);
 
                     switch (tag) {
                         case ConstPool::CLASS:
@@ -587,7 +592,7 @@ namespace jnif {
                                << entry->nameAndType.descriptorIndex;
                             break;
                         case ConstPool::UTF8:
-                            os << entry->utf8.str;
+                            os << cp.getUtf8(i);
                             break;
                         case ConstPool::METHODHANDLE:
                             os << entry->methodHandle.referenceKind << " #"
@@ -715,7 +720,7 @@ namespace jnif {
                 }
             }
 
-            void parseTs(vector<Type>& locs) {
+            void parseTs(ArenaVector<Type>& locs) {
                 line(2) << "[" << locs.size() << "] ";
                 for (u1 i = 0; i < locs.size(); i++) {
                     Type& vt = locs[i];
@@ -0,0 +1,331 @@
+/*
+ * snippet.cpp
+ *
+ * Instruction sequences compiled once per class and inserted many times.
+ */
+#include "jnif.hpp"
+
+namespace jnif {
+
+    namespace model {
+
+        Snippet::Symbol Snippet::putString(const string& value) {
+            return _put(ConstPool::STRING, value);
+        }
+
+        Snippet::Symbol Snippet::putClass(const string& className) {
+            return _put(ConstPool::CLASS, className);
+        }
+
+        Snippet::Symbol Snippet::putFieldRef(const string& className, const string& name, const string& desc) {
+            return _put(ConstPool::FIELDREF, className, name, desc);
+        }
+
+        Snippet::Symbol Snippet::putMethodRef(const string& className, const string& name, const string& desc) {
+            return _put(ConstPool::METHODREF, className, name, desc);
+        }
+
+        Snippet::Symbol Snippet::putInterMethodRef(const string& className, const string& name, const string& desc) {
+            return _put(ConstPool::INTERMETHODREF, className, name, desc);
+        }
+
+        Snippet::Symbol Snippet::param() {
+            _paramCount++;
+            return _put(ConstPool::NULLENTRY, "");
+        }
+
+        void Snippet::addLabel(int label) {
+            JnifError::check(label >= 0 && label < _labelCount, "Invalid snippet label: ", label);
+            _add(Opcode::nop, KIND_LABEL, label);
+        }
+
+        void Snippet::addZero(Opcode opcode) {
+            _add(opcode, KIND_ZERO);
+        }
+
+        void Snippet::addBiPush(u1 value) {
+            _add(Opcode::bipush, KIND_BIPUSH, value);
+        }
+
+        void Snippet::addSiPush(u2 value) {
+            _add(Opcode::sipush, KIND_SIPUSH, value);
+        }
+
+        void Snippet::addLdc(Opcode opcode, Symbol value) {
+            JnifError::check(value < _constants.size(), "Invalid snippet symbol: ", value);
+            _add(opcode, KIND_LDC, value);
+        }
+
+        void Snippet::addVar(Opcode opcode, u1 lvindex) {
+            _add(opcode, KIND_VAR, lvindex);
+        }
+
+        void Snippet::addIinc(u1 index, u1 value) {
+            _add(Opcode::iinc, KIND_IINC, index, value);
+        }
+
+        void Snippet::addJump(Opcode opcode, int label) {
+            JnifError::check(label >= 0 && label < _labelCount, "Invalid snippet label: ", label);
+            _add(opcode, KIND_JUMP, label);
+        }
+
+        void Snippet::addField(Opcode opcode, Symbol fieldRef) {
+            _addRef(opcode, KIND_FIELD, fieldRef, ConstPool::FIELDREF);
+        }
+
+        void Snippet::addInvoke(Opcode opcode, Symbol methodRef) {
+            JnifError::check(methodRef < _constants.size(), "Invalid snippet symbol: ", methodRef);
+
+            // invokestatic and invokespecial can also target interface methods.
+            if (_constants[methodRef].tag == ConstPool::INTERMETHODREF) {
+                _add(opcode, KIND_INVOKE, methodRef);
+            } else {
+                _addRef(opcode, KIND_INVOKE, methodRef, ConstPool::METHODREF);
+            }
+        }
+
+        void Snippet::addInvokeInterface(Symbol interMethodRef, u1 count) {
+            _addRef(Opcode::invokeinterface, KIND_INVOKEINTERFACE, interMethodRef,
+                    ConstPool::INTERMETHODREF, count);
+        }
+
+        void Snippet::addType(Opcode opcode, Symbol classRef) {
+            _addRef(opcode, KIND_TYPE, classRef, ConstPool::CLASS);
+        }
+
+        void Snippet::addNewArray(u1 atype) {
+            _add(Opcode::newarray, KIND_NEWARRAY, atype);
+        }
+
+        CompiledSnippet Snippet::compile(ClassFile& cf) const {
+            // Each insertion adds a copy of every label once, so a label
+            // is placed at most once, and exactly once when jumped to.
+            vector<int> placed(_labelCount, 0);
+            for (const SnippetInst& si : _insts) {
+                if (si.kind == KIND_LABEL) {
+                    JnifError::check(++placed[si.operand] == 1, "Snippet label placed more than once: ",
+                                     si.operand);
+                }
+            }
+
+            for (const SnippetInst& si : _insts) {
+                if (si.kind == KIND_JUMP) {
+                    JnifError::check(placed[si.operand] == 1, "Snippet jump to a label not placed: ", si.operand);
+                }
+            }
+
+            vector<ConstPool::Index> indices(_constants.size(), ConstPool::NULLENTRY);
+            vector<int> params(_constants.size(), -1);
+
+            int param = 0;
+            for (size_t i = 0; i < _constants.size(); i++) {
+                const Constant& c = _constants[i];
+                const char* className = c.className.c_str();
+
+                switch (c.tag) {
+                    case ConstPool::NULLENTRY:
+                        params[i] = param++;
+                        break;
+                    case ConstPool::STRING:
+                        indices[i] = cf.putString(c.className);
+                        break;
+                    case ConstPool::CLASS:
+                        indices[i] = cf.putClass(className);
+                        break;
+                    case ConstPool::FIELDREF:
+                        indices[i] = cf.putFieldRef(cf.putClass(className), c.name.c_str(), c.desc.c_str());
+                        break;
+                    case ConstPool::METHODREF:
+                        indices[i] = cf.putMethodRef(cf.putClass(className), c.name.c_str(), c.desc.c_str());
+                        break;
+                    case ConstPool::INTERMETHODREF:
+                        indices[i] = cf.putInterMethodRef(cf.putClass(className), c.name.c_str(), c.desc.c_str());
+                        break;
+                    default:
+                        throw Exception("Invalid snippet constant tag: ", c.tag);
+                }
+            }
+
+            CompiledSnippet cs;
+            cs._labelCount = _labelCount;
+            cs._paramCount = _paramCount;
+            cs._insts.reserve(_insts.size());
+
+            for (const SnippetInst& si : _insts) {
+                CompiledSnippet::ResolvedInst ri = {si.opcode, si.kind, si.operand, si.operand2, -1};
+
+                switch (si.kind) {
+                    case KIND_LDC:
+                    case KIND_FIELD:
+                    case KIND_INVOKE:
+                    case KIND_INVOKEINTERFACE:
+                    case KIND_TYPE:
+                        ri.operand = indices[si.operand];
+                        ri.param = params[si.operand];
+                        break;
+                    case KIND_JUMP:
+                        cs._branches++;
+                        break;
+                    default:
+                        break;
+                }
+
+                if (si.opcode == Opcode::jsr || si.opcode == Opcode::ret) {
+                    cs._jsrOrRet = true;
+                }
+
+                cs._summary.add(si.opcode, si.kind);
+                cs._insts.push_back(ri);
+            }
+
+            return cs;
+        }
+
+        Snippet::Symbol Snippet::_put(ConstPool::Tag tag, const string& className,
+                                      const string& name, const string& desc) {
+            for (size_t i = 0; i < _constants.size(); i++) {
+                const Constant& c = _constants[i];
+                if (tag != ConstPool::NULLENTRY && c.tag == tag && c.className == className
+                    && c.name == name && c.desc == desc) {
+                    return i;
+                }
+            }
+
+            _constants.push_back({tag, className, name, desc});
+            return _constants.size() - 1;
+        }
+
+        void Snippet::_add(Opcode opcode, OpKind kind, u2 operand, u2 operand2) {
+            _insts.push_back({opcode, kind, operand, operand2});
+        }
+
+        void Snippet::_addRef(Opcode opcode, OpKind kind, Symbol symbol,
+                              ConstPool::Tag tag, u2 operand2) {
+            JnifError::check(symbol < _constants.size(), "Invalid snippet symbol: ", symbol);
+
+            ConstPool::Tag actual = _constants[symbol].tag;
+            JnifError::check(actual == tag || actual == ConstPool::NULLENTRY,
+                             "Invalid snippet symbol for ", kind, ": ", symbol);
+
+            _add(opcode, kind, symbol, operand2);
+        }
+
+        Inst* InstList::addSnippet(const CompiledSnippet& snippet, Inst* pos,
+                                   std::initializer_list<ConstPool::Index> args) {
+            JnifError::check(args.size() == (size_t) snippet._paramCount,
+                             "Invalid number of snippet arguments: ", args.size(),
+                             ", expected: ", snippet._paramCount);
+
+            if (snippet._insts.empty()) {
+                return nullptr;
+            }
+
+            Arena& arena = constPool->_arena;
+            const ConstPool::Index* argv = args.begin();
+
+            LabelInst** labels = nullptr;
+            if (snippet._labelCount > 0) {
+                labels = arena.newArray<LabelInst*>(snippet._labelCount);
+            }
+
+            for (int i = 0; i < snippet._labelCount; i++) {
+                labels[i] = createLabel();
+            }
+
+            Inst* head = nullptr;
+            Inst* tail = nullptr;
+
+            for (const CompiledSnippet::ResolvedInst& ri : snippet._insts) {
+                u2 operand = ri.param < 0 ? ri.operand : argv[ri.param];
+
+                Inst* inst;
+                switch (ri.kind) {
+                    case KIND_LABEL:
+                        inst = labels[operand];
+                        break;
+                    case KIND_ZERO:
+                        inst = _create<ZeroInst>(ri.opcode, constPool);
+                        break;
+                    case KIND_BIPUSH:
+                    case KIND_SIPUSH:
+                        inst = _create<PushInst>(ri.opcode, ri.kind, operand, constPool);
+                        break;
+                    case KIND_LDC:
+                        inst = _create<LdcInst>(ri.opcode, operand, constPool);
+                        break;
+                    case KIND_VAR:
+                        inst = _create<VarInst>(ri.opcode, (u1) operand, constPool);
+                        break;
+                    case KIND_IINC:
+                        inst = _create<IincInst>((u1) operand, (u1) ri.operand2, constPool);
+                        break;
+                    case KIND_JUMP:
+                        labels[operand]->isBranchTarget = true;
+                        inst = _create<JumpInst>(ri.opcode, labels[operand], constPool);
+                        break;
+                    case KIND_FIELD:
+                        inst = _create<FieldInst>(ri.opcode, operand, constPool);
+                        break;
+                    case KIND_INVOKE:
+                        inst = _create<InvokeInst>(ri.opcode, operand, constPool);
+                        break;
+                    case KIND_INVOKEINTERFACE:
+                        inst = _create<InvokeInterfaceInst>(operand, (u1) ri.operand2, constPool);
+                        break;
+                    case KIND_TYPE:
+                        inst = _create<TypeInst>(ri.opcode, operand, constPool);
+                        break;
+                    case KIND_NEWARRAY:
+                        inst = _create<NewArrayInst>(ri.opcode, (u1) operand, constPool);
+                        break;
+                    default:
+                        throw Exception("Invalid snippet instruction kind: ", ri.kind);
+                }
+
+                inst->prev = tail;
+                if (tail != nullptr) {
+                    tail->next = inst;
+                } else {
+                    head = inst;
+                }
+
+                tail = inst;
+            }
+
+            JnifError::assert(pos == nullptr || first != nullptr, "Invalid pos");
+
+            u4 index = pos == nullptr ? _size : _indexOf(pos);
+            for (Inst* inst = head; inst != nullptr; inst = inst->next) {
+                _insertAt(index++, inst);
+            }
+
+            Inst* p = pos == nullptr ? last : pos->prev;
+            Inst* n = pos;
+
+            head->prev = p;
+            tail->next = n;
+
+            if (p != nullptr) {
+                p->next = head;
+            } else {
+                first = head;
+            }
+
+            if (n != nullptr) {
+                n->prev = tail;
+            } else {
+                last = tail;
+            }
+
+            _size += snippet._insts.size();
+            branchesCount += snippet._branches;
+            jsrOrRet = jsrOrRet || snippet._jsrOrRet;
+            _summary.add(snippet._summary);
+            modified = true;
+            _offsetIndex.clear();
+
+            return head;
+        }
+
+    }
+}
@@ -160,13 +160,20 @@ namespace jnif {
             u2 count = cp.size();
             bw.writeu2(count);
 
-            for (ConstPool::Iterator it = cp.iterator(); it.hasNext(); it++) {
+            ConstPool::Index start = 1;
+            if (cp._source != nullptr) {
+                bw.writecount(cp._source, cp._sourceLen);
+                start = cp._sourceCount;
+            }
+
+            for (ConstPool::Iterator it = cp.iterator(start); it.hasNext(); it++) {
                 ConstPool::Index i = *it;
-                const ConstPool::Item* entry = &cp.entries[i];
+                ConstPool::Tag tag = cp.getTag(i);
+                const ConstPool::Value* entry = &cp.getValue(i);
 
-                bw.writeu1(entry->tag);
+                bw.writeu1(tag);
 
-                switch (entry->tag) {
+                switch (tag) {
                     case ConstPool::CLASS:
                         bw.writeu2(entry->clazz.nameIndex);
                         break;
@@ -214,10 +221,9 @@ namespace jnif {
                         bw.writeu2(entry->nameAndType.descriptorIndex);
                         break;
                     case ConstPool::UTF8: {
-                        u2 len = entry->utf8.str.length();
-                        const char* str = entry->utf8.str.c_str();
-                        bw.writeu2(len);
-                        bw.writecount(str, len);
+                        const ConstPool::Utf8& utf8 = cp.getUtf8Entry(i);
+                        bw.writeu2(utf8.length());
+                        bw.writecount(utf8.bytes(), utf8.length());
                         break;
                     }
                     case ConstPool::METHODHANDLE:
@@ -365,7 +371,7 @@ namespace jnif {
             }
         }
 
-        void writeSmtTypes(const vector<Type>& locs) {
+        void writeSmtTypes(const ArenaVector<Type>& locs) {
             for (u1 i = 0; i < locs.size(); i++) {
                 const Type& type = locs[i];
 
@@ -587,6 +593,8 @@ namespace jnif {
                         throw Exception("default kind in instlist: ", inst.kind);
                 }
             }
+
+            instList.invalidateOffsets();
         }
 
         void writeCode(CodeAttr& attr) {
@@ -594,6 +602,12 @@ namespace jnif {
             bw.writeu2(attr.maxLocals);
             bw.writeu4(attr.codeLen);
 
+            if (!attr.isModified()) {
+                // Copies the original code, exception table and attributes.
+                bw.writecount(attr._data, attr._dataLen);
+                return;
+            }
+
             u4 offset = bw.getOffset();
 
             writeInstList(attr.instList);
@@ -630,7 +644,7 @@ namespace jnif {
 
             for (u4 i = 0; i < attrs.size(); i++) {
 
-                Attr& attr = (Attr&) *attrs.attrs[i];
+                Attr& attr = (Attr&) attrs[i];
 
                 bw.writeu2(attr.nameIndex);
                 bw.writeu4(attr.len);
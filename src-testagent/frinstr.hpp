@@ -32,6 +32,7 @@ struct InstrArgs {
 struct Stats {
 	long loadedClasses;
 	long exceptionEntries;
+	long blockVisits;
 
 };
 
@@ -218,14 +218,14 @@ private:
 		u1* bytes = (u1*) jni->GetByteArrayElements((jbyteArray) res, NULL);
 		ASSERT(bytes != NULL, "loadClassAsResource: ");
 
-		parser::ClassFileParser cf(bytes, len);
+		// Only this and super class are needed, the class is not parsed.
+		parser::ClassFileView view(bytes, len);
+		classHierarchy.addClass(view);
 
 		jni->ReleaseByteArrayElements((jbyteArray) res, (jbyte*) bytes,
 		JNI_ABORT);
 		jni->DeleteLocalRef(res);
 		jni->DeleteLocalRef(targetName);
-
-		classHierarchy.addClass(cf);
 	}
 
 	//const char* className;
@@ -308,7 +308,7 @@ void InstrClassEmpty(jvmtiEnv*, u1* data, int len, const char* className, int*,
 void InstrClassIdentity(jvmtiEnv* jvmti, u1* data, int len,
 		const char* className, int* newlen, u1** newdata, JNIEnv*,
 		InstrArgs* args) {
-	parser::ClassFileParser cf(data, len);
+	parser::ClassFileParser cf(data, len, true, &ArenaPool::local());
 	*newlen = cf.computeSize();
 	*newdata = Allocate(jvmti, *newlen);
 	cf.write(*newdata, *newlen);
@@ -324,7 +324,7 @@ void InstrClassCompute(jvmtiEnv* jvmti, u1* data, int len,
 	getProf().prof("@LoadClassEvent:Mutex", ProfEntry::getTime() - start);
 
 	start = ProfEntry::getTime();
-	parser::ClassFileParser cf(data, len);
+	parser::ClassFileParser cf(data, len, false, &ArenaPool::local());
 	getProf().prof("@ClassParser", ProfEntry::getTime() - start);
 
 	{
@@ -344,6 +344,10 @@ void InstrClassCompute(jvmtiEnv* jvmti, u1* data, int len,
 		if (m.hasCode()) {
 			CodeAttr* c = m.codeAttr();
 			stats.exceptionEntries += c->exceptions.size();
+
+			if (c->cfg != nullptr) {
+				stats.blockVisits += c->cfg->visits();
+			}
 		}
 	}
 
@@ -363,7 +367,7 @@ public:
 			return;
 		}
 
-		ConstPool::Index mid = cf.addMethodRef(classIndex, "alloc",
+		ConstPool::Index mid = cf.putMethodRef(classIndex, "alloc",
 				"(Ljava/lang/Object;)V");
 
 		for (Method& m : cf.methods) {
@@ -379,10 +383,10 @@ public:
 
     static void instrNewArray(ClassFile& cf, ConstPool::Index classIndex) {
 		const char* desc = "(ILjava/lang/Object;I)V";
-		ConstPool::Index mid = cf.addMethodRef(classIndex, "newArrayEvent", desc);
+		ConstPool::Index mid = cf.putMethodRef(classIndex, "newArrayEvent", desc);
 
 		for (Method& m : cf.methods) {
-			if (m.hasCode()) {
+			if (m.hasCode() && m.summary()->has(Opcode::newarray)) {
 				InstList& instList = m.instList();
 
 				for (Inst* inst : instList) {
@@ -417,10 +421,10 @@ public:
 
     static void instrANewArray(ClassFile& cf, ConstPool::Index classIndex) {
 		const char* desc = "(ILjava/lang/Object;Ljava/lang/String;)V";
-		ConstPool::Index mid = cf.addMethodRef(classIndex, "aNewArrayEvent", desc);
+		ConstPool::Index mid = cf.putMethodRef(classIndex, "aNewArrayEvent", desc);
 
 		for (Method& m : cf.methods) {
-			if (m.hasCode()) {
+			if (m.hasCode() && m.summary()->has(Opcode::anewarray)) {
 				InstList& instList = m.instList();
 
 				for (Inst* inst : instList) {
@@ -440,7 +444,7 @@ public:
 						// STACK: ... | arrayref | count | arrayref
 
 						auto ci = inst->type()->classIndex;
-						auto strIndex = cf.addStringFromClass(ci);
+						auto strIndex = cf.putStringFromClass(ci);
 
 						instList.addLdc(Opcode::ldc_w, strIndex, p);
 						// STACK: ... | arrayref | count | arrayref | classname
@@ -455,33 +459,46 @@ public:
 		}
 	}
 
-    static void instrMethodEntryExit(ClassFile& cf, ConstPool::Index proxyClass) {
-		//if  ( cf.getThisClassName())
-        ConstPool::Index sid = cf.addMethodRef(proxyClass, "enterMethod",
+    /**
+     * Probe for instrMethodEntryExit, taking the class name and method name
+     * strings as parameters.
+     */
+    static Snippet methodEventSnippet(const char* eventName) {
+		Snippet snippet;
+		Snippet::Symbol classNameIndex = snippet.param();
+		Snippet::Symbol methodIndex = snippet.param();
+		Snippet::Symbol mid = snippet.putMethodRef(FR_PROXY_CLASS, eventName,
 				"(Ljava/lang/String;Ljava/lang/String;)V");
 
-        ConstPool::Index eid = cf.addMethodRef(proxyClass, "exitMethod",
-				"(Ljava/lang/String;Ljava/lang/String;)V");
+		snippet.addLdc(Opcode::ldc_w, classNameIndex);
+		snippet.addLdc(Opcode::ldc_w, methodIndex);
+		snippet.addInvoke(Opcode::invokestatic, mid);
+
+		return snippet;
+	}
+
+    static void instrMethodEntryExit(ClassFile& cf) {
+		static const Snippet enterSnippet = methodEventSnippet("enterMethod");
+		static const Snippet exitSnippet = methodEventSnippet("exitMethod");
 
-        ConstPool::Index classNameIdx = cf.addStringFromClass(cf.thisClassIndex);
+		CompiledSnippet enterProbe = enterSnippet.compile(cf);
+		CompiledSnippet exitProbe = exitSnippet.compile(cf);
+
+        ConstPool::Index classNameIdx = cf.putStringFromClass(cf.thisClassIndex);
 
 		for (Method& m : cf.methods) {
 			if (m.hasCode()) {
 				InstList& instList = m.instList();
 
-        ConstPool::Index methodIndex = cf.addString(m.nameIndex);
+        ConstPool::Index methodIndex = cf.putString(m.nameIndex);
 
 				Inst* p = *instList.begin();
 
-				instList.addLdc(Opcode::ldc_w, classNameIdx, p);
-				instList.addLdc(Opcode::ldc_w, methodIndex, p);
-				instList.addInvoke(Opcode::invokestatic, sid, p);
+				instList.addSnippet(enterProbe, p, { classNameIdx, methodIndex });
 
 				for (Inst* inst : instList) {
 					if (inst->isExit()) {
-						instList.addLdc(Opcode::ldc_w, classNameIdx, inst);
-						instList.addLdc(Opcode::ldc_w, methodIndex, inst);
-						instList.addInvoke(Opcode::invokestatic, eid, inst);
+						instList.addSnippet(exitProbe, inst, { classNameIdx, methodIndex });
 					}
 				}
 			}
@@ -489,8 +506,8 @@ public:
 	}
 
     static void instrMain(ClassFile& cf, ConstPool::Index classIndex) {
-        ConstPool::Index sid = cf.addMethodRef(classIndex, "enterMainMethod", "()V");
-        ConstPool::Index eid = cf.addMethodRef(classIndex, "exitMainMethod", "()V");
+        ConstPool::Index sid = cf.putMethodRef(classIndex, "enterMainMethod", "()V");
+        ConstPool::Index eid = cf.putMethodRef(classIndex, "exitMainMethod", "()V");
 
 		for (Method& m : cf.methods) {
 			if (m.isMain()) {
@@ -509,7 +526,7 @@ public:
 	}
 
     static void instrIndy(ClassFile& cf, ConstPool::Index classIndex) {
-        ConstPool::Index mid = cf.addMethodRef(classIndex, "indy", "(I)V");
+        ConstPool::Index mid = cf.putMethodRef(classIndex, "indy", "(I)V");
 
 		for (Method& m : cf.methods) {
 			if (m.hasCode()) {
@@ -528,7 +545,7 @@ public:
 	}
 
     static void instrAllOpcodes(ClassFile& cf, ConstPool::Index proxyClass) {
-//		ConstIndex mid = cf.addMethodRef(proxyClass, "opcode", "(I)V");
+//		ConstIndex mid = cf.putMethodRef(proxyClass, "opcode", "(I)V");
 
 		for (Method& m : cf.methods) {
 			if (m.hasCode()) {
@@ -557,10 +574,11 @@ void InstrClassStats(jvmtiEnv* jvmti, unsigned char* data, int len,
 		JNIEnv* jni, InstrArgs* args) {
 	LoadClassEvent m;
 
-	parser::ClassFileParser cf(data, len);
+	parser::ClassFileParser cf(data, len, true, &ArenaPool::local());
 	classHierarchy.addClass(cf);
 
-  ConstPool::Index proxyClass = cf.addClass("frproxy/FrInstrProxy");
+  ConstPool::Index proxyClass = cf.putClass("frproxy/FrInstrProxy");
+	cf.setModified(false);
 
 	Instr::instrObjectInit(cf, proxyClass);
 	//Instr::instrNewArray(cf, classIndex);
@@ -568,9 +586,13 @@ void InstrClassStats(jvmtiEnv* jvmti, unsigned char* data, int len,
 	Instr::instrMain(cf, proxyClass);
 	//Instr::instrIndy(cf, proxyClass);
 
-	//Instr::instrMethodEntryExit(cf, proxyClass);
+	//Instr::instrMethodEntryExit(cf);
 	//Instr::instrAllOpcodes(cf, proxyClass);
 
+	if (!cf.isModified()) {
+		return;
+	}
+
 	try {
 		ClassPath cp(cf.getThisClassName(), jni, args->loader);
 		cf.computeFrames(&cp);
@@ -588,15 +610,20 @@ void InstrClassAll(jvmtiEnv* jvmti, unsigned char* data, int len,
 		JNIEnv* jni, InstrArgs* args) {
 	LoadClassEvent m;
 
-	parser::ClassFileParser cf(data, len);
+	parser::ClassFileParser cf(data, len, true, &ArenaPool::local());
 	classHierarchy.addClass(cf);
 
-  ConstPool::Index proxyClass = cf.addClass("frproxy/FrInstrProxy");
+  ConstPool::Index proxyClass = cf.putClass("frproxy/FrInstrProxy");
+	cf.setModified(false);
 
 	if (!isPrefix("java/lang/", cf.getThisClassName())) {
 		Instr::instrAllOpcodes(cf, proxyClass);
 	}
 
+	if (!cf.isModified()) {
+		return;
+	}
+
 	try {
 		ClassPath cp(cf.getThisClassName(), jni, args->loader);
 		cf.computeFrames(&cp);
@@ -54,6 +54,29 @@ typedef struct {
 
 InstrFuncEntry instrFuncEntry;
 
+/**
+ * When not empty, only the classes referencing any of its patterns
+ * are given to the instrumentation function.
+ */
+parser::ClassFilePrefilter prefilter;
+
+/**
+ * Whether the class is given to the instrumentation function.
+ * Classes the prefilter cannot scan are given anyway, so that they fail
+ * in the guarded instrumentation call, as without a prefilter.
+ */
+static bool PrefilterMatches(const unsigned char* data, int len) {
+	if (prefilter.empty()) {
+		return true;
+	}
+
+	try {
+		return prefilter.matches(data, len);
+	} catch (const jnif::Exception&) {
+		return true;
+	}
+}
+
 static void JNICALL ClassFileLoadEvent(jvmtiEnv* jvmti, JNIEnv* jni,
 		jclass class_being_redefined, jobject loader, const char* name,
 		jobject protection_domain, jint class_data_len,
@@ -65,6 +88,10 @@ static void JNICALL ClassFileLoadEvent(jvmtiEnv* jvmti, JNIEnv* jni,
 		return;
 	}
 
+	if (!PrefilterMatches(class_data, class_data_len)) {
+		return;
+	}
+
 	InstrArgs args;
 	args.loader = loader;
 	args.instrName = instrFuncEntry.name;
@@ -216,6 +243,17 @@ static void ParseOptions(const char* commandLineOptions) {
 		ERROR("Invalid configuration");
 	}
 
+	// Optional comma-separated list of class name patterns to prefilter.
+	if (options.size() >= 5) {
+		std::stringstream patterns(options[4]);
+		std::string className;
+		while (std::getline(patterns, className, ',')) {
+			if (!className.empty()) {
+				prefilter.addClass(className);
+			}
+		}
+	}
+
 	extern InstrFunc InstrClassEmpty;
 	extern InstrFunc InstrClassIdentity;
 	extern InstrFunc InstrClassCompute;
@@ -360,6 +398,7 @@ JNIEXPORT void JNICALL Agent_OnUnload(JavaVM* jvm) {
 
 	getProf().prof("#loadedClasses", stats.loadedClasses);
 	getProf().prof("#exceptionEntries", stats.exceptionEntries);
+	getProf().prof("#blockVisits", stats.blockVisits);
 
 	_TLOG("Agent unloaded");
 }
@@ -7,8 +7,10 @@
 #include <cstring>
 
 #include <ftw.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 using namespace std;
 using namespace jnif;
@@ -20,6 +22,22 @@ static bool isSuffix(const string& suffix, const string& text) {
     return res.first == suffix.rend();
 }
 
+/**
+ * Whether the cache file exists and is not older than the jar.
+ */
+static bool isFreshCache(const string& cachePath, const string& jarPath) {
+    struct stat cacheStat;
+    struct stat jarStat;
+
+    return stat(cachePath.c_str(), &cacheStat) == 0 && stat(jarPath.c_str(), &jarStat) == 0
+           && cacheStat.st_mtime >= jarStat.st_mtime;
+}
+
+static void addClass(void* classes, int, void* buf, int s, const char* fileNameInZip) {
+    JavaFile jf = { (const u1*) buf, s, fileNameInZip };
+    ((list<JavaFile>*)classes)->push_back(jf);
+}
+
 void apply(ostream& os, const list<JavaFile>& classes, TestFunc instr) {
     int i = 0;
     for (const JavaFile& jf : classes) {
@@ -42,6 +60,19 @@ int main(int argc, const char* argv[]) {
         {"printer", &testPrinter},
         {"size", &testSize},
         {"writer", &testWriter},
+        {"lazyWriter", &testLazyWriter},
+        {"lazyUnmodified", &testLazyUnmodified},
+        {"lazyUtf8", &testLazyUtf8},
+        {"lazyConstPoolWriter", &testLazyConstPoolWriter},
+        {"compactConstPool", &testCompactConstPool},
+        {"instOffsetIndex", &testInstOffsetIndex},
+        {"memberIndex", &testMemberIndex},
+        {"instSummary", &testInstSummary},
+        {"snippet", &testSnippet},
+        {"clone", &testClone},
+        {"image", &testImage},
+        {"classFileView", &testClassFileView},
+        {"classFilePrefilter", &testClassFilePrefilter},
         {"analysis", &testAnalysis},
         {"analysisPrinter", &testAnalysisPrinter},
         {"analysisWriter", &testAnalysisWriter},
@@ -49,13 +80,17 @@ int main(int argc, const char* argv[]) {
         {"nopAdderInstrSize", &testNopAdderInstrSize},
         {"nopAdderInstrWriter", &testNopAdderInstrWriter},
         {"nopAdderInstrAnalysisPrinter", &testNopAdderInstrAnalysisPrinter},
-        {"nopAdderInstrAnalysisWriter", &testNopAdderInstrAnalysisWriter}
+        {"nopAdderInstrAnalysisWriter", &testNopAdderInstrAnalysisWriter},
+        {"lazyNopAdderInstrWriter", &testLazyNopAdderInstrWriter}
     };
 
     if (argc == 1) {
         cerr << "Usage: " << endl;
         cerr << "  " << argv[0];
-        cerr << " [test1..testN] <j1>.jar [<j2>.jar..<jM>.jar]" << endl;
+        cerr << " [-c] [test1..testN] <j1>.jar [<j2>.jar..<jM>.jar]" << endl;
+        cerr << endl;
+        cerr << "  -c  loads the inflated classes of each jar from <jar>.jnifcache," << endl;
+        cerr << "      creating it when missing or older than the jar" << endl;
         cerr << endl;
         cerr << "  where testI is one of the following: " << endl;
         for (auto& t : availableTests) {
@@ -73,9 +108,13 @@ int main(int argc, const char* argv[]) {
     list<pair<string, TestFunc>> tests;
     list<string> jars;
     list<JavaFile> classes;
+    list<unique_ptr<jnif::jar::ClassCache>> caches;
+    bool useCache = false;
 
     for (int i = 1; i < argc; i++) {
-        if (isSuffix(".jar", string(argv[i]))) {
+        if (string(argv[i]) == "-c") {
+            useCache = true;
+        } else if (isSuffix(".jar", string(argv[i]))) {
             jars.push_back(argv[i]);
         } else {
             auto t = availableTestsLookup.find(argv[i]);
@@ -97,16 +136,38 @@ int main(int argc, const char* argv[]) {
     for (const string& j : jars) {
         cout << "[Loading " << j << " .. " << flush;
         try {
+            string cachePath = j + ".jnifcache";
+            if (useCache && isFreshCache(cachePath, j)) {
+                // The classes point into the mapped cache.
+                caches.emplace_back(new jnif::jar::ClassCache(cachePath.c_str()));
+                int csc = caches.back()->forEach(&classes, 0, &addClass);
+                cout << csc << " classes from cache OK]" << endl;
+                continue;
+            }
+
+            size_t before = classes.size();
+
             jnif::jar::JarFile uf(j.c_str());
             int csc = uf.forEach(&classes, 0, [] (void* classes, int, void* buf, int s, const char* fileNameInZip) {
                     u1* b = new u1[s];
                     memcpy(b, buf, s);
-                    JavaFile jf = { b, s, fileNameInZip };
-                    ((list<JavaFile>*)classes)->push_back(jf);
+                    addClass(classes, 0, b, s, fileNameInZip);
                 });
             cout << csc << " classes OK]" << endl;
+
+            if (useCache) {
+                jnif::jar::ClassCache::Builder builder;
+
+                auto it = classes.begin();
+                advance(it, before);
+                for (; it != classes.end(); ++it) {
+                    builder.add(it->name.c_str(), it->data, it->len);
+                }
+
+                builder.write(cachePath.c_str());
+            }
         } catch (const jnif::jar::JarException& ex) {
-            cerr << "ERROR: Can't open file" << endl;
+            cerr << "ERROR: " << ex.message << endl;
             return 1;
         }
     }
@@ -90,6 +90,47 @@ void testWriter(const JavaFile& jf) {
 	delete[] newdata;
 }
 
+void testLazyWriter(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len, true);
+
+	int newlen = cf.computeSize();
+
+	JnifError::assertEquals(newlen, jf.len);
+
+	u1* newdata = new u1[newlen];
+
+	cf.write(newdata, newlen);
+
+	assertEquals(jf.data, jf.len, newdata, newlen);
+
+	delete[] newdata;
+}
+
+void testLazyUnmodified(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len, true);
+
+	JnifError::check(!cf.isModified(), "Lazy parsed class must be unmodified");
+
+	for (Method& m : cf.methods) {
+		if (m.hasCode()) {
+			m.instList();
+		}
+	}
+
+	UnitTestClassPath cp;
+	cf.computeFrames(&cp);
+
+	JnifError::check(!cf.isModified(), "Decoded class must be unmodified");
+
+	int newlen = cf.computeSize();
+	u1* newdata = new u1[newlen];
+	cf.write(newdata, newlen);
+
+	assertEquals(jf.data, jf.len, newdata, newlen);
+
+	delete[] newdata;
+}
+
 void testAnalysis(const JavaFile& jf) {
 	ClassFileParser cf(jf.data, jf.len);
 
@@ -192,3 +233,671 @@ void testNopAdderInstrAnalysisWriter(const JavaFile& jf) {
 
 	delete[] newdata;
 }
+
+void testLazyUtf8(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	ClassFileParser lazycf(jf.data, jf.len, true);
+
+	for (ConstPool::Iterator it = cf.iterator(); it.hasNext(); it++) {
+		ConstPool::Index i = *it;
+		if (cf.isUtf8(i)) {
+			const ConstPool::Utf8& utf8 = lazycf.getUtf8Entry(i);
+			JnifError::check(!utf8.isBorrowed()
+					|| (utf8.bytes() >= (const char*) jf.data && utf8.bytes() < (const char*) jf.data + jf.len),
+					"Borrowed UTF8 must point into the class file");
+			JnifError::assertEquals(string(lazycf.getUtf8(i)), string(cf.getUtf8(i)));
+			JnifError::assertEquals(lazycf.getIndexOfUtf8(cf.getUtf8(i)), cf.getIndexOfUtf8(cf.getUtf8(i)));
+		}
+	}
+}
+
+static void addProxyConstants(ClassFile& cf) {
+	ConstPool::Index proxyClass = cf.putClass("frproxy/FrInstrProxy");
+	cf.putMethodRef(proxyClass, "enterMethod", "(Ljava/lang/String;Ljava/lang/String;)V");
+	cf.putStringFromClass(cf.thisClassIndex);
+	cf.putLong(42);
+	cf.putInteger(42);
+}
+
+void testLazyConstPoolWriter(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	ClassFileParser lazycf(jf.data, jf.len, true);
+
+	addProxyConstants(cf);
+	addProxyConstants(lazycf);
+
+	int newlen = cf.computeSize();
+	int lazylen = lazycf.computeSize();
+
+	JnifError::assertEquals(newlen, lazylen);
+
+	u1* newdata = new u1[newlen];
+	cf.write(newdata, newlen);
+
+	u1* lazydata = new u1[lazylen];
+	lazycf.write(lazydata, lazylen);
+
+	assertEquals(newdata, newlen, lazydata, lazylen);
+
+	delete[] newdata;
+	delete[] lazydata;
+}
+
+static string describeConst(const ConstPool& cp, ConstPool::Index i) {
+	stringstream ss;
+	if (i == ConstPool::NULLENTRY) {
+		return "null";
+	}
+
+	const ConstPool::Value& v = cp.getValue(i);
+	ConstPool::Tag tag = cp.getTag(i);
+	ss << tag << ":";
+	switch (tag) {
+		case ConstPool::CLASS:
+			ss << cp.getClassName(i);
+			break;
+		case ConstPool::FIELDREF:
+		case ConstPool::METHODREF:
+		case ConstPool::INTERMETHODREF:
+			ss << describeConst(cp, v.memberRef.classIndex) << "."
+					<< describeConst(cp, v.memberRef.nameAndTypeIndex);
+			break;
+		case ConstPool::STRING:
+			ss << cp.getString(i);
+			break;
+		case ConstPool::INTEGER:
+			ss << cp.getInteger(i);
+			break;
+		case ConstPool::FLOAT:
+			ss << cp.getFloat(i);
+			break;
+		case ConstPool::LONG:
+			ss << cp.getLong(i);
+			break;
+		case ConstPool::DOUBLE:
+			ss << cp.getDouble(i);
+			break;
+		case ConstPool::NAMEANDTYPE:
+			ss << cp.getUtf8(v.nameAndType.nameIndex) << ":"
+					<< cp.getUtf8(v.nameAndType.descriptorIndex);
+			break;
+		case ConstPool::UTF8:
+			ss << cp.getUtf8(i);
+			break;
+		case ConstPool::METHODHANDLE:
+			ss << (int) v.methodHandle.referenceKind << ":"
+					<< describeConst(cp, v.methodHandle.referenceIndex);
+			break;
+		case ConstPool::METHODTYPE:
+			ss << cp.getUtf8(v.methodType.descriptorIndex);
+			break;
+		case ConstPool::INVOKEDYNAMIC:
+			ss << v.invokeDynamic.bootstrapMethodAttrIndex << ":"
+					<< describeConst(cp, v.invokeDynamic.nameAndTypeIndex);
+			break;
+		default:
+			ss << "?";
+	}
+
+	return ss.str();
+}
+
+static ConstPool::Index instConst(Inst* inst) {
+	switch (inst->kind) {
+		case KIND_LDC:
+			return inst->ldc()->valueIndex;
+		case KIND_FIELD:
+			return inst->field()->fieldRefIndex;
+		case KIND_INVOKE:
+			return inst->invoke()->methodRefIndex;
+		case KIND_INVOKEINTERFACE:
+			return inst->invokeinterface()->interMethodRefIndex;
+		case KIND_INVOKEDYNAMIC:
+			return inst->indy()->callSite();
+		case KIND_TYPE:
+			return inst->type()->classIndex;
+		case KIND_MULTIARRAY:
+			return inst->multiarray()->classIndex;
+		default:
+			return ConstPool::NULLENTRY;
+	}
+}
+
+static void assertSameClass(ClassFile& expected, ClassFile& actual) {
+	JnifError::assertEquals(describeConst(actual, actual.thisClassIndex),
+			describeConst(expected, expected.thisClassIndex));
+	JnifError::assertEquals(describeConst(actual, actual.superClassIndex),
+			describeConst(expected, expected.superClassIndex));
+
+	auto em = expected.methods.begin();
+	for (Method& am : actual.methods) {
+		JnifError::assertEquals(string(actual.getUtf8(am.nameIndex)),
+				string(expected.getUtf8(em->nameIndex)));
+		JnifError::assertEquals(string(actual.getUtf8(am.descIndex)),
+				string(expected.getUtf8(em->descIndex)));
+
+		if (am.hasCode()) {
+			InstList::Iterator ei = em->instList().begin();
+			for (Inst* ai : am.instList()) {
+				Inst* e = *ei;
+				Opcode eop = e->opcode == Opcode::ldc_w ? Opcode::ldc : e->opcode;
+				Opcode aop = ai->opcode == Opcode::ldc_w ? Opcode::ldc : ai->opcode;
+				JnifError::assertEquals(aop, eop);
+				JnifError::assertEquals(describeConst(actual, instConst(ai)),
+						describeConst(expected, instConst(e)));
+				++ei;
+			}
+		}
+
+		++em;
+	}
+}
+
+void testCompactConstPool(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	if (cf.compactConstPool() < 0) {
+		return;
+	}
+
+	for (Method& m : cf.methods) {
+		if (m.hasCode()) {
+			CodeAttr* code = m.codeAttr();
+			for (Inst* inst : code->instList) {
+				JnifError::assertEquals(code->summary().has(inst->opcode) || inst->isLabel(), true,
+						"Opcode missing from summary: ", inst->opcode);
+			}
+		}
+	}
+
+	int newlen = cf.computeSize();
+	u1* newdata = new u1[newlen];
+	cf.write(newdata, newlen);
+
+	JnifError::assertEquals(newlen <= jf.len, true, "Compacted class must not grow");
+
+	{
+		ClassFileParser original(jf.data, jf.len);
+		ClassFileParser compacted(newdata, newlen);
+		assertSameClass(original, compacted);
+
+		JnifError::assertEquals(compacted.compactConstPool(), 0);
+	}
+
+	{
+		ClassFileParser lazycf(jf.data, jf.len, true);
+		lazycf.putClass("jnif/Unused");
+		lazycf.putMethodRef(lazycf.thisClassIndex, "unused", "()V");
+		lazycf.putLong(7);
+
+		JnifError::assertEquals(lazycf.compactConstPool() >= 5, true);
+
+		int lazylen = lazycf.computeSize();
+		u1* lazydata = new u1[lazylen];
+		lazycf.write(lazydata, lazylen);
+
+		assertEquals(newdata, newlen, lazydata, lazylen);
+
+		delete[] lazydata;
+	}
+
+	delete[] newdata;
+}
+
+static void assertOffsetIndex(InstList& instList, u4 codeLen) {
+	for (u4 offset = 0; offset <= codeLen; offset++) {
+		Inst* expected = nullptr;
+		for (Inst* inst : instList) {
+			if (inst->_offset == (int) offset && !inst->isLabel()) {
+				expected = inst;
+				break;
+			}
+		}
+
+		Inst* actual = instList.getInst(offset);
+		JnifError::assertEquals(expected, actual, "offset: ", offset);
+
+		if (actual != nullptr) {
+			JnifError::assertEquals(instList.getOffset(actual), (int) offset);
+		}
+	}
+}
+
+void testInstOffsetIndex(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+
+	for (Method& m : cf.methods) {
+		if (m.hasCode()) {
+			CodeAttr* code = m.codeAttr();
+			assertOffsetIndex(code->instList, code->codeLen);
+
+			code->instList.addZero(Opcode::nop, *code->instList.begin());
+		}
+	}
+
+	cf.computeSize();
+
+	for (Method& m : cf.methods) {
+		if (m.hasCode()) {
+			CodeAttr* code = m.codeAttr();
+			assertOffsetIndex(code->instList, code->codeLen + 1);
+
+			JnifError::assertEquals(code->instList.getInst(0)->opcode, Opcode::nop);
+		}
+	}
+}
+
+static Attr* findAttr(const Attrs& attrs, AttrKind kind) {
+	for (Attr* attr : attrs) {
+		if (attr->kind == kind) {
+			return attr;
+		}
+	}
+
+	return nullptr;
+}
+
+void testMemberIndex(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+
+	for (Field& f : cf.fields) {
+		JnifError::assertEquals(cf.findField(f.getName(), f.getDesc()), &f);
+		JnifError::assertEquals(cf.findField(f.nameIndex, f.descIndex), &f);
+	}
+
+	for (Method& m : cf.methods) {
+		JnifError::assertEquals(cf.findMethod(m.getName(), m.getDesc()), &m);
+		JnifError::assertEquals(cf.findMethod(m.nameIndex, m.descIndex), &m);
+
+		JnifError::assertEquals(m.attrs.get(ATTR_CODE), findAttr(m.attrs, ATTR_CODE));
+		JnifError::assertEquals(m.attrs.get(ATTR_SIGNATURE), findAttr(m.attrs, ATTR_SIGNATURE));
+
+		if (m.hasCode()) {
+			Attrs& attrs = m.codeAttr()->attrs;
+			JnifError::assertEquals(attrs.get(ATTR_SMT), findAttr(attrs, ATTR_SMT));
+			JnifError::assertEquals(attrs.get(ATTR_LNT), findAttr(attrs, ATTR_LNT));
+		}
+	}
+
+	JnifError::assertEquals(cf.findMethod("jnif$unknown", "()V"), (Method*) nullptr);
+
+	Method& m = cf.addMethod("jnif$unknown", "()V", Method::STATIC);
+	JnifError::assertEquals(cf.findMethod("jnif$unknown", "()V"), &m);
+	JnifError::assertEquals(cf.findMethod("jnif$unknown", "()I"), (Method*) nullptr);
+}
+
+static void assertSameSummary(const InstSummary& expected, const InstSummary& actual) {
+	for (int i = 0; i < 4; i++) {
+		JnifError::assertEquals(expected.opcodes[i], actual.opcodes[i]);
+	}
+
+	JnifError::assertEquals(expected.kinds, actual.kinds);
+	JnifError::assertEquals(expected.invokes, actual.invokes);
+	JnifError::assertEquals(expected.branches, actual.branches);
+	JnifError::assertEquals(expected.allocations, actual.allocations);
+	JnifError::assertEquals(expected.hasHandlers, actual.hasHandlers);
+}
+
+void testInstSummary(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	ClassFileParser lazycf(jf.data, jf.len, true);
+
+	assertSameSummary(cf.summary(), lazycf.summary());
+
+	auto it = cf.methods.begin();
+	for (Method& lazym : lazycf.methods) {
+		Method& m = *it++;
+		if (!m.hasCode()) {
+			JnifError::assertEquals(lazym.summary(), (const InstSummary*) nullptr);
+			continue;
+		}
+
+		InstSummary expected;
+		for (Inst* inst : m.instList()) {
+			expected.add(inst->opcode, inst->kind);
+		}
+		expected.hasHandlers = m.codeAttr()->hasTryCatch();
+
+		assertSameSummary(expected, *m.summary());
+		assertSameSummary(expected, *lazym.summary());
+
+		CodeAttr* lazycode = (CodeAttr*) lazym.attrs.get(ATTR_CODE);
+		JnifError::assertEquals(lazycode->isDecoded(), false);
+
+		InstList& instList = lazym.instList();
+		assertSameSummary(expected, *lazym.summary());
+
+		instList.addInvoke(Opcode::invokestatic, 1, *instList.begin());
+		JnifError::assertEquals(lazym.summary()->has(Opcode::invokestatic), true);
+		JnifError::assertEquals(lazym.summary()->invokes, expected.invokes + 1);
+	}
+}
+
+static void addProbe(ClassFile& cf, InstList& instList, ConstPool::Index nameIndex, Inst* pos) {
+	ConstPool::Index classNameIndex = cf.putString("jnif/Probed");
+	ConstPool::Index mid = cf.putMethodRef(cf.putClass("jnif/Probe"), "enter",
+			"(Ljava/lang/String;Ljava/lang/String;)V");
+
+	LabelInst* done = instList.createLabel();
+	instList.addLdc(Opcode::ldc_w, classNameIndex, pos);
+	instList.addLdc(Opcode::ldc_w, nameIndex, pos);
+	instList.addInvoke(Opcode::invokestatic, mid, pos);
+	instList.addJump(Opcode::GOTO, done, pos);
+	instList.addLabel(done, pos);
+}
+
+static const Snippet& probeSnippet() {
+	static Snippet snippet;
+	if (snippet.size() == 0) {
+		Snippet::Symbol nameIndex = snippet.param();
+		Snippet::Symbol classNameIndex = snippet.putString("jnif/Probed");
+		Snippet::Symbol mid = snippet.putMethodRef("jnif/Probe", "enter",
+				"(Ljava/lang/String;Ljava/lang/String;)V");
+
+		int done = snippet.createLabel();
+		snippet.addLdc(Opcode::ldc_w, classNameIndex);
+		snippet.addLdc(Opcode::ldc_w, nameIndex);
+		snippet.addInvoke(Opcode::invokestatic, mid);
+		snippet.addJump(Opcode::GOTO, done);
+		snippet.addLabel(done);
+	}
+
+	return snippet;
+}
+
+static void writeProbed(ClassFile& cf, bool useSnippet, vector<u1>* data) {
+	CompiledSnippet probe = probeSnippet().compile(cf);
+	for (Method& m : cf.methods) {
+		if (!m.hasCode()) {
+			continue;
+		}
+
+		InstList& instList = m.instList();
+		ConstPool::Index nameIndex = cf.putString(m.nameIndex);
+
+		vector<Inst*> positions = { *instList.begin() };
+		for (Inst* inst : instList) {
+			if (inst->isExit()) {
+				positions.push_back(inst);
+			}
+		}
+
+		for (Inst* pos : positions) {
+			if (useSnippet) {
+				instList.addSnippet(probe, pos, { nameIndex });
+			} else {
+				addProbe(cf, instList, nameIndex, pos);
+			}
+		}
+	}
+
+	data->resize(cf.computeSize());
+	cf.write(data->data(), data->size());
+}
+
+void testSnippet(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	ClassFileParser snippetcf(jf.data, jf.len);
+
+	vector<u1> expected;
+	writeProbed(cf, false, &expected);
+
+	vector<u1> actual;
+	writeProbed(snippetcf, true, &actual);
+
+	assertEquals(expected.data(), expected.size(), actual.data(), actual.size());
+
+	for (Method& m : snippetcf.methods) {
+		if (m.hasCode()) {
+			JnifError::assertEquals(m.instList().summary().has(Opcode::GOTO), true);
+		}
+	}
+}
+
+static void writeClass(ClassFile& cf, vector<u1>* data) {
+	data->resize(cf.computeSize());
+	cf.write(data->data(), data->size());
+}
+
+static void assertClone(const JavaFile& jf, bool lazy) {
+	ClassFileParser* cf = new ClassFileParser(jf.data, jf.len, lazy);
+	NopAdderInstr instr(*cf);
+
+	vector<u1> expected;
+	writeClass(*cf, &expected);
+
+	ClassFile pristine(ClassFileParser(jf.data, jf.len, lazy), nullptr);
+	ClassFile copy(*cf, nullptr);
+	JnifError::assertEquals(cf->isModified(), copy.isModified());
+
+	// The copy does not depend on the source class file.
+	delete cf;
+
+	vector<u1> actual;
+	writeClass(copy, &actual);
+	assertEquals(expected.data(), expected.size(), actual.data(), actual.size());
+
+	if (lazy) {
+		JnifError::assertEquals(false, pristine.isModified());
+	}
+
+	// Instrumenting the pristine copy gives the same class again.
+	NopAdderInstr pristineInstr(pristine);
+	writeClass(pristine, &actual);
+	assertEquals(expected.data(), expected.size(), actual.data(), actual.size());
+
+	UnitTestClassPath cp;
+	copy.computeFrames(&cp);
+	ClassFile framed(copy, nullptr);
+	writeClass(copy, &expected);
+	writeClass(framed, &actual);
+	assertEquals(expected.data(), expected.size(), actual.data(), actual.size());
+}
+
+void testClone(const JavaFile& jf) {
+	assertClone(jf, false);
+	assertClone(jf, true);
+}
+
+static void assertImage(const JavaFile& jf, bool lazy) {
+	ClassFileParser* cf = new ClassFileParser(jf.data, jf.len, lazy);
+	NopAdderInstr instr(*cf);
+
+	vector<u1> expected;
+	writeClass(*cf, &expected);
+
+	vector<u1> image;
+	cf->writeImage(&image);
+
+	// The rehydrated class file depends on the image only.
+	delete cf;
+
+	ClassFile rehydrated(image.data(), image.size(), nullptr);
+
+	vector<u1> actual;
+	writeClass(rehydrated, &actual);
+	assertEquals(expected.data(), expected.size(), actual.data(), actual.size());
+
+	UnitTestClassPath cp;
+	rehydrated.computeFrames(&cp);
+	writeClass(rehydrated, &expected);
+
+	// The rehydrated class file uses its image, so it cannot be overwritten.
+	vector<u1> framedImage;
+	rehydrated.writeImage(&framedImage);
+
+	ClassFile framed(framedImage.data(), framedImage.size(), nullptr);
+	writeClass(framed, &actual);
+	assertEquals(expected.data(), expected.size(), actual.data(), actual.size());
+}
+
+void testImage(const JavaFile& jf) {
+	assertImage(jf, false);
+	assertImage(jf, true);
+}
+
+static string str(const ConstPool::Utf8& utf8) {
+	return string(utf8.data, utf8.len);
+}
+
+static void assertSameMember(const ClassFileView& view, const ClassFileView::Member& vm,
+		const ClassFile& cf, const Member& m) {
+	JnifError::assertEquals(vm.accessFlags, m.accessFlags);
+	JnifError::assertEquals(str(view.getName(vm)), string(cf.getUtf8(m.nameIndex)));
+	JnifError::assertEquals(str(view.getDesc(vm)), string(cf.getUtf8(m.descIndex)));
+	JnifError::assertEquals(vm.attrCount, m.attrs.size());
+
+	for (u2 i = 0; i < vm.attrCount; i++) {
+		JnifError::assertEquals(view.attr(vm, i).nameIndex, (*(m.attrs.begin() + i))->nameIndex);
+	}
+}
+
+void testClassFileView(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	ClassFileParser lazycf(jf.data, jf.len, true);
+	ClassFileView view(jf.data, jf.len);
+
+	JnifError::assertEquals(view.version().majorVersion(), cf.version.majorVersion());
+	JnifError::assertEquals(view.accessFlags(), cf.accessFlags);
+	JnifError::assertEquals((u4) view.constCount(), cf.size());
+	JnifError::assertEquals(str(view.getThisClassName()), string(cf.getThisClassName()));
+
+	if (cf.superClassIndex != ConstPool::NULLENTRY) {
+		JnifError::assertEquals(str(view.getSuperClassName()), string(cf.getClassName(cf.superClassIndex)));
+	}
+
+	JnifError::assertEquals((size_t) view.interfaceCount(), (size_t) cf.interfaces.size());
+	u2 i = 0;
+	for (ConstPool::Index interIndex : cf.interfaces) {
+		JnifError::assertEquals(view.getInterface(i++), interIndex);
+	}
+
+	JnifError::assertEquals(view.fields().size(), (size_t) cf.fields.size());
+	auto fit = cf.fields.begin();
+	for (const ClassFileView::Member& vf : view.fields()) {
+		assertSameMember(view, vf, cf, *fit++);
+		JnifError::assertEquals(view.hasCode(vf), false);
+	}
+
+	JnifError::assertEquals(view.methods().size(), (size_t) cf.methods.size());
+	auto mit = cf.methods.begin();
+	auto lazyit = lazycf.methods.begin();
+	for (const ClassFileView::Member& vm : view.methods()) {
+		const Method& m = *mit++;
+		const Method& lazym = *lazyit++;
+		assertSameMember(view, vm, cf, m);
+
+		JnifError::assertEquals(view.hasCode(vm), m.hasCode());
+		if (!m.hasCode()) {
+			continue;
+		}
+
+		ClassFileView::Code code = view.getCode(vm);
+		CodeAttr* c = m.codeAttr();
+		JnifError::assertEquals(code.maxStack, c->maxStack);
+		JnifError::assertEquals(code.maxLocals, c->maxLocals);
+		JnifError::assertEquals(code.codeLen, c->codeLen);
+		JnifError::assertEquals((size_t) code.exceptionCount, (size_t) c->exceptions.size());
+		JnifError::assertEquals(code.attrCount, c->attrs.size());
+
+		// The lazy parser keeps the code bytes where the view found them.
+		CodeAttr* lazyc = (CodeAttr*) lazym.attrs.get(ATTR_CODE);
+		JnifError::assertEquals(view.data() + code.codeOffset, (const u1*) lazyc->_data);
+
+		for (u2 i = 0; i < code.attrCount; i++) {
+			JnifError::assertEquals(view.attr(code.firstAttr + i).nameIndex,
+					(*(c->attrs.begin() + i))->nameIndex);
+		}
+	}
+
+	JnifError::assertEquals(view.attrCount(), cf.attrs.size());
+	JnifError::assertEquals(view.findAttr("SourceFile") != nullptr,
+			cf.attrs.get(ATTR_SOURCEFILE) != nullptr);
+
+	// A rescanned view reports the same hierarchy entry as the model.
+	view.scan(jf.data, jf.len);
+
+	ClassHierarchy ch;
+	ch.addClass(view);
+	ClassHierarchy expected;
+	expected.addClass(cf);
+
+	const string& className = cf.getThisClassName();
+	JnifError::assertEquals(ch.getSuperClass(className), expected.getSuperClass(className));
+}
+
+/**
+ * Returns whether a utf8 constant of cf contains value, or is equal to it
+ * when whole is true.
+ */
+static bool hasUtf8(const ClassFile& cf, const string& value, bool whole) {
+	for (ConstPool::Iterator it = cf.iterator(); it.hasNext(); it++) {
+		ConstPool::Index i = *it;
+		if (cf.isUtf8(i)) {
+			const ConstPool::Utf8& utf8 = cf.getUtf8Entry(i);
+			string bytes(utf8.bytes(), utf8.length());
+			if (whole ? bytes == value : bytes.find(value) != string::npos) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void testClassFilePrefilter(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len, true);
+
+	const char* classNames[] = { "java/lang/Object", "java/util/", "java/lang/String;",
+			"jnif/NoSuchClass", cf.getThisClassName() };
+	for (const char* className : classNames) {
+		ClassFilePrefilter filter;
+		filter.addClass(className);
+		JnifError::assertEquals(filter.matches(jf.data, jf.len), hasUtf8(cf, className, false),
+				"class pattern: ", className);
+	}
+
+	const char* values[] = { "<init>", "toString", "main", "Code", "" };
+	for (const char* value : values) {
+		ClassFilePrefilter filter;
+		filter.addString(value);
+		JnifError::assertEquals(filter.matches(jf.data, jf.len), hasUtf8(cf, value, true),
+				"string pattern: ", value);
+
+		ClassFilePrefilter memberFilter;
+		memberFilter.addMember("java/lang/Object", value);
+		JnifError::assertEquals(memberFilter.matches(jf.data, jf.len),
+				hasUtf8(cf, "java/lang/Object", false) && hasUtf8(cf, value, true),
+				"member pattern: ", value);
+	}
+
+	ClassFilePrefilter filter;
+	JnifError::assertEquals(filter.matches(jf.data, jf.len), false);
+
+	filter.addClass("jnif/NoSuchClass");
+	filter.addClass(cf.getThisClassName());
+	JnifError::assertEquals(filter.matches(jf.data, jf.len), true);
+}
+
+void testLazyNopAdderInstrWriter(const JavaFile& jf) {
+	ClassFileParser cf(jf.data, jf.len);
+	ClassFileParser lazycf(jf.data, jf.len, true);
+
+	NopAdderInstr instr(cf);
+	NopAdderInstr lazyinstr(lazycf);
+
+	int newlen = cf.computeSize();
+	int lazylen = lazycf.computeSize();
+
+	JnifError::assertEquals(newlen, lazylen);
+
+	u1* newdata = new u1[newlen];
+	cf.write(newdata, newlen);
+
+	u1* lazydata = new u1[lazylen];
+	lazycf.write(lazydata, lazylen);
+
+	assertEquals(newdata, newlen, lazydata, lazylen);
+
+	delete[] newdata;
+	delete[] lazydata;
+}
@@ -22,6 +22,19 @@ public:
 void testPrinter(const JavaFile& jf);
 void testSize(const JavaFile& jf);
 void testWriter(const JavaFile& jf);
+void testLazyWriter(const JavaFile& jf);
+void testLazyUnmodified(const JavaFile& jf);
+void testLazyUtf8(const JavaFile& jf);
+void testLazyConstPoolWriter(const JavaFile& jf);
+void testCompactConstPool(const JavaFile& jf);
+void testInstOffsetIndex(const JavaFile& jf);
+void testMemberIndex(const JavaFile& jf);
+void testInstSummary(const JavaFile& jf);
+void testSnippet(const JavaFile& jf);
+void testClone(const JavaFile& jf);
+void testImage(const JavaFile& jf);
+void testClassFileView(const JavaFile& jf);
+void testClassFilePrefilter(const JavaFile& jf);
 void testAnalysis(const JavaFile& jf);
 void testAnalysisPrinter(const JavaFile& jf);
 void testAnalysisWriter(const JavaFile& jf);
@@ -30,5 +43,6 @@ void testNopAdderInstrSize(const JavaFile& jf);
 void testNopAdderInstrWriter(const JavaFile& jf);
 void testNopAdderInstrAnalysisPrinter(const JavaFile& jf);
 void testNopAdderInstrAnalysisWriter(const JavaFile& jf);
+void testLazyNopAdderInstrWriter(const JavaFile& jf);
 
 #endif
@@ -36,6 +36,342 @@ static void testConstPool() {
     assertEquals(cp.getDouble(di), 4.2);
 }
 
+static void testConstPoolIndex() {
+    ConstPool cp;
+
+    auto ai = cp.putUtf8("a");
+    auto ci = cp.putClass("java/lang/Object");
+
+    for (int i = 0; i < 200; i++) {
+        stringstream ss;
+        ss << "name" << i;
+        cp.addUtf8(ss.str().c_str());
+    }
+
+    assertEquals(cp.putUtf8("a"), ai);
+    assertEquals(cp.putClass("java/lang/Object"), ci);
+    assertEquals(string(cp.getUtf8(cp.getIndexOfUtf8("name150"))), string("name150"));
+    assertEquals(cp.getIndexOfUtf8("missing"), (ConstPool::Index) ConstPool::NULLENTRY);
+    assertEquals(cp.getIndexOfClass("missing"), (ConstPool::Index) ConstPool::NULLENTRY);
+
+    auto si = cp.addClass("java/lang/String");
+    assertEquals(cp.putClass("java/lang/String"), si);
+}
+
+static void testConstPoolIndexFull() {
+    ConstPool cp;
+
+    auto ai = cp.addUtf8("a");
+    for (int i = 0; i < 65532; i++) {
+        cp.addInteger(i);
+    }
+
+    auto li = cp.addUtf8("last");
+    auto ci = cp.addClass(li);
+
+    // The indices are built on a pool that uses every index.
+    assertEquals(cp.size(), 65536u);
+    assertEquals(ci, (ConstPool::Index) 65535);
+    assertEquals(cp.getIndexOfUtf8("a"), ai);
+    assertEquals(cp.getIndexOfUtf8("last"), li);
+    assertEquals(cp.getIndexOfUtf8("missing"), (ConstPool::Index) ConstPool::NULLENTRY);
+    assertEquals(cp.getIndexOfClass("last"), ci);
+    assertEquals(cp.putInteger(65531), (ConstPool::Index) 65533);
+}
+
+static void testCompactFullConstPool() {
+    ClassFile cf("testunit/Full");
+
+    while (cf.size() < 65534) {
+        cf.addInteger(cf.size());
+    }
+
+    Field& f = cf.addField("field", "I");
+    assertEquals(f.descIndex, (ConstPool::Index) 65535);
+
+    assertEquals(cf.compactConstPool(), 65529);
+    assertEquals(cf.size(), 7u);
+    assertEquals(string(cf.getUtf8(f.nameIndex)), string("field"));
+    assertEquals(string(cf.getUtf8(f.descIndex)), string("I"));
+}
+
+static void testConstPoolPut() {
+    ConstPool cp;
+
+    auto ci = cp.putClass("frproxy/FrInstrProxy");
+    auto mi = cp.putMethodRef(ci, "enterMethod", "(Ljava/lang/String;)V");
+    auto fi = cp.putFieldRef(ci, "count", "I");
+    auto si = cp.putString("main");
+    auto li = cp.putLong(3);
+    auto ii = cp.putInteger(3);
+    auto size = cp.size();
+
+    assertEquals(cp.putClass("frproxy/FrInstrProxy"), ci);
+    assertEquals(cp.putMethodRef(ci, "enterMethod", "(Ljava/lang/String;)V"), mi);
+    assertEquals(cp.putFieldRef(ci, "count", "I"), fi);
+    assertEquals(cp.putString("main"), si);
+    assertEquals(cp.putLong(3), li);
+    assertEquals(cp.putInteger(3), ii);
+    assertEquals(cp.size(), size);
+
+    assertEquals(cp.putStringFromClass(ci), cp.putString("frproxy/FrInstrProxy"));
+    assertEquals(cp.putDouble(-0.0) != cp.putDouble(0.0), true);
+
+    auto ai = cp.addInteger(7);
+    assertEquals(cp.putInteger(7), ai);
+}
+
+static void testAttrsIndex() {
+    ClassFile cf("testunit/Attrs");
+    ConstPool::Index nameIndex = cf.addUtf8("Signature");
+    Attrs attrs(&cf._arena);
+
+    Attr* unknown = attrs.add(cf._arena.create<UnknownAttr>(nameIndex, 0, nullptr, &cf));
+    Attr* first = attrs.add(cf._arena.create<SignatureAttr>(nameIndex, nameIndex, &cf));
+    Attr* second = attrs.add(cf._arena.create<SignatureAttr>(nameIndex, nameIndex, &cf));
+
+    assertEquals(attrs.get(ATTR_UNKNOWN), unknown);
+    assertEquals(attrs.get(ATTR_SIGNATURE), first);
+    assertEquals(attrs.get(ATTR_SOURCEFILE), (Attr*) nullptr);
+
+    attrs.remove(attrs.begin() + 1);
+    assertEquals(attrs.get(ATTR_SIGNATURE), second);
+
+    attrs.remove(attrs.begin());
+    assertEquals(attrs.get(ATTR_UNKNOWN), (Attr*) nullptr);
+    assertEquals(attrs.get(ATTR_SIGNATURE), second);
+    assertEquals(attrs.size(), (u2) 1);
+}
+
+static bool compiles(const Snippet& snippet, ClassFile& cf) {
+    try {
+        snippet.compile(cf);
+        return true;
+    } catch (const Exception&) {
+        return false;
+    }
+}
+
+static void testSnippetLabels() {
+    ClassFile cf("testunit/Snippet");
+
+    Snippet unplaced;
+    unplaced.addJump(Opcode::GOTO, unplaced.createLabel());
+    assertEquals(compiles(unplaced, cf), false);
+
+    Snippet twice;
+    int label = twice.createLabel();
+    twice.addLabel(label);
+    twice.addZero(Opcode::nop);
+    twice.addLabel(label);
+    assertEquals(compiles(twice, cf), false);
+
+    Snippet loop;
+    int start = loop.createLabel();
+    loop.createLabel();
+    loop.addLabel(start);
+    loop.addJump(Opcode::GOTO, start);
+    assertEquals(compiles(loop, cf), true);
+}
+
+static void testArena() {
+    Arena arena(16);
+
+    char* small = (char*) arena.alloc(8);
+    char* large = (char*) arena.alloc(Arena::BLOCK_SIZE + 1);
+    char* next = (char*) arena.alloc(8);
+
+    // The large allocation gets a dedicated block.
+    assertEquals(small + 8, next);
+
+    large[0] = 1;
+    large[Arena::BLOCK_SIZE] = 1;
+
+    arena.reserve(1024);
+    char* first = (char*) arena.alloc(512);
+    char* second = (char*) arena.alloc(512);
+
+    assertEquals(first + 512, second);
+
+    // The size in bytes of an allocation must not wrap around.
+    bool thrown = false;
+    try {
+        ArenaAllocator<u4>(&arena).allocate(SIZE_MAX / 4 + 2);
+    } catch (const Exception&) {
+        thrown = true;
+    }
+
+    JnifError::assert(thrown, "Overflowing allocation succeeded");
+
+    struct Owned {
+        Owned(vector<int>& deleted, int id) : deleted(deleted), id(id) {
+        }
+
+        ~Owned() {
+            deleted.push_back(id);
+        }
+
+        vector<int>& deleted;
+        int id;
+    };
+
+    vector<int> deleted;
+    {
+        Arena owner;
+        owner.own(new Owned(deleted, 1));
+        owner.own(new Owned(deleted, 2));
+
+        assertEquals(deleted.size(), (size_t) 0);
+    }
+
+    // Owned objects are deleted with the arena, the last given first.
+    assertEquals(deleted.size(), (size_t) 2);
+    assertEquals(deleted[0], 2);
+    assertEquals(deleted[1], 1);
+}
+
+static void testArenaPool() {
+    for (bool hugePages : {false, true}) {
+        ArenaPool pool(hugePages);
+
+        {
+            Arena arena(Arena::INITIAL_BLOCK_SIZE, &pool);
+            arena.alloc(pool.blockSize());
+            arena.alloc(16);
+            arena.alloc(pool.blockSize() + 1);
+        }
+
+        assertEquals(pool.freeBlocks(), 2);
+
+        {
+            ClassFile cf(&pool);
+            Method& m = cf.addMethod("main", "([Ljava/lang/String;)V", Method::STATIC | Method::PUBLIC);
+            CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+            m.attrs.add(code);
+            m.instList().addZero(Opcode::nop);
+
+            assertEquals(pool.freeBlocks(), 1);
+        }
+
+        assertEquals(pool.freeBlocks(), 2);
+    }
+
+    ArenaPool pool(false, 1);
+    {
+        Arena arena(Arena::INITIAL_BLOCK_SIZE, &pool);
+        arena.alloc(pool.blockSize());
+        arena.alloc(pool.blockSize());
+    }
+
+    // Blocks beyond maxFree are freed.
+    assertEquals(pool.freeBlocks(), 1);
+}
+
+static void testClassCache() {
+    const char* path = "testunit.jnifcache";
+
+    ClassFile cf("jnif/test/generated/Cached");
+    vector<u1> data(cf.computeSize());
+    cf.write(data.data(), data.size());
+
+    jar::ClassCache::Builder builder;
+    builder.add("jnif/test/generated/Cached.class", data.data(), data.size(), &cf);
+    builder.add("Empty.class", data.data(), 0);
+    builder.write(path);
+
+    {
+        jar::ClassCache cache(path);
+        assertEquals(cache.size(), 2);
+        assertEquals(string(cache.fileName(0)), string("jnif/test/generated/Cached.class"));
+        assertEquals(string(cache.fileName(1)), string("Empty.class"));
+        assertEquals(cache.len(0), (u4) data.size());
+        assertEquals(cache.len(1), 0u);
+        assertEquals(((uintptr_t) cache.data(0)) % 8, (uintptr_t) 0);
+
+        parser::ClassFileParser cached(cache.data(0), cache.len(0), true);
+        assertEquals(string(cached.getThisClassName()), string("jnif/test/generated/Cached"));
+
+        assertEquals(cache.image(1) == nullptr, true);
+        assertEquals(((uintptr_t) cache.image(0)) % 8, (uintptr_t) 0);
+
+        ClassFile rehydrated(cache.image(0), cache.imageLen(0), nullptr);
+        assertEquals(string(rehydrated.getThisClassName()), string("jnif/test/generated/Cached"));
+
+        vector<u1> written(rehydrated.computeSize());
+        rehydrated.write(written.data(), written.size());
+        assertEquals(written == data, true);
+
+        try {
+            ClassFile truncated(cache.image(0), cache.imageLen(0) / 2, nullptr);
+            JnifError::assert(false, "Truncated image accepted");
+        } catch (const Exception&) {
+        }
+    }
+
+    {
+        ofstream os(path, ios::binary);
+        os << "JNIFCACH";
+    }
+
+    try {
+        jar::ClassCache cache(path);
+        JnifError::assert(false, "Truncated cache accepted");
+    } catch (const jar::JarException&) {
+    }
+
+    remove(path);
+}
+
+static void testConstPoolEntries() {
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    ConstPool::Index longIndex = cf.addLong(7);
+    ConstPool::Index utf8Index = cf.addUtf8("value");
+
+    JnifError::assertEquals(cf.entries.size(), (size_t) cf.size());
+    JnifError::assertEquals(cf.entries[ConstPool::NULLENTRY].tag, ConstPool::NULLENTRY);
+
+    JnifError::assertEquals(cf.entries[cf.thisClassIndex].tag, ConstPool::CLASS);
+    JnifError::assertEquals(cf.entries[cf.thisClassIndex].clazz.nameIndex,
+                            cf.getClassNameIndex(cf.thisClassIndex));
+
+    JnifError::assertEquals(cf.entries[longIndex].tag, ConstPool::LONG);
+    JnifError::assertEquals(cf.entries[longIndex].l.value, 7l);
+    JnifError::assertEquals(cf.entries[longIndex + 1].tag, ConstPool::NULLENTRY);
+
+    ConstPool::Item item = cf.entries[utf8Index];
+    JnifError::assertEquals(item.tag, ConstPool::UTF8);
+    JnifError::assertEquals(string(item.utf8.bytes(), item.utf8.length()), string("value"));
+}
+
+static void testClassNames() {
+    assertEquals(ClassNames::intern("java/lang/Object"), (ClassNames::Symbol) ClassNames::OBJECT);
+    assertEquals(ClassNames::name(ClassNames::THROWABLE), string("java/lang/Throwable"));
+
+    // Only the given bytes are interned.
+    ClassNames::Symbol symbol = ClassNames::intern("testunit/Interned;", 17);
+    assertEquals(ClassNames::intern(string("testunit/Interned")), symbol);
+    assertEquals(ClassNames::find("testunit/Interned", 17), symbol);
+    assertEquals(ClassNames::find("testunit/Missing", 16), (ClassNames::Symbol) ClassNames::NONE);
+    assertEquals(ClassNames::name(symbol), string("testunit/Interned"));
+
+    ConstPool cp;
+    ConstPool::Index ci = cp.addClass("testunit/Interned");
+    assertEquals(cp.getClassSymbol(ci), symbol);
+
+    const Type& t = TypeFactory::objectType("testunit/Interned");
+    assertEquals(t, TypeFactory::fromConstClass(cp, ci));
+    assertEquals(t.getClassSymbol(), symbol);
+    assertEquals(t == TypeFactory::objectType(ClassNames::STRING), false);
+
+    const char* desc = "[[Ltestunit/Interned;";
+    const Type& array = TypeFactory::fromFieldDesc(desc);
+    assertEquals(array.getClassName(), string("[[Ltestunit/Interned;"));
+    assertEquals(array.elementType().elementType(), t);
+
+    const char* intDesc = "[I";
+    assertEquals(TypeFactory::fromFieldDesc(intDesc).getClassName(), string("[I"));
+}
+
 class UnitTestClassPath : public jnif::model::IClassPath {
 public:
 
@@ -79,7 +415,7 @@ static void testJoinFrameObjectAndEmpty() {
     lhs.join(rhs, &cp);
 
     Frame res;
-    res.lva.resize(2, std::make_pair(TypeFactory::topType(), std::set<Inst*>()));
+    res.lva.resize(2, Frame::T(TypeFactory::topType(), NoDefs()));
     res.setVar2(0, s, nullptr);
 
     JnifError::assertEquals(res, lhs);
@@ -101,7 +437,7 @@ static void testJoinFrameException() {
     lhs.join(rhs, &cp);
 
     Frame res;
-    res.lva.resize(2, std::make_pair(TypeFactory::topType(), std::set<Inst*>()));
+    res.lva.resize(2, Frame::T(TypeFactory::topType(), NoDefs()));
     res.setVar2(0, classType, nullptr);
 
     JnifError::assertEquals(res, lhs);
@@ -113,7 +449,7 @@ static void testJoinFrame() {
     ClassFile cf("testunit/Class", ClassFile::OBJECT);
     Method& m = cf.addMethod("method", "()Ltestunit/Class;", Method::PUBLIC | Method::STATIC);
     ConstPool::Index cidx = cf.addUtf8("Code");
-    CodeAttr* code = new CodeAttr(cidx, &cf);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cidx, &cf);
     m.attrs.add(code);
     InstList& instList = m.codeAttr()->instList;
 
@@ -160,7 +496,7 @@ static void testJoinStack() {
 
     Method& m = cf.addMethod("method", "()Ltestunit/Class;", Method::PUBLIC);
     auto cidx = cf.addUtf8("Code");
-    CodeAttr* code = new CodeAttr(cidx, &cf);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cidx, &cf);
     m.attrs.add(code);
     InstList& instList = m.codeAttr()->instList;
 
@@ -248,6 +584,288 @@ static void testJoinStack() {
     }
 }
 
+static void testComputeFramesVisits() {
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    Method& m = cf.addMethod("method", "()V", Method::PUBLIC | Method::STATIC);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+    m.attrs.add(code);
+    InstList& instList = code->instList;
+
+    // A chain of conditional jumps, deeper than a recursive analysis
+    // would like.
+    const u4 jumps = 4000;
+    for (u4 i = 0; i < jumps; i++) {
+        LabelInst* next = instList.createLabel();
+        instList.addZero(Opcode::iconst_0);
+        instList.addJump(Opcode::ifeq, next);
+        instList.addLabel(next);
+    }
+    instList.addZero(Opcode::RETURN);
+
+    UnitTestClassPath cp;
+    cf.computeFrames(&cp);
+
+    // Without back edges, each block is visited once in reverse post-order.
+    JnifError::assertEquals(jumps + 1, code->cfg->visits());
+
+    for (BasicBlock* bb : *code->cfg) {
+        if (bb != code->cfg->entry) {
+            JnifError::assertEquals(bb->in.valid, bb->visits == 1);
+        }
+    }
+}
+
+static void testBlockHandlers() {
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    Method& m = cf.addMethod("method", "()V", Method::PUBLIC | Method::STATIC);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+    m.attrs.add(code);
+    InstList& instList = code->instList;
+
+    LabelInst* tryStart = instList.createLabel();
+    tryStart->isTryStart = true;
+
+    LabelInst* tryEnd = instList.createLabel();
+
+    LabelInst* handler = instList.createLabel();
+    handler->isCatchHandler = true;
+
+    // The try range ends in the middle of straight-line code.
+    instList.addLabel(tryStart);
+    instList.addZero(Opcode::aconst_null);
+    instList.addZero(Opcode::astore_0);
+    instList.addLabel(tryEnd);
+    instList.addZero(Opcode::aconst_null);
+    instList.addZero(Opcode::astore_0);
+    instList.addZero(Opcode::RETURN);
+    instList.addLabel(handler);
+    instList.addZero(Opcode::astore_1);
+    instList.addZero(Opcode::RETURN);
+
+    code->exceptions.push_back({tryStart, tryEnd, handler, ConstPool::NULLENTRY});
+
+    UnitTestClassPath cp;
+    cf.computeFrames(&cp);
+
+    ControlFlowGraph& cfg = *code->cfg;
+    BasicBlock* tryBb = cfg.findBasicBlockOfLabel(tryStart->id);
+    JnifError::assertEquals(tryBb->handlers.size(), (size_t) 1);
+    JnifError::assertEquals(tryBb->handlers[0], 0u);
+    JnifError::assertEquals(cfg.findBasicBlockOfLabel(tryEnd->id)->handlers.empty(), true);
+
+    BasicBlock* handlerBb = cfg.findBasicBlockOfLabel(handler->id);
+    JnifError::assertEquals(handlerBb->handlers.empty(), true);
+    JnifError::assertEquals(handlerBb->visits, 1u);
+    JnifError::assertEquals(handlerBb->in.stack.size(), (size_t) 1);
+    JnifError::assertEquals(handlerBb->in.stack.back().first,
+                            TypeFactory::objectType("java/lang/Throwable"));
+}
+
+static void testDefUse() {
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    Method& m = cf.addMethod("method", "()I", Method::PUBLIC | Method::STATIC);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+    m.attrs.add(code);
+    InstList& instList = code->instList;
+
+    instList.addZero(Opcode::iconst_0);
+    Inst* def = instList.addZero(Opcode::istore_0);
+    Inst* use = instList.addZero(Opcode::iload_0);
+    instList.addZero(Opcode::ireturn);
+
+    UnitTestClassPath cp;
+
+    // Only the types are tracked by default.
+    cf.computeFrames(&cp);
+    JnifError::assertEquals(use->consumes.empty(), true);
+
+    cf.computeFrames(&cp, true);
+    JnifError::assertEquals(use->consumes.size(), (size_t) 1);
+    JnifError::assertEquals(*use->consumes.begin(), def);
+    JnifError::assertEquals(*def->produces.begin(), use);
+}
+
+static void testSwitchCfg() {
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    Method& m = cf.addMethod("method", "(I)V", Method::PUBLIC | Method::STATIC);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+    m.attrs.add(code);
+    InstList& instList = code->instList;
+
+    const int cases = 4000;
+    LabelInst* def = instList.createLabel();
+
+    instList.addZero(Opcode::iload_0);
+    TableSwitchInst* ts = instList.addTableSwitch(def, 0, cases - 1);
+
+    vector<LabelInst*> labels;
+    for (int i = 0; i < cases; i++) {
+        labels.push_back(instList.createLabel());
+        ts->addTarget(labels.back());
+    }
+
+    for (LabelInst* label : labels) {
+        instList.addLabel(label);
+        instList.addZero(Opcode::RETURN);
+    }
+
+    instList.addLabel(def);
+    instList.addZero(Opcode::RETURN);
+
+    UnitTestClassPath cp;
+    cf.computeFrames(&cp);
+
+    ControlFlowGraph& cfg = *code->cfg;
+    JnifError::assertEquals(cfg.size(), (u4) cases + 4);
+    JnifError::assertEquals(cfg.entry->name(), string(ControlFlowGraph::EntryName));
+    JnifError::assertEquals(cfg.exit->name(), string(ControlFlowGraph::ExitName));
+
+    BasicBlock* switchBb = *cfg.entry->begin();
+    JnifError::assertEquals(switchBb->name(), string("BB0"));
+    JnifError::assertEquals(switchBb->targets().size(), (u4) cases + 1);
+    JnifError::assertEquals(switchBb->targets()[0], cfg.findBasicBlockOfLabel(def->id));
+
+    for (int i = 0; i < cases; i++) {
+        BasicBlock* bb = cfg.findBasicBlockOfLabel(labels[i]->id);
+        JnifError::assertEquals(cfg.basicBlocks[bb->id], bb);
+        JnifError::assertEquals(switchBb->targets()[i + 1], bb);
+        JnifError::assertEquals(bb->ins().size(), 1u);
+        JnifError::assertEquals(bb->ins()[0], switchBb);
+        JnifError::assertEquals(bb->visits, 1u);
+    }
+
+    JnifError::assertEquals(cfg.exit->ins().size(), (u4) cases + 1);
+}
+
+static void assertOrder(const InstList& instList, const vector<Inst*>& expected) {
+    vector<Inst*> actual;
+    for (Inst* inst : instList) {
+        actual.push_back(inst);
+    }
+
+    JnifError::assert(actual == expected, "Invalid instruction order");
+    assertEquals((size_t) instList.size(), expected.size());
+
+    for (size_t i = 0; i < expected.size(); i++) {
+        assertEquals(expected[i]->prev, i == 0 ? nullptr : expected[i - 1]);
+        assertEquals(expected[i]->next, i + 1 == expected.size() ? nullptr : expected[i + 1]);
+    }
+
+    InstList::Iterator it = instList.end();
+    for (size_t i = expected.size(); i > 0; i--) {
+        --it;
+        assertEquals(*it, expected[i - 1]);
+    }
+}
+
+static void testInstListOrder() {
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    Method& m = cf.addMethod("method", "()V", Method::PUBLIC | Method::STATIC);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+    m.attrs.add(code);
+    InstList& instList = code->instList;
+
+    assertOrder(instList, {});
+
+    Inst* a = instList.addZero(Opcode::iconst_0);
+    Inst* b = instList.addZero(Opcode::iconst_1);
+    LabelInst* def = instList.createLabel();
+    Inst* ts = instList.addTableSwitch(def, 0, 0);
+    Inst* c = instList.addZero(Opcode::RETURN);
+
+    // Records are contiguous, and a switch takes two of them.
+    assertEquals((size_t) ((u1*) b - (u1*) a), InstList::RECORD_SIZE);
+    assertEquals((size_t) ((u1*) c - (u1*) ts), 2 * InstList::RECORD_SIZE);
+
+    Inst* x = instList.addZero(Opcode::nop, b);
+    Inst* y = instList.addZero(Opcode::nop, b);
+    Inst* z = instList.addZero(Opcode::nop, a);
+    instList.addLabel(def, c);
+
+    assertOrder(instList, {z, a, x, y, b, ts, def, c});
+
+    // Iterators stay valid while inserting before the current instruction.
+    vector<Inst*> expected;
+    for (Inst* inst : instList) {
+        expected.push_back(instList.addZero(Opcode::nop, inst));
+        expected.push_back(inst);
+    }
+
+    assertOrder(instList, expected);
+
+    // Inserting far from the gap, many times, also grows the buffer.
+    for (int i = 0; i < 100; i++) {
+        Inst* pos = i % 2 == 0 ? expected.front() : expected[expected.size() / 2];
+        auto at = std::find(expected.begin(), expected.end(), pos);
+        expected.insert(at, instList.addZero(Opcode::nop, pos));
+        expected.push_back(instList.addZero(Opcode::nop));
+    }
+
+    assertOrder(instList, expected);
+}
+
+static void patchSwitch(vector<u1>& data, u4 marker, int delta, u4 value) {
+    for (size_t i = 0; i + 4 <= data.size(); i++) {
+        u4 word = (data[i] << 24) | (data[i + 1] << 16) | (data[i + 2] << 8) | data[i + 3];
+        if (word == marker) {
+            i += delta;
+            data[i] = value >> 24;
+            data[i + 1] = value >> 16;
+            data[i + 2] = value >> 8;
+            data[i + 3] = value;
+            return;
+        }
+    }
+
+    JnifError::assert(false, "Switch marker not found");
+}
+
+static void testMalformedSwitch() {
+    const u4 marker = 0x11223344;
+
+    ClassFile cf("testunit/Class", ClassFile::OBJECT);
+    Method& m = cf.addMethod("method", "(I)V", Method::PUBLIC | Method::STATIC);
+    CodeAttr* code = cf._arena.create<CodeAttr>(cf.addUtf8("Code"), &cf);
+    m.attrs.add(code);
+    InstList& instList = code->instList;
+
+    LabelInst* def = instList.createLabel();
+    instList.addZero(Opcode::iload_0);
+    TableSwitchInst* ts = instList.addTableSwitch(def, marker, marker);
+    ts->addTarget(def);
+    instList.addZero(Opcode::iload_0);
+    LookupSwitchInst* ls = instList.addLookupSwitch(def, 1);
+    ls->keys.push_back(marker + 1);
+    ls->addTarget(def);
+    instList.addLabel(def);
+    instList.addZero(Opcode::RETURN);
+    code->maxStack = 1;
+    code->maxLocals = 1;
+
+    vector<u1> data(cf.computeSize());
+    cf.write(data.data(), data.size());
+
+    // The switch counts are read before their targets, so a huge count
+    // must fail on the missing bytes, not when reserving its targets.
+    vector<u1> table = data;
+    patchSwitch(table, marker, 0, 0x80000000);
+    patchSwitch(table, marker, 4, 0x7fffffff);
+
+    vector<u1> lookup = data;
+    patchSwitch(lookup, marker + 1, -4, 0x40000001);
+
+    for (const vector<u1>& malformed : {table, lookup}) {
+        bool thrown = false;
+        try {
+            parser::ClassFileParser parsed(malformed.data(), malformed.size());
+        } catch (const Exception&) {
+            thrown = true;
+        }
+
+        JnifError::assert(thrown, "Malformed switch was parsed");
+    }
+}
+
 typedef void (TestFunc)();
 
 static void run(TestFunc* testFunc, const string& testName) {
@@ -273,7 +891,24 @@ int main(int, const char* []) {
     RUN(testJoinFrameException);
     RUN(testJoinFrame);
     RUN(testJoinStack);
+    RUN(testComputeFramesVisits);
+    RUN(testBlockHandlers);
+    RUN(testDefUse);
+    RUN(testSwitchCfg);
+    RUN(testMalformedSwitch);
+    RUN(testInstListOrder);
     RUN(testConstPool);
+    RUN(testConstPoolIndex);
+    RUN(testConstPoolIndexFull);
+    RUN(testCompactFullConstPool);
+    RUN(testConstPoolPut);
+    RUN(testConstPoolEntries);
+    RUN(testClassNames);
+    RUN(testArena);
+    RUN(testAttrsIndex);
+    RUN(testSnippetLabels);
+    RUN(testArenaPool);
+    RUN(testClassCache);
 
     return 0;
 }